@@ -37,7 +37,10 @@
 #define HAVE_IOATTRS /* to enable PRINTF */
 #include <PUCA/funcattrs.h> /* for NOTNULL, PURE, PRINTF */
 #include <stdarg.h> /* for va_* */
+#include <stdatomic.h> /* for atomic_* */
 #include <stdbool.h>
+#include <stddef.h> /* for size_t */
+#include <stdint.h> /* for uint32_t, UINT32_MAX */
 #include <stdio.h> /* for FILE, fopen, fprintf, fputs */
 
 
@@ -93,6 +96,21 @@ typedef enum {
 	CLOG_FILTER_NONE = CLOG_FATAL
 } LogLevel;
 
+/**
+ * \brief The lowest priority level compiled into the logging macros.
+ *
+ * The calls to the logging macros (\a trace, \a debug, etc.) whose level is
+ * lower than this value are removed at compile-time: neither \a logmsg is
+ * called nor its arguments are evaluated.
+ *
+ * Define it before including this file (e.g. \c -DCLOG_COMPILE_LEVEL=CLOG_INFO)
+ * to strip the debugging messages from release builds; by default, no message
+ * is removed.
+ */
+#ifndef CLOG_COMPILE_LEVEL
+# define CLOG_COMPILE_LEVEL CLOG_TRACE
+#endif
+
 /**
  * \brief Defines attributes to modify the aspect of the logging output.
  */
@@ -125,6 +143,39 @@ typedef enum {
 	 */
 	CLOG_ATTR_COLORED = 0x10,
 
+	/**
+	 * \brief The message header displays the logging time, to the
+	 *        microsecond.
+	 */
+	CLOG_ATTR_TIME_US = 0x20,
+
+	/**
+	 * \brief The message header displays the logging time, to the
+	 *        nanosecond.
+	 */
+	CLOG_ATTR_TIME_NS = 0x40,
+
+	/**
+	 * \brief The message header displays the time elapsed since the
+	 *        initialization of the log system, read from a monotonic clock.
+	 *
+	 * \note The elapsed time is given in seconds, to the microsecond (or to
+	 *       the nanosecond with \a CLOG_ATTR_TIME_NS).
+	 */
+	CLOG_ATTR_UPTIME = 0x80,
+
+	/**
+	 * \brief The message header displays the id of the thread that logged
+	 *        it, and its name if set with \a clog_setthreadname.
+	 */
+	CLOG_ATTR_THREAD = 0x100,
+
+	/**
+	 * \brief The message header displays the processor the message was
+	 *        logged on.
+	 */
+	CLOG_ATTR_CPU = 0x200,
+
 	/**
 	*  \brief The message is output with time, line, function and file info.
 	*/
@@ -162,8 +213,511 @@ typedef enum {
 	 *            \a CLOG_INIT_APPEND init mode.
 	 */
 	 CLOG_FORMAT_JSON,
+
+	/**
+	 * \brief Log the messages in newline-delimited JSON: one compact object
+	 *        per line.
+	 *
+	 * \note Unlike \a CLOG_FORMAT_JSON, the records are independent: the file
+	 *       is valid at any time, and can be appended to or read while it is
+	 *       written.
+	 */
+	CLOG_FORMAT_NDJSON,
+
+	/**
+	 * \brief Log the messages in a compact binary format, to decode with the
+	 *        \c clog-decode program.
+	 *
+	 * A record holds the time, level and line of the message, the identifiers
+	 * of its file, function and format strings, which are defined once in the
+	 * log, and the arguments of the message: it is formatted when decoded.
+	 * The output attributes are the default ones of the decoding, all of
+	 * them are recorded.
+	 *
+	 * \note The strings are identified by their address, which is expected to
+	 *       be that of a string literal.
+	 *
+	 * \attention This format cannot be used with a rotated log file.
+	 */
+	CLOG_FORMAT_BINARY,
+
+	/**
+	 * \brief Log the messages as syslog records (RFC 5424), one per line.
+	 *
+	 * The time is in UTC, the file and function names, and the fields, are
+	 * structured data; the facility, application name and host of the
+	 * records are set once with \a clog_setsyslogident.
+	 */
+	CLOG_FORMAT_SYSLOG,
+
+	/**
+	 * \brief Log the messages in the native protocol of the systemd journal:
+	 *        one \c KEY=value line per field, and a blank line after each
+	 *        record.
+	 *
+	 * The file and function names are the \c CODE_* fields, and the keys of
+	 * the fields are uppercased; the time is set by the journal.
+	 */
+	CLOG_FORMAT_JOURNALD
 } OutputFormat;
 
+/**
+ * \brief Specifies what to do with a new message when the queue of the
+ *        asynchronous mode is full.
+ *
+ * \sa clog_init_async
+ */
+typedef enum {
+	/**
+	 * \brief The logging call waits for the writer thread to make room.
+	 */
+	CLOG_OVERFLOW_BLOCK,
+
+	/**
+	 * \brief The new message is discarded.
+	 */
+	CLOG_OVERFLOW_DROP_NEWEST,
+
+	/**
+	 * \brief The oldest message of the queue is discarded to make room.
+	 */
+	CLOG_OVERFLOW_DROP_OLDEST
+} OverflowPolicy;
+
+/**
+ * \brief Defines the thread lock taken by the logging functions around the
+ *        output of a message, unless lock functions are given.
+ *
+ * \sa clog_setlock
+ */
+typedef enum {
+	/**
+	 * \brief No lock is taken: the log system is used by a single thread.
+	 */
+	CLOG_LOCK_NONE,
+
+	/**
+	 * \brief A lock that spins a short while, then sleeps (on a futex on Linux).
+	 *
+	 * It costs a single atomic operation when uncontended. This is the default.
+	 */
+	CLOG_LOCK_ADAPTIVE,
+
+	/**
+	 * \brief A pthread mutex.
+	 */
+	CLOG_LOCK_MUTEX
+} LockType;
+
+/**
+ * \brief The compression of the rotated log files, or of a compressed log
+ *        file.
+ *
+ * \note The compression is only available if the library was built with it
+ *       (\c ZLIB=y or \c ZSTD=y); otherwise, the rotated files are kept
+ *       uncompressed, and a compressed file cannot be opened.
+ *
+ * \sa RotationPolicy
+ * \sa CompressionPolicy
+ */
+typedef enum {
+	/**
+	 * \brief The rotated files are not compressed.
+	 */
+	CLOG_COMPRESS_NONE,
+
+	/**
+	 * \brief The rotated files are compressed with gzip (suffix \c .gz).
+	 */
+	CLOG_COMPRESS_GZIP,
+
+	/**
+	 * \brief The rotated files are compressed with zstd (suffix \c .zst).
+	 */
+	CLOG_COMPRESS_ZSTD
+} Compression;
+
+/**
+ * \brief The transport of a socket sink.
+ *
+ * \sa clog_addsink_socket
+ */
+typedef enum {
+	/**
+	 * \brief UDP datagrams, one per record, to a \c host:port address.
+	 */
+	CLOG_SOCKET_UDP,
+
+	/**
+	 * \brief A TCP connection to a \c host:port address; the records are sent
+	 *        back to back.
+	 */
+	CLOG_SOCKET_TCP,
+
+	/**
+	 * \brief Unix domain datagrams, one per record, to the socket at a path
+	 *        (as \a CLOG_SYSLOG_SOCKET or \a CLOG_JOURNALD_SOCKET).
+	 */
+	CLOG_SOCKET_UNIX
+} SocketType;
+
+/**
+ * \brief The path of the socket of the local syslog daemon.
+ */
+#define CLOG_SYSLOG_SOCKET "/dev/log"
+
+/**
+ * \brief The path of the socket of the native protocol of the systemd journal.
+ */
+#define CLOG_JOURNALD_SOCKET "/run/systemd/journal/socket"
+
+
+/**
+ * \}
+ * \name Structures
+ * \{
+ */
+
+/**
+ * \brief An output of the log system.
+ *
+ * A sink receives the records already rendered in its output format, each one
+ * in a single call to \a write (as well as the header and footer of the
+ * format, if any).
+ *
+ * \note The functions are called with the thread lock held, or from the writer
+ *       thread in asynchronous mode.
+ *
+ * \sa clog_addsink
+ */
+typedef struct {
+	/** \brief Writes \a len bytes of \a data; the data is not terminated. */
+	void (*write)(void *userdata, const char *data, size_t len);
+
+	/** \brief Writes out the buffered data, if any (can be \c NULL). */
+	void (*flush)(void *userdata);
+
+	/** \brief Releases the sink when it is removed (can be \c NULL). */
+	void (*close)(void *userdata);
+
+	/** \brief The data passed to the functions of the sink. */
+	void *userdata;
+} LogSink;
+
+/**
+ * \brief Specifies how a log file is compressed while it is written.
+ *
+ * The records are compressed by blocks, in the thread that writes them: a
+ * block is compressed and written out to the file, in a way that can be
+ * decompressed up to there (a zlib sync flush, or the end of a zstd block),
+ * once it is full or the sink is flushed. A crash loses at most the records of
+ * the current block.
+ *
+ * \sa clog_addsink_compressed
+ */
+typedef struct {
+	/** \brief The codec (\c CLOG_COMPRESS_NONE for an uncompressed file). */
+	Compression compress;
+
+	/** \brief The compression level (\c 0 for the default of the codec): the
+	 *         higher levels trade throughput for ratio. */
+	int level;
+
+	/** \brief The size of a block, in bytes of records (\c 0 for 64 KiB). */
+	size_t block;
+} CompressionPolicy;
+
+/**
+ * \brief Specifies when a log file is rotated, and what becomes of the former
+ *        files.
+ *
+ * When the file is rotated, it is renamed with the suffix \c .1 (the former
+ * files being shifted to \c .2, \c .3, etc.) and a new file is started, with
+ * the header of its format; the footer of the format is written to the former
+ * file.
+ *
+ * The files can also be compressed while they are written: the rotated ones
+ * then get their index before the suffix of the codec (\c app.log.gz, then
+ * \c app.log.1.gz, etc.), and their size is that of their records before
+ * compression.
+ *
+ * \sa clog_addsink_rotating
+ */
+typedef struct {
+	/** \brief The size of a file, in bytes, from which it is rotated (\c 0 for
+	 *         no limit). */
+	size_t maxsize;
+
+	/** \brief The age of a file, in seconds, from which it is rotated (\c 0
+	 *         for no limit). */
+	long maxage;
+
+	/** \brief The number of rotated files kept; the older ones are removed. */
+	int keep;
+
+	/** \brief The compression of the rotated files. */
+	Compression compress;
+
+	/** \brief The compression of the files while they are written, instead of
+	 *         once rotated. */
+	CompressionPolicy stream;
+} RotationPolicy;
+
+/**
+ * \brief Specifies how the records are buffered before being written to a
+ *        sink, and when the sink is flushed.
+ *
+ * A sink with a buffer gathers its records, and writes them at once when the
+ * buffer is full or when it is flushed; flushing a sink also flushes its
+ * stream, if any. A sink is always flushed by \a clog_flush, when it is
+ * removed, and after a \c CLOG_FATAL record.
+ *
+ * The initial policy of a sink has no buffer, and only flushes the sink after
+ * the \c CLOG_FATAL records; that of a socket sink flushes it after the
+ * \c CLOG_ERROR records, and by the first record 10 ms after the last flush
+ * (in synchronous mode, the writer thread flushing it otherwise).
+ *
+ * \note A socket sink batches its records itself, and sends those of a flush
+ *       at once: the buffer is ignored for the datagram sockets, whose
+ *       records must stay apart.
+ *
+ * \sa clog_setflushpolicy
+ */
+typedef struct {
+	/** \brief The size of the buffer of the sink, in bytes (\c 0 for none: the
+	 *         records are written one by one). */
+	size_t bufsize;
+
+	/** \brief The lowest level of the records after which the sink is
+	 *         flushed. */
+	LogLevel level;
+
+	/** \brief The count of records after which the sink is flushed (\c 0 for
+	 *         no limit). */
+	unsigned int records;
+
+	/** \brief The time, in milliseconds, after which the sink is flushed by
+	 *         the next record (\c 0 for no limit). */
+	long interval;
+} FlushPolicy;
+
+/**
+ * \brief Specifies when the writer thread of the asynchronous mode writes the
+ *        records queued.
+ *
+ * The writer thread is woken up once a given count of records are queued, and
+ * otherwise writes them after a given time; in between, the records are left
+ * to gather. The records of a file or stream sink are then written together,
+ * with a single vectored write per batch of up to 64 KiB.
+ *
+ * The initial policy wakes the writer thread up for each record, and lets it
+ * sleep for 100 ms at most.
+ *
+ * \note The writer thread is always woken up by a \c CLOG_FATAL record, or
+ *       once the queue is half full.
+ *
+ * \sa clog_setbatchpolicy
+ */
+typedef struct {
+	/** \brief The count of records queued for which the writer thread is
+	 *         woken up (at least \c 1). */
+	unsigned int records;
+
+	/** \brief The time, in milliseconds, after which the records queued are
+	 *         written anyway (at least \c 1). */
+	unsigned int latency;
+} BatchPolicy;
+
+/**
+ * \brief Specifies the flight recorder: a ring of the last records, kept in
+ *        memory and written out only on demand.
+ *
+ * The records are kept in text format, from a given level, even below the
+ * filter levels; each record is truncated to 256 bytes. They are written out
+ * to a file descriptor after a \c CLOG_FATAL record, on a call to
+ * \a clog_dumprecorder, and optionally on a crash signal (\c SIGSEGV,
+ * \c SIGBUS, \c SIGILL, \c SIGFPE and \c SIGABRT), before the former
+ * handler of the signal is called.
+ *
+ * \sa clog_setrecorder
+ */
+typedef struct {
+	/** \brief The count of records kept (\c 0 disables the recorder). */
+	size_t capacity;
+
+	/** \brief The lowest level of the records kept. */
+	LogLevel level;
+
+	/** \brief The attributes of the records, in text format. */
+	OutputAttribute attrs;
+
+	/** \brief The file descriptor the records are written out to. */
+	int fd;
+
+	/** \brief Whether the records are written out on a crash signal. */
+	bool signals;
+
+	char pad[3];
+} RecorderPolicy;
+
+/**
+ * \brief The maximal count of sinks at once.
+ */
+#define CLOG_MAX_SINKS 8
+
+/**
+ * \brief The count of buckets of the histograms of the lock times: the bucket
+ *        \c i counts the times from 2^i to 2^(i+1) ns, and the last one all
+ *        the longer times.
+ */
+#define CLOG_STATS_BUCKETS 24
+
+/**
+ * \brief The statistics of the log system itself, while they were enabled.
+ *
+ * The counters of the messages are by level.
+ *
+ * \sa clog_getstats
+ */
+typedef struct {
+	/** \brief The messages output (pushed in the queue in asynchronous
+	 *         mode). */
+	unsigned long long emitted[CLOG_FATAL + 1];
+
+	/** \brief The messages filtered out by the filter levels (after they were
+	 *         sampled). */
+	unsigned long long filtered[CLOG_FATAL + 1];
+
+	/** \brief The messages discarded by the rate limit of their site. */
+	unsigned long long ratelimited[CLOG_FATAL + 1];
+
+	/** \brief The messages dropped from the queue of the asynchronous
+	 *         mode. */
+	unsigned long long dropped[CLOG_FATAL + 1];
+
+	/** \brief The bytes written to each sink, by identifier. */
+	unsigned long long written[CLOG_MAX_SINKS];
+
+	/** \brief The histogram of the times waited for the thread lock, by one
+	 *         message in 16. */
+	unsigned long long lockwait[CLOG_STATS_BUCKETS];
+
+	/** \brief The histogram of the times the thread lock was held, by one
+	 *         message in 16. */
+	unsigned long long lockhold[CLOG_STATS_BUCKETS];
+
+	/** \brief The highest count of messages in the queue of the asynchronous
+	 *         mode. */
+	size_t highwater;
+} LogStats;
+
+/**
+ * \brief The type of the value of a field.
+ *
+ * \sa LogField
+ */
+typedef enum {
+	/** \brief A signed integer. */
+	CLOG_FIELD_INT,
+
+	/** \brief An unsigned integer. */
+	CLOG_FIELD_UINT,
+
+	/** \brief A floating-point number. */
+	CLOG_FIELD_DOUBLE,
+
+	/** \brief A boolean. */
+	CLOG_FIELD_BOOL,
+
+	/** \brief A string. */
+	CLOG_FIELD_STR
+} FieldType;
+
+/**
+ * \brief A typed key-value field of a message.
+ *
+ * The fields are output after the message: as \c key=value in text format
+ * (the strings are quoted if they contain spaces, \c = or \c "), as attributes
+ * of the message in XML, as extra \c key=value columns in CSV, and as members
+ * of the record in JSON and NDJSON.
+ *
+ * \note The key must be a valid XML attribute name, and in binary format it
+ *       must be a string literal (its address identifies it).
+ *
+ * \sa clog_kv
+ */
+typedef struct {
+	/** \brief The key of the field. */
+	const char *key;
+
+	/** \brief The value of the field, as per its type. */
+	union {
+		long long i;
+		unsigned long long u;
+		double d;
+		bool b;
+		const char *s;
+	} value;
+
+	/** \brief The type of the value. */
+	FieldType type;
+
+	char pad[4];
+} LogField;
+
+/**
+ * \brief The initializers of a field, for each type of value.
+ */
+#define CLOG_INT(k, v) ((LogField) {.key = (k), .value.i = (v), \
+                                    .type = CLOG_FIELD_INT})
+#define CLOG_UINT(k, v) ((LogField) {.key = (k), .value.u = (v), \
+                                     .type = CLOG_FIELD_UINT})
+#define CLOG_DOUBLE(k, v) ((LogField) {.key = (k), .value.d = (v), \
+                                       .type = CLOG_FIELD_DOUBLE})
+#define CLOG_BOOL(k, v) ((LogField) {.key = (k), .value.b = (v), \
+                                     .type = CLOG_FIELD_BOOL})
+#define CLOG_STR(k, v) ((LogField) {.key = (k), .value.s = (v), \
+                                    .type = CLOG_FIELD_STR})
+
+/**
+ * \brief The state of a call site of the logging macros, for the rate
+ *        limiting, the sampling and the collapsing of the repeated messages.
+ *
+ * Each macro call declares its own, statically; its members are internal.
+ *
+ * \sa clog_setratelimit
+ * \sa clog_setsamplerate
+ * \sa clog_setcollapse
+ */
+typedef struct {
+	const char *file;
+	const char *func;
+	unsigned int line;
+	/* the generation of the filter levels it was resolved for, then the
+	   filter level of the site and the lowest level it logs or records (on
+	   CLOG_SITE_LEVELBITS bits each) */
+	atomic_uint filter;
+	atomic_int level; /* of the last message */
+	unsigned int rate; /* the site keeps one message in rate */
+	atomic_ullong due; /* the time the next message is due at, in ns */
+	atomic_ulong suppressed; /* the messages rate limited since the last one */
+	atomic_ullong hash; /* of the last message */
+	atomic_ulong repeats; /* of the last message, not written */
+} LogSite;
+
+/**
+ * \brief The initializer of the state of the current call site, which keeps
+ *        one message in \a rate.
+ */
+#define CLOG_SITE_SAMPLED(rate) {__FILE__, __func__, __LINE__, 0, 0, (rate), \
+                                 0, 0, 0, 0}
+
+/**
+ * \brief The initializer of the state of the current call site.
+ */
+#define CLOG_SITE CLOG_SITE_SAMPLED(1)
+#define CLOG_SITE_LEVELBITS 4
+
 
 /**
  * \}
@@ -174,6 +728,10 @@ typedef enum {
 /**
  * \brief Initializes the log system to a file.
  *
+ * \note The log system can be initialized again while other threads log: the
+ *       former main sink is closed once the logging calls under way are done
+ *       with it, as done by all the \c clog_init* functions.
+ *
  * \param[in] filename The path to the log file
  * \param[in] format   The output format
  * \param[in] attrs The OutputAttribute, or several \c OR -ed together
@@ -193,12 +751,338 @@ bool clog_init_file(const char *filename, OutputFormat format,
  */
 bool clog_init(OutputFormat format, OutputAttribute attrs);
 
+/**
+ * \brief Initializes the log system to a memory-mapped file.
+ *
+ * The file is preallocated and mapped in memory by segments of \a segsize
+ * bytes; the logging functions copy their message directly in the mapping,
+ * with no system call. The file is cut to its actual length in clog_term().
+ *
+ * \note No \c FILE is opened in this mode: clog_getlogfile() returns \c NULL.
+ *
+ * \param[in] filename The path to the log file
+ * \param[in] format   The output format
+ * \param[in] attrs    The OutputAttribute, or several \c OR -ed together
+ * \param[in] segsize  The size of a segment (rounded up to a multiple of the
+ *                     page size)
+ *
+ * \return \c true iff no error occured.
+ */
+bool clog_init_mmap(const char *filename, OutputFormat format,
+                    OutputAttribute attrs, size_t segsize);
+
+/**
+ * \brief Initializes the log system to a file that is rotated as per a policy.
+ *
+ * \param[in] filename The path to the log file
+ * \param[in] format   The output format
+ * \param[in] attrs    The OutputAttribute, or several \c OR -ed together
+ * \param[in] policy   The rotation policy
+ *
+ * \return \c true iff no error occured.
+ *
+ * \sa clog_addsink_rotating
+ */
+bool clog_init_file_rotating(const char *filename, OutputFormat format,
+                             OutputAttribute attrs,
+                             const RotationPolicy *policy) NOTNULL(1, 4);
+
+/**
+ * \brief Initializes the log system to a file compressed while it is written.
+ *
+ * \param[in] filename The path to the log file (its suffix is not added)
+ * \param[in] format   The output format
+ * \param[in] attrs    The OutputAttribute, or several \c OR -ed together
+ * \param[in] policy   The compression of the file
+ *
+ * \return \c true iff no error occured.
+ *
+ * \sa clog_addsink_compressed
+ */
+bool clog_init_file_compressed(const char *filename, OutputFormat format,
+                               OutputAttribute attrs,
+                               const CompressionPolicy *policy) NOTNULL(1, 4);
+
+/**
+ * \brief Initializes the log system to a file, in asynchronous mode.
+ *
+ * \param[in] filename The path to the log file
+ * \param[in] format   The output format
+ * \param[in] attrs    The OutputAttribute, or several \c OR -ed together
+ * \param[in] capacity The number of messages the queue can hold
+ *
+ * \return \c true iff no error occured.
+ *
+ * \sa clog_init_async
+ */
+bool clog_init_file_async(const char *filename, OutputFormat format,
+                          OutputAttribute attrs, size_t capacity);
+
+/**
+ * \brief Initializes the log system to \c stderr, in asynchronous mode.
+ *
+ * In this mode, the logging functions only push the formatted message in a
+ * bounded lock-free queue, and a dedicated thread writes them to the log file.
+ * The thread lock functions are therefore not needed.
+ *
+ * \note The capacity is rounded up to a power of two. If the system is in
+ *       asynchronous mode already, only the main sink is replaced: the queue
+ *       and its thread go on, with their former capacity.
+ *
+ * \param[in] format   The output format
+ * \param[in] attrs    The OutputAttribute, or several \c OR -ed together
+ * \param[in] capacity The number of messages the queue can hold
+ *
+ * \return \c true iff no error occured.
+ *
+ * \sa clog_setoverflowpolicy
+ */
+bool clog_init_async(OutputFormat format, OutputAttribute attrs,
+                     size_t capacity);
+
+/**
+ * \brief Initializes the log system to a file per thread.
+ *
+ * In this mode, each thread writes its messages to a shard of its own, named
+ * after the prefix and the order in which the threads first logged, e.g.
+ * \c app.log.0 and \c app.log.1. The logging functions take no lock, and the
+ * sinks are not written to.
+ *
+ * \note The shards of a binary log are merged by time with
+ * <tt>clog-decode -m</tt>.
+ *
+ * \param[in] prefix The path to the log files, before their index
+ * \param[in] format The output format
+ * \param[in] attrs  The OutputAttribute, or several \c OR -ed together
+ *
+ * \return \c true iff no error occured.
+ */
+bool clog_init_sharded(const char *prefix, OutputFormat format,
+                       OutputAttribute attrs) NOTNULL(1);
+
+/**
+ * \brief Writes out the pending messages, and flushes the sinks.
+ *
+ * In asynchronous mode, waits for the messages logged so far to be written.
+ */
+void clog_flush(void);
+
 /**
  * \brief Shuts down the log system.
+ *
+ * In asynchronous mode, the pending messages are written before. All the sinks
+ * are closed.
  */
 void clog_term(void);
 
 
+/**
+ * \}
+ * \name Sinks functions
+ * \{
+ *
+ * The messages can be output to several sinks at once, each with its own
+ * format, attributes and filter level (in addition to the global filter
+ * level); the sink set up by the initialization functions has the identifier
+ * \c 0. A message is rendered only once for all the sinks sharing the same
+ * format and attributes.
+ *
+ * \note In asynchronous mode, the messages logged before a sink is added or
+ *       removed are written out first.
+ */
+
+/**
+ * \brief Adds a sink to the log system.
+ *
+ * The header of the format, if any, is written to the sink at once.
+ *
+ * \param[in] sink   The sink functions and data (copied)
+ * \param[in] format The output format of the sink
+ * \param[in] attrs  The OutputAttribute, or several \c OR -ed together
+ * \param[in] level  The lowest level of the messages output to the sink
+ *
+ * \return The identifier of the sink, or \c -1 if there are too many sinks.
+ */
+int clog_addsink(const LogSink *sink, OutputFormat format,
+                 OutputAttribute attrs, LogLevel level) NOTNULL(1);
+
+/**
+ * \brief Adds a sink writing to a new file.
+ *
+ * \param[in] filename The path to the file
+ * \param[in] format   The output format of the sink
+ * \param[in] attrs    The OutputAttribute, or several \c OR -ed together
+ * \param[in] level    The lowest level of the messages output to the sink
+ *
+ * \return The identifier of the sink, or \c -1 on error.
+ */
+int clog_addsink_file(const char *filename, OutputFormat format,
+                      OutputAttribute attrs, LogLevel level) NOTNULL(1);
+
+/**
+ * \brief Adds a sink writing to a file that is rotated as per a policy.
+ *
+ * A background thread prepares the next file, and renames and compresses the
+ * former ones: the logging functions never wait for it. If the next file is
+ * not ready yet when the current one is due, the rotation is postponed.
+ *
+ * \param[in] filename The path to the file
+ * \param[in] format   The output format of the sink
+ * \param[in] attrs    The OutputAttribute, or several \c OR -ed together
+ * \param[in] level    The lowest level of the messages output to the sink
+ * \param[in] policy   The rotation policy
+ *
+ * \return The identifier of the sink, or \c -1 on error.
+ */
+int clog_addsink_rotating(const char *filename, OutputFormat format,
+                          OutputAttribute attrs, LogLevel level,
+                          const RotationPolicy *policy) NOTNULL(1, 5);
+
+/**
+ * \brief Adds a sink writing to a file compressed while it is written.
+ *
+ * \note The stream of the sink, as returned by \a clog_getlogfile for the
+ *       first sink, compresses what is written to it.
+ *
+ * \param[in] filename The path to the file (its suffix is not added)
+ * \param[in] format   The output format of the sink
+ * \param[in] attrs    The OutputAttribute, or several \c OR -ed together
+ * \param[in] level    The lowest level of the messages output to the sink
+ * \param[in] policy   The compression of the file
+ *
+ * \return The identifier of the sink, or \c -1 on error (or if the library
+ *         was not built with the codec).
+ */
+int clog_addsink_compressed(const char *filename, OutputFormat format,
+                            OutputAttribute attrs, LogLevel level,
+                            const CompressionPolicy *policy) NOTNULL(1, 5);
+
+/**
+ * \brief Adds a sink writing to an opened stream (e.g. \c stderr or a pipe).
+ *
+ * \note The stream is not closed with the sink.
+ *
+ * \param[in] stream The stream
+ * \param[in] format The output format of the sink
+ * \param[in] attrs  The OutputAttribute, or several \c OR -ed together
+ * \param[in] level  The lowest level of the messages output to the sink
+ *
+ * \return The identifier of the sink, or \c -1 if there are too many sinks.
+ */
+int clog_addsink_stream(FILE *stream, OutputFormat format,
+                        OutputAttribute attrs, LogLevel level) NOTNULL(1);
+
+/**
+ * \brief Adds a sink sending the records over a socket.
+ *
+ * The socket is non-blocking: the records that cannot be sent at once are
+ * queued, up to \a backlog bytes, and sent with the next ones, in a single
+ * system call (\a sendmmsg for the datagrams); the records that do not fit in
+ * the queue are dropped, and counted. A TCP connection that breaks is opened
+ * again once a second, if the format has no header; the records are dropped
+ * until then.
+ *
+ * \code
+ * clog_addsink_socket(CLOG_JOURNALD_SOCKET, CLOG_SOCKET_UNIX,
+ *                     CLOG_FORMAT_JOURNALD, CLOG_ATTR_FILE, CLOG_INFO, 0);
+ * clog_addsink_socket("logs.example.com:5140", CLOG_SOCKET_TCP,
+ *                     CLOG_FORMAT_NDJSON, CLOG_ATTR_TIME_US, CLOG_DEBUG, 0);
+ * \endcode
+ *
+ * \note The binary format can only be sent over TCP, and its connection is
+ *       not opened again. Its records are not gathered in the buffer of the
+ *       sink: after a record is dropped, the next ones define again the
+ *       strings the log uses, so that it can still be decoded.
+ *
+ * \param[in] address The \c host:port address (the host of an IPv6 address
+ *                    within brackets), or the path of a Unix socket
+ * \param[in] type    The transport of the records
+ * \param[in] format  The output format of the sink
+ * \param[in] attrs   The OutputAttribute, or several \c OR -ed together
+ * \param[in] level   The lowest level of the messages output to the sink
+ * \param[in] backlog The size of the queue, in bytes (\c 0 for 1 MiB)
+ *
+ * \return The identifier of the sink, or \c -1 on error.
+ */
+int clog_addsink_socket(const char *address, SocketType type,
+                        OutputFormat format, OutputAttribute attrs,
+                        LogLevel level, size_t backlog) NOTNULL(1);
+
+/**
+ * \brief Retrieves the count of records a sink dropped, as its queue was full,
+ *        or the segments of its memory-mapped file could not be mapped.
+ *
+ * \param[in] sink The identifier of the sink
+ *
+ * \return The count of records dropped (always \c 0 but for a socket or
+ *         memory-mapped sink).
+ */
+unsigned long clog_getsinkdrops(int sink);
+
+/**
+ * \brief Specifies the identity of the syslog and journal records.
+ *
+ * \note This must be called before the sinks in these formats are added.
+ *
+ * \param[in] app      The name of the application (\c NULL for none)
+ * \param[in] facility The syslog facility of the records (\c 1, \e user, by
+ *                     default; as \c LOG_LOCAL0 \c >> \c 3)
+ */
+void clog_setsyslogident(const char *app, int facility);
+
+/**
+ * \brief Names the calling thread, for the records of \a CLOG_ATTR_THREAD.
+ *
+ * The name is kept to its first 15 characters, and its characters other than
+ * letters, digits and punctuation that needs no escaping are replaced with
+ * \c '_'.
+ *
+ * \param[in] name The name of the thread (\c NULL or empty for none)
+ */
+void clog_setthreadname(const char *name);
+
+/**
+ * \brief Removes a sink: its footer is written, and it is closed.
+ *
+ * \param[in] sink The identifier of the sink
+ */
+void clog_removesink(int sink);
+
+/**
+ * \brief Sets the filter level of a sink.
+ *
+ * \param[in] sink  The identifier of the sink
+ * \param[in] level The lowest level of the messages output to the sink
+ */
+void clog_setsinklevel(int sink, LogLevel level);
+
+/**
+ * \brief Retrieves the filter level of a sink.
+ *
+ * \param[in] sink The identifier of the sink
+ *
+ * \return The filter level of the sink, or \c CLOG_FATAL if there is no such
+ *         sink.
+ */
+LogLevel clog_getsinklevel(int sink) PURE;
+
+/**
+ * \brief Sets how the records are buffered and flushed for a sink.
+ *
+ * The records buffered so far are written out first.
+ *
+ * \note In asynchronous mode, the writer thread also flushes the sinks each
+ *       time it has written all the pending messages.
+ *
+ * \param[in] sink   The identifier of the sink
+ * \param[in] policy The buffering and flush policy (copied)
+ *
+ * \return \c false if there is no such sink, or the buffer could not be
+ *         allocated.
+ */
+bool clog_setflushpolicy(int sink, const FlushPolicy *policy) NOTNULL(2);
+
+
 /**
  * \}
  * \name Log settings functions
@@ -208,7 +1092,9 @@ void clog_term(void);
 /**
  * \brief Retrieve the log file.
  *
- * \return The file where messages are logged.
+ * \return The file where messages are logged by the sink set up by the
+ *         initialization functions, or \c NULL if it does not write to a
+ *         stream.
  */
 FILE *clog_getlogfile(void) PURE;
 
@@ -222,6 +1108,33 @@ FILE *clog_getlogfile(void) PURE;
  */
 void clog_setfilterlevel(LogLevel filterlevel);
 
+/**
+ * \brief Sets the filter level of the files of a module.
+ *
+ * The level applies to the calls of the logging macros from the files whose
+ * path starts with \a prefix, or has it after a \c '/' (\e e.g. \c "net/"
+ * for \c src/net/socket.c), instead of the global filter level; the longest
+ * matching prefix applies. The macros resolve their level once per change of
+ * the filter levels.
+ *
+ * \param[in] prefix      The beginning of the paths of the files
+ * \param[in] filterlevel The filter level of the files
+ *
+ * \return \c true iff no error occured.
+ *
+ * \sa clog_setfilterlevel
+ */
+bool clog_setfilterlevel_for(const char *prefix, LogLevel filterlevel)
+NOTNULL(1);
+
+/**
+ * \brief Removes the filter level of the files of a module, set by
+ *        clog_setfilterlevel_for().
+ *
+ * \param[in] prefix The beginning of the paths of the files
+ */
+void clog_unsetfilterlevel_for(const char *prefix) NOTNULL(1);
+
 /**
  * \brief Retrieves the filter level.
  *
@@ -242,7 +1155,8 @@ const char *clog_getfiltername(void) PURE;
 
 
 /**
- * \brief Retrieves the output attributes.
+ * \brief Retrieves the output attributes of the sink set up by the
+ *        initialization functions.
  *
  * \return The \c OR sum of the log output attributes.
  */
@@ -250,30 +1164,50 @@ OutputAttribute clog_getoutputattrs(void) PURE;
 
 
 /**
- * \brief Retrieves the format used to log messages.
+ * \brief Retrieves the format used to log messages by the sink set up by the
+ *        initialization functions.
  *
  * \return The log output format.
  */
 OutputFormat clog_getoutputformat(void) PURE;
 
 
+/**
+ * \brief Specifies the built-in thread lock.
+ *
+ * \note The lock must not be changed while several threads log.
+ *
+ * \param[in] type The lock type (\a CLOG_LOCK_ADAPTIVE by default)
+ */
+void clog_setlocktype(LockType type);
+
+/**
+ * \brief Retrieves the type of the built-in thread lock.
+ *
+ * \return The lock type.
+ */
+LockType clog_getlocktype(void) PURE;
+
 /**
  * \brief Specifies a lock function to acquire thread lock.
  *
- * \note In a multi-threaded environment where the log file can be accessed
- *       concurrently, using this function ensure thread-safety. If the function
- *       is not called, no thread lock will be performed.
+ * \note The lock functions, if given, replace the built-in thread lock: they
+ *       are needed, along with the unlock function, if the log file is also
+ *       accessed by the program.
  *
- * \param[in] lock The function to lock the thread
+ * \param[in] lock The function to lock the thread, or \c NULL to use the
+ *                 built-in lock again
+ *
+ * \sa clog_setlocktype
  */
-void clog_setlock(void (*lock)(void*)) NOTNULL(1);
+void clog_setlock(void (*lock)(void*));
 
 /**
  * \brief Specifies the function to release the thread lock.
  *
  * \param[in] unlock The thread unlock function
  */
-void clog_setunlock(void (*unlock)(void*)) NOTNULL(1);
+void clog_setunlock(void (*unlock)(void*));
 
 /**
  * \brief Gives the parameter to pass to the thread lock and unlock functions.
@@ -291,6 +1225,164 @@ void clog_setlockuserdata(void *userdata);
 void *clog_getlockuserdata(void) PURE;
 
 
+/**
+ * \brief Specifies the behavior of the asynchronous mode when its queue is
+ *        full.
+ *
+ * The count of discarded messages, if any, is logged as a warning.
+ *
+ * \param[in] policy The overflow policy (\a CLOG_OVERFLOW_BLOCK by default)
+ */
+void clog_setoverflowpolicy(OverflowPolicy policy);
+
+/**
+ * \brief Retrieves the overflow policy of the asynchronous mode.
+ *
+ * \return The overflow policy.
+ */
+OverflowPolicy clog_getoverflowpolicy(void) PURE;
+
+
+/**
+ * \brief Specifies whether the formatting of the messages is deferred to the
+ *        writer thread, in asynchronous mode.
+ *
+ * When enabled, the logging functions only capture the arguments of the
+ * message (strings are copied), and the message is formatted when written.
+ *
+ * \note The messages whose format string uses a conversion that cannot be
+ *       captured (positional arguments, wide characters or \c %n) are still
+ *       formatted by the logging function.
+ *
+ * \param[in] deferred Whether to defer the formatting (\c false by default)
+ *
+ * \sa clog_init_async
+ */
+void clog_setdeferred(bool deferred);
+
+/**
+ * \brief Tells whether the formatting of the messages is deferred.
+ *
+ * \return \c true iff the formatting is deferred to the writer thread.
+ */
+bool clog_getdeferred(void) PURE;
+
+/**
+ * \brief Sets how the writer thread of the asynchronous mode batches the
+ *        records.
+ *
+ * \param[in] policy The batching policy (copied)
+ *
+ * \sa clog_init_async
+ */
+void clog_setbatchpolicy(const BatchPolicy *policy) NOTNULL(1);
+
+/**
+ * \brief Limits the rate of the messages of each call site of the logging
+ *        macros.
+ *
+ * A call site can log \a burst messages at once, then \a rate messages per
+ * second; the messages over the limit are discarded before being formatted.
+ * Their count is logged along with the next message of the site.
+ *
+ * \param[in] rate  The messages per second of a site (\c 0 for no limit, the
+ *                  default)
+ * \param[in] burst The messages a site can log at once (at least \c 1)
+ */
+void clog_setratelimit(unsigned int rate, unsigned int burst);
+
+/**
+ * \brief Samples the messages of a level: only one message in \a rate is kept.
+ *
+ * The messages are sampled at random by the logging macros, before anything
+ * else is done: a message that is not kept is neither formatted nor recorded.
+ * A message kept holds the rate it was sampled at, as the field
+ * \c sample_rate.
+ *
+ * \param[in] level The level of the messages
+ * \param[in] rate  The rate of the messages kept (\c 0 or \c 1 to keep all of
+ *                  them, the default)
+ *
+ * \sa clog_sampled
+ */
+void clog_setsamplerate(LogLevel level, unsigned int rate);
+
+/**
+ * \brief Retrieves the sampling rate of a level.
+ *
+ * \param[in] level The level of the messages
+ *
+ * \return The rate of the messages of the level kept (\c 1 if they all are).
+ */
+unsigned int clog_getsamplerate(LogLevel level) PURE;
+
+/**
+ * \brief Specifies whether the repetitions of a message are collapsed.
+ *
+ * When enabled, a message logged again by the same call site, with the same
+ * arguments, and with no other message in between, is not written; the count
+ * of its repetitions is logged before the next different message, as
+ * <tt>last message repeated N times</tt>.
+ *
+ * \param[in] collapse Whether to collapse the repetitions (\c false by
+ *                     default)
+ */
+void clog_setcollapse(bool collapse);
+
+/**
+ * \brief Tells whether the repetitions of a message are collapsed.
+ *
+ * \return \c true iff the repetitions are collapsed.
+ */
+bool clog_getcollapse(void) PURE;
+
+/**
+ * \brief Sets up the flight recorder, or disables it.
+ *
+ * The records kept by the former recorder, if any, are discarded.
+ *
+ * \note The recorder must not be set up while other threads log.
+ *
+ * \param[in] policy The recorder (copied), or \c NULL to disable it
+ *
+ * \return \c false if the ring could not be allocated or the signal handlers
+ *         installed; the recorder is then disabled.
+ */
+bool clog_setrecorder(const RecorderPolicy *policy);
+
+/**
+ * \brief Writes out the records of the flight recorder, from the oldest one.
+ *
+ * The records are kept: they are written out again by the next dump.
+ *
+ * \return The count of records written out.
+ */
+size_t clog_dumprecorder(void);
+
+/**
+ * \brief Enables or disables the statistics of the log system.
+ *
+ * Each thread counts its own statistics, on cache lines of its own; they are
+ * summed up when read. While they are enabled, the messages filtered out are
+ * passed to the logging functions, to be counted; the lock is timed for one
+ * message in 16 of each level, by three clock readings.
+ *
+ * \param[in] enabled Whether to collect the statistics (\c false by default)
+ *
+ * \sa clog_getstats
+ */
+void clog_setstats(bool enabled);
+
+/**
+ * \brief Retrieves the statistics of the log system.
+ *
+ * The statistics of the threads that exited are kept.
+ *
+ * \param[out] stats The statistics, summed up over all the threads
+ */
+void clog_getstats(LogStats *stats) NOTNULL(1);
+
+
 /**
  * \}
  * \name Log functions and macros
@@ -322,6 +1414,138 @@ void *clog_getlockuserdata(void) PURE;
 void logmsg(const char *file, unsigned int line, const char *func,
             LogLevel level, const char *fmt, ...) PRINTF(5, 6) NOTNULL(1, 3, 5);
 
+/**
+ * \brief Logs a message from the call site of a logging macro.
+ *
+ * The message is subject to the rate limit and to the collapsing of the
+ * repetitions of the site, unlike with \a logmsg; it was sampled by the
+ * macro already.
+ *
+ * \param[in,out] site  The state of the call site
+ * \param[in]     level The level of the message
+ * \param[in]     fmt   The string format for the message
+ * \param[in]     ...   The arguments to format
+ *
+ * \sa CLOG_MSG
+ */
+void logsite(LogSite *site, LogLevel level, const char *fmt, ...)
+PRINTF(3, 4) NOTNULL(1, 3);
+
+/**
+ * \brief Logs a message with key-value fields from the call site of a
+ *        logging macro.
+ *
+ * The message is not a format string, it is output as is; it is subject to
+ * the rate limit of the site, but not to the collapsing of the repetitions.
+ *
+ * \param[in,out] site    The state of the call site
+ * \param[in]     level   The level of the message
+ * \param[in]     msg     The message
+ * \param[in]     fields  The fields of the message
+ * \param[in]     nfields The count of fields
+ *
+ * \sa clog_kv
+ */
+void logfields(LogSite *site, LogLevel level, const char *msg,
+               const LogField *fields, size_t nfields) NOTNULL(1, 3);
+
+/* The generation of the filter levels, changed with any of them */
+extern atomic_uint _clog_filtergen;
+
+/* Resolves the filter level of a call site; returns its new state */
+unsigned int _clog_siteresolve(LogSite *site) NOTNULL(1);
+
+/* The sampling thresholds of the levels: a message is kept if a random number
+   is at most that of its level */
+extern _Atomic(uint32_t) _clog_samplethresholds[];
+
+/* The state of the random numbers of the sampling, in the thread */
+extern _Thread_local uint32_t _clog_samplestate;
+
+/* Seeds the random numbers of the sampling in the thread; returns the seed */
+uint32_t _clog_sampleseed(void);
+
+/* Tells whether a random number, drawn with a xorshift generator, is at most
+   a threshold */
+static INLINE bool _clog_sampledraw(const uint32_t threshold) {
+	uint32_t x = _clog_samplestate;
+	if(x == 0)
+		x = _clog_sampleseed();
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	_clog_samplestate = x;
+	return x <= threshold;
+}
+
+/* Tells whether a message of a level is kept by the sampling of its call site,
+   which keeps one message in rate, and that of its level */
+static INLINE bool _clog_sampled(const LogLevel level,
+                                 const unsigned int rate) {
+	if(rate > 1 && !_clog_sampledraw(UINT32_MAX / rate))
+		return false;
+	const uint32_t threshold =
+	        atomic_load_explicit(&_clog_samplethresholds[level],
+	                             memory_order_relaxed);
+	return threshold == UINT32_MAX || _clog_sampledraw(threshold);
+}
+
+/* Tells whether a call site logs or records a message of a level: the levels
+   of the site are resolved again only once the filter levels changed */
+static INLINE NOTNULL(1) bool _clog_siteenabled(LogSite *const site,
+                                                const LogLevel level) {
+	unsigned int filter = atomic_load_explicit(&site->filter,
+	                                           memory_order_relaxed);
+	const unsigned int gen = atomic_load_explicit(&_clog_filtergen,
+	                                             memory_order_relaxed);
+	if((filter ^ gen << 2 * CLOG_SITE_LEVELBITS) >> 2 * CLOG_SITE_LEVELBITS)
+		filter = _clog_siteresolve(site);
+	return (unsigned int) level
+	       >= (filter & ((1u << CLOG_SITE_LEVELBITS) - 1));
+}
+
+/**
+ * \brief Logs a message of given \a level at the call site.
+ *
+ * The message is discarded at compile-time if \a level is lower than
+ * \a CLOG_COMPILE_LEVEL.
+ *
+ * \note The macro is a statement: it declares the state of its call site.
+ *
+ * \param[in] level The level of the message
+ * \param[in] ...   The format string and optional arguments
+ *
+ * \sa logsite
+ */
+#define CLOG_MSG(level, ...) clog_sampled(level, 1, __VA_ARGS__)
+
+/**
+ * \brief Logs one message in \a rate of given \a level at the call site.
+ *
+ * The messages are sampled at random, before the call to the logging
+ * function; those kept hold the rate they were sampled at (along with that of
+ * their level), as the field \c sample_rate.
+ *
+ * \code
+ * for(size_t i = 0; i < npackets; ++i)
+ *     clog_sampled(CLOG_TRACE, 1000, "packet %zu: %u bytes", i, len[i]);
+ * \endcode
+ *
+ * \param[in] level The level of the message
+ * \param[in] rate  The rate of the messages kept, as a constant expression
+ * \param[in] ...   The format string and optional arguments
+ *
+ * \sa clog_setsamplerate
+ */
+#define clog_sampled(level, rate, ...) do {\
+	if((level) >= CLOG_COMPILE_LEVEL) {\
+		static LogSite _clog_site = CLOG_SITE_SAMPLED(rate);\
+		if(_clog_siteenabled(&_clog_site, level)\
+		   && _clog_sampled(level, rate))\
+			logsite(&_clog_site, level, __VA_ARGS__);\
+	}\
+} while(0)
+
 /**
  * \brief Logs a trace message.
  *
@@ -329,7 +1553,7 @@ void logmsg(const char *file, unsigned int line, const char *func,
  *
  * \sa logmsg
  */
-#define trace(...) logmsg(__FILE__, __LINE__, __func__, CLOG_TRACE, __VA_ARGS__)
+#define trace(...) CLOG_MSG(CLOG_TRACE, __VA_ARGS__)
 
 /**
  * \brief Logs a debugging message.
@@ -338,7 +1562,7 @@ void logmsg(const char *file, unsigned int line, const char *func,
  *
  * \sa logmsg
  */
-#define debug(...) logmsg(__FILE__, __LINE__, __func__, CLOG_DEBUG, __VA_ARGS__)
+#define debug(...) CLOG_MSG(CLOG_DEBUG, __VA_ARGS__)
 
 /**
  * \brief Logs a detailled information message.
@@ -347,8 +1571,7 @@ void logmsg(const char *file, unsigned int line, const char *func,
  *
  * \sa logmsg
  */
-#define verbose(...) logmsg(__FILE__, __LINE__, __func__, CLOG_VERBOSE,\
-                            __VA_ARGS__)
+#define verbose(...) CLOG_MSG(CLOG_VERBOSE, __VA_ARGS__)
 
 /**
  * \brief Logs a basic information message.
@@ -357,7 +1580,7 @@ void logmsg(const char *file, unsigned int line, const char *func,
  *
  * \sa logmsg
  */
-#define info(...) logmsg(__FILE__, __LINE__, __func__, CLOG_INFO, __VA_ARGS__)
+#define info(...) CLOG_MSG(CLOG_INFO, __VA_ARGS__)
 
 /**
  * \brief Logs an information message that requires attention.
@@ -366,8 +1589,7 @@ void logmsg(const char *file, unsigned int line, const char *func,
  *
  * \sa logmsg
  */
-#define notice(...) logmsg(__FILE__, __LINE__, __func__, CLOG_NOTICE,\
-                           __VA_ARGS__)
+#define notice(...) CLOG_MSG(CLOG_NOTICE, __VA_ARGS__)
 
 /**
  * \brief Logs a warning message.
@@ -376,8 +1598,7 @@ void logmsg(const char *file, unsigned int line, const char *func,
  *
  * \sa logmsg
  */
-#define warning(...) logmsg(__FILE__, __LINE__, __func__, CLOG_WARNING,\
-                            __VA_ARGS__)
+#define warning(...) CLOG_MSG(CLOG_WARNING, __VA_ARGS__)
 
 /**
  * \brief Logs an error message.
@@ -386,7 +1607,7 @@ void logmsg(const char *file, unsigned int line, const char *func,
  *
  * \sa logmsg
  */
-#define error(...) logmsg(__FILE__, __LINE__, __func__, CLOG_ERROR, __VA_ARGS__)
+#define error(...) CLOG_MSG(CLOG_ERROR, __VA_ARGS__)
 
 /**
  * \brief Logs a fatal error message.
@@ -397,7 +1618,36 @@ void logmsg(const char *file, unsigned int line, const char *func,
  *
  * \sa logmsg
  */
-#define fatal(...) logmsg(__FILE__, __LINE__, __func__, CLOG_FATAL, __VA_ARGS__)
+#define fatal(...) CLOG_MSG(CLOG_FATAL, __VA_ARGS__)
+
+/**
+ * \brief Logs a message with key-value fields, of given \a level, at the call
+ *        site.
+ *
+ * \code
+ * clog_kv(CLOG_INFO, "request served", CLOG_STR("req", id),
+ *         CLOG_UINT("latency_us", latency));
+ * \endcode
+ *
+ * \note The fields are evaluated only if the message is logged.
+ *
+ * \param[in] level The level of the message
+ * \param[in] msg   The message, output as is
+ * \param[in] ...   The fields, given with \c CLOG_INT, \c CLOG_STR, etc.
+ *
+ * \sa logfields
+ */
+#define clog_kv(level, msg, ...) do {\
+	if((level) >= CLOG_COMPILE_LEVEL) {\
+		static LogSite _clog_site = CLOG_SITE;\
+		if(_clog_siteenabled(&_clog_site, level)\
+		   && _clog_sampled(level, 1)) {\
+			const LogField _clog_fields[] = {__VA_ARGS__};\
+			logfields(&_clog_site, level, msg, _clog_fields,\
+			          sizeof _clog_fields / sizeof *_clog_fields);\
+		}\
+	}\
+} while(0)
 
 
 /**
@@ -0,0 +1,320 @@
+#define _POSIX_C_SOURCE 200809L /* for strnlen */
+
+#include "args.h"
+
+#include <stdatomic.h> /* for atomic_*, _Atomic */
+#include <stdbool.h>
+#include <stdint.h> /* for intmax_t, uintptr_t */
+#include <stdio.h> /* for snprintf */
+#include <stdlib.h> /* for malloc, free */
+#include <string.h> /* for memcpy, strchr, strlen, strnlen */
+
+#include <PUCA/funcattrs.h> /* for INLINE, NOTNULL */
+
+
+
+#define ARG_NONE (-1) /* for "%%" */
+
+/* A conversion specification, e.g. "%-*.3lu" */
+struct conv {
+	int len; /* '%' included */
+	int type;
+	int prec;
+	int nstars; /* arguments given for width and precision */
+};
+#define CONV_MAXLEN 32
+
+/* The specifications are kept for the life of the process: the records in
+   flight and the threads logging may use them at any time */
+#define SPECS_SIZE 1024 /* power of two */
+static _Atomic(struct argspec*) _specs[SPECS_SIZE];
+
+
+static INLINE bool _isdigit(const char c) {
+	return '0' <= c && c <= '9';
+}
+
+/* Decodes the conversion specification at f; returns the position past it, or
+   NULL if it is not supported */
+static const char *_parseconv(const char *f, struct conv *const c) {
+	const char *const start = f++;
+	c->type = ARG_NONE;
+	c->prec = ARG_NOPREC;
+	c->nstars = 0;
+	if(*f == '%') {
+		c->len = 2;
+		return f + 1;
+	}
+
+	/* flags */
+	while(*f && strchr("-+ #0'", *f))
+		++f;
+	/* width */
+	if(*f == '*') {
+		++c->nstars;
+		++f;
+	} else {
+		while(_isdigit(*f))
+			++f;
+		if(*f == '$')
+			return NULL; /* positional argument */
+	}
+	/* precision */
+	if(*f == '.') {
+		if(*++f == '*') {
+			++c->nstars;
+			c->prec = ARG_STARPREC;
+			++f;
+		} else {
+			c->prec = 0;
+			while(_isdigit(*f))
+				c->prec = 10 * c->prec + *f++ - '0';
+		}
+	}
+	/* length modifier */
+	char len = '\0';
+	switch(*f) {
+		case 'h':
+		case 'l':
+			len = *f++;
+			if(*f == len) {
+				len = (char) (len == 'h' ? 'H' : 'L'); /* hh, ll */
+				++f;
+			} else if(len == 'h') {
+				len = '\0'; /* promoted to int */
+			}
+			break;
+		case 'j':
+		case 'z':
+		case 't':
+			len = *f++;
+			break;
+		case 'L':
+			len = 'D'; /* long double */
+			++f;
+			break;
+		default: break;
+	}
+	/* conversion specifier */
+	switch(*f++) {
+		case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+			switch(len) {
+				case '\0': case 'H': c->type = ARG_INT; break;
+				case 'l': c->type = ARG_LONG; break;
+				case 'L': c->type = ARG_LLONG; break;
+				case 'j': c->type = ARG_INTMAX; break;
+				case 'z': c->type = ARG_SIZE; break;
+				case 't': c->type = ARG_PTRDIFF; break;
+				default: return NULL;
+			}
+			break;
+		case 'c':
+			if(len != '\0')
+				return NULL; /* wint_t */
+			c->type = ARG_INT;
+			break;
+		case 'f': case 'F': case 'e': case 'E':
+		case 'g': case 'G': case 'a': case 'A':
+			if(len == 'D')
+				c->type = ARG_LDOUBLE;
+			else if(len == '\0' || len == 'l')
+				c->type = ARG_DOUBLE;
+			else
+				return NULL;
+			break;
+		case 's':
+			if(len != '\0')
+				return NULL; /* wchar_t* */
+			c->type = ARG_STRING;
+			break;
+		case 'p':
+			c->type = ARG_POINTER;
+			break;
+		default:
+			return NULL; /* %n, extensions, or end of string */
+	}
+	c->len = (int) (f - start);
+	return c->len < CONV_MAXLEN ? f : NULL;
+}
+
+static struct argspec *_parse(const char *const fmt) {
+	size_t n = 0;
+	struct conv c;
+	for(const char *f = fmt; (f = strchr(f, '%')) != NULL;) {
+		if((f = _parseconv(f, &c)) == NULL) {
+			n = ARGS_UNSUPPORTED;
+			break;
+		}
+		n += (size_t) c.nstars + (c.type != ARG_NONE);
+	}
+
+	const size_t nitems = n == ARGS_UNSUPPORTED ? 0 : n;
+	struct argspec *const s = malloc(sizeof *s + nitems * sizeof *s->items);
+	if(s == NULL)
+		return NULL;
+	s->fmt = fmt;
+	s->nargs = n;
+	struct argitem *item = s->items;
+	for(const char *f = fmt; nitems && (f = strchr(f, '%')) != NULL;) {
+		f = _parseconv(f, &c);
+		for(int i = 0; i < c.nstars; ++i, ++item) {
+			item->type = ARG_INT;
+			item->prec = ARG_NOPREC;
+		}
+		if(c.type != ARG_NONE) {
+			item->type = c.type;
+			item->prec = c.prec;
+			++item;
+		}
+	}
+	return s;
+}
+
+const struct argspec *_clog_argspec(const char *const fmt) {
+	size_t i = ((uintptr_t) fmt >> 3) & (SPECS_SIZE - 1);
+	for(size_t probe = 0; probe < SPECS_SIZE; ++probe) {
+		struct argspec *s = atomic_load_explicit(&_specs[i],
+		                                         memory_order_acquire);
+		if(s == NULL) {
+			struct argspec *const new = _parse(fmt);
+			if(new == NULL)
+				return NULL;
+			if(atomic_compare_exchange_strong_explicit(&_specs[i], &s, new,
+			                                           memory_order_acq_rel,
+			                                           memory_order_acquire))
+				return new;
+			/* another thread took the entry first; s is its value */
+			free(new);
+		}
+		if(s->fmt == fmt)
+			return s;
+		i = (i + 1) & (SPECS_SIZE - 1);
+	}
+	return NULL;
+}
+
+struct argspec *_clog_parseargspec(const char *const fmt) {
+	return _parse(fmt);
+}
+
+
+#define PUT(T, v) do {\
+	const T _v = (v);\
+	if(len + sizeof _v <= size)\
+		memcpy(out + len, &_v, sizeof _v);\
+	len += sizeof _v;\
+} while(0)
+
+size_t _clog_capture(char *const out, const size_t size,
+                     const struct argspec *const spec, va_list args) {
+	size_t len = 0;
+	int last = 0; /* the value of a star precision */
+	for(size_t i = 0; i < spec->nargs; ++i) {
+		switch(spec->items[i].type) {
+			case ARG_INT:
+				last = va_arg(args, int);
+				PUT(int, last);
+				break;
+			case ARG_LONG: PUT(long, va_arg(args, long)); break;
+			case ARG_LLONG: PUT(long long, va_arg(args, long long)); break;
+			case ARG_INTMAX: PUT(intmax_t, va_arg(args, intmax_t)); break;
+			case ARG_SIZE: PUT(size_t, va_arg(args, size_t)); break;
+			case ARG_PTRDIFF: PUT(ptrdiff_t, va_arg(args, ptrdiff_t)); break;
+			case ARG_DOUBLE: PUT(double, va_arg(args, double)); break;
+			case ARG_LDOUBLE:
+				PUT(long double, va_arg(args, long double));
+				break;
+			case ARG_POINTER: PUT(void*, va_arg(args, void*)); break;
+			case ARG_STRING: {
+				const char *str = va_arg(args, const char*);
+				if(str == NULL)
+					str = "(null)";
+				const int prec = spec->items[i].prec == ARG_STARPREC
+				                 ? last : spec->items[i].prec;
+				/* with a precision, the string may not be null-terminated */
+				const size_t n = prec >= 0 ? strnlen(str, (size_t) prec)
+				                           : strlen(str);
+				if(len + n + 1 <= size) {
+					memcpy(out + len, str, n);
+					out[len + n] = '\0';
+				}
+				len += n + 1;
+				break;
+			}
+			default: break;
+		}
+	}
+	return len;
+}
+
+
+#define CONVERT(v) (c.nstars == 0 ? snprintf(o, room, spec, v)\
+                    : c.nstars == 1 ? snprintf(o, room, spec, stars[0], v)\
+                    : snprintf(o, room, spec, stars[0], stars[1], v))
+#define GET(T) do {\
+	T _v;\
+	memcpy(&_v, packed, sizeof _v);\
+	packed += sizeof _v;\
+	n = CONVERT(_v);\
+} while(0)
+
+int _clog_expand(char *const out, const size_t size, const char *fmt,
+                 const char *packed) {
+	size_t len = 0;
+	for(;;) {
+		const char *const pct = strchr(fmt, '%');
+		const size_t lit = pct ? (size_t) (pct - fmt) : strlen(fmt);
+		if(len < size)
+			memcpy(out + len, fmt, lit < size - len ? lit : size - len);
+		len += lit;
+		if(pct == NULL)
+			break;
+
+		struct conv c;
+		fmt = _parseconv(pct, &c);
+		if(fmt == NULL)
+			return -1;
+		if(c.type == ARG_NONE) {
+			if(len < size)
+				out[len] = '%';
+			++len;
+			continue;
+		}
+
+		char spec[CONV_MAXLEN];
+		memcpy(spec, pct, (size_t) c.len);
+		spec[c.len] = '\0';
+		int stars[2];
+		for(int i = 0; i < c.nstars; ++i) {
+			memcpy(&stars[i], packed, sizeof *stars);
+			packed += sizeof *stars;
+		}
+		char *const o = len < size ? out + len : NULL;
+		const size_t room = len < size ? size - len : 0;
+		int n;
+		switch(c.type) {
+			case ARG_INT: GET(int); break;
+			case ARG_LONG: GET(long); break;
+			case ARG_LLONG: GET(long long); break;
+			case ARG_INTMAX: GET(intmax_t); break;
+			case ARG_SIZE: GET(size_t); break;
+			case ARG_PTRDIFF: GET(ptrdiff_t); break;
+			case ARG_DOUBLE: GET(double); break;
+			case ARG_LDOUBLE: GET(long double); break;
+			case ARG_POINTER: GET(void*); break;
+			case ARG_STRING: {
+				const char *const str = packed;
+				packed += strlen(str) + 1;
+				n = CONVERT(str);
+				break;
+			}
+			default: return -1;
+		}
+		if(n < 0)
+			return n;
+		len += (size_t) n;
+	}
+	if(size)
+		out[len < size ? len : size - 1] = '\0';
+	return (int) len;
+}
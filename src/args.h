@@ -0,0 +1,129 @@
+/**
+ * \file args.h
+ * \author joH1
+ * \version 0.1
+ *
+ * Internal functions to capture the arguments of a log message in a packed
+ * binary form, and to format the message from them later.
+ *
+ * Each argument is stored with its natural size, not aligned; the strings are
+ * copied (up to the precision of the conversion, if any) with their
+ * terminating null character.
+ */
+
+#ifndef CLOG_ARGS_H
+#define CLOG_ARGS_H
+
+#include <stdarg.h> /* for va_list */
+#include <stddef.h> /* for size_t */
+
+#include <PUCA/funcattrs.h> /* for NOTNULL */
+
+
+
+/**
+ * \brief The type of an argument, as read from a \c va_list.
+ */
+enum argtype {
+	ARG_INT,
+	ARG_LONG,
+	ARG_LLONG,
+	ARG_INTMAX,
+	ARG_SIZE,
+	ARG_PTRDIFF,
+	ARG_DOUBLE,
+	ARG_LDOUBLE,
+	ARG_STRING,
+	ARG_POINTER
+};
+
+/**
+ * \brief A precision value for string arguments: none given, or given as an
+ *        argument (the previous one).
+ */
+#define ARG_NOPREC (-1)
+#define ARG_STARPREC (-2)
+
+/**
+ * \brief An argument, as decoded from the format string.
+ */
+struct argitem {
+	int type;
+	int prec; /* for ARG_STRING only */
+};
+
+/**
+ * \brief The arguments expected by a format string.
+ */
+struct argspec {
+	const char *fmt;
+	size_t nargs;
+	struct argitem items[];
+};
+
+/**
+ * \brief The value of \c nargs for a format string using a conversion that is
+ *        not supported (positional arguments, wide characters, \c %n).
+ */
+#define ARGS_UNSUPPORTED ((size_t) -1)
+
+
+/**
+ * \brief Retrieves the arguments expected by a format string.
+ *
+ * The format string is decoded once, and its specification is cached by
+ * address.
+ *
+ * \param[in] fmt The format string
+ *
+ * \return The arguments specification, or \c NULL if it cannot be cached.
+ */
+const struct argspec *_clog_argspec(const char *fmt) NOTNULL(1);
+
+/**
+ * \brief Decodes the arguments expected by a format string, with no cache.
+ *
+ * For the format strings whose address does not identify them, as those
+ * copied to a buffer that is reused.
+ *
+ * \param[in] fmt The format string
+ *
+ * \return The arguments specification, to release with \c free, or \c NULL
+ *         if it cannot be allocated.
+ */
+struct argspec *_clog_parseargspec(const char *fmt) NOTNULL(1);
+
+/**
+ * \brief Captures the arguments of a log message.
+ *
+ * \param[out] out  The output buffer
+ * \param[in]  size The size of the output buffer
+ * \param[in]  spec The arguments specification (must be supported)
+ * \param[in]  args The arguments
+ *
+ * \return The size of the packed arguments. If it is larger than \a size, the
+ *         output buffer was too small and its contents are undefined.
+ */
+size_t _clog_capture(char *out, size_t size, const struct argspec *spec,
+                     va_list args) NOTNULL(3);
+
+/**
+ * \brief Formats a message from its packed arguments.
+ *
+ * This function behaves as \a snprintf.
+ *
+ * \param[out] out    The output buffer
+ * \param[in]  size   The size of the output buffer
+ * \param[in]  fmt    The format string
+ * \param[in]  packed The packed arguments, as output by \a _clog_capture
+ *
+ * \return The length of the formatted message, or a negative value on error.
+ */
+int _clog_expand(char *out, size_t size, const char *fmt, const char *packed)
+NOTNULL(3);
+
+
+#include <PUCA/end.h>
+
+
+#endif /* CLOG_ARGS_H */
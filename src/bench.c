@@ -0,0 +1,492 @@
+#define _POSIX_C_SOURCE 200809L /* for clock_gettime, getopt, pipe, fdopen */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#include "clog.h"
+
+/*
+ * Measures the latency of the logging calls, and the throughput of the log
+ * system, for a configuration given on the command line:
+ *   -f format  TEXT, XML, CSV, JSON or NDJSON
+ *   -a attrs   see _attrsets
+ *   -o output  null, file or pipe
+ *   -t threads the number of logging threads
+ *   -m mode    sync, async or sharded (to a file per thread, the output is
+ *              ignored)
+ *   -l lock    the lock in sync mode: adaptive, mutex (built in) or user (a
+ *              pthread mutex given as lock functions)
+ *   -n count   the number of messages per thread
+ *   -s string  the string in the messages: text, clean or escaped (with
+ *              characters escaped in JSON and XML)
+ *   -F         the messages are filtered out
+ *   -b size    the stream is unbuffered (as stderr), and the sink buffers
+ *              size bytes (0 for none), flushed on errors
+ *   -B n:ms    in async mode, the writer thread is woken up for n records,
+ *              or after ms milliseconds
+ *   -S         the statistics of the log system are collected
+ * or for a set of configurations covering all of them if none is given.
+ */
+
+#define BENCH_FILE "bench.log"
+#define ASYNC_CAPACITY 4096
+
+struct attrset {
+	const char *name;
+	OutputAttribute attrs;
+	char pad[4];
+};
+static const struct attrset _attrsets[] = {
+	{"MINIMAL", CLOG_ATTR_MINIMAL, ""},
+	{"TIME", CLOG_ATTR_TIME, ""},
+	{"TIME_US", CLOG_ATTR_TIME_US, ""},
+	{"TIME_NS", CLOG_ATTR_TIME_NS, ""},
+	{"UPTIME", CLOG_ATTR_UPTIME, ""},
+	{"FILE", CLOG_ATTR_FILE, ""},
+	{"FUNC", CLOG_ATTR_FUNC, ""},
+	{"THREAD", CLOG_ATTR_THREAD, ""},
+	{"CPU", CLOG_ATTR_CPU, ""},
+	{"COLORED", CLOG_ATTR_COLORED, ""},
+	{"VERBOSE", CLOG_ATTR_VERBOSE, ""},
+	{"ALL", CLOG_ATTR_VERBOSE | CLOG_ATTR_TIME_NS | CLOG_ATTR_UPTIME
+	        | CLOG_ATTR_COLORED, ""}
+};
+#define NATTRSETS (sizeof _attrsets / sizeof *_attrsets)
+
+static const char *const _formatnames[] = {
+	[CLOG_FORMAT_TEXT] = "TEXT",
+	[CLOG_FORMAT_XML] = "XML",
+	[CLOG_FORMAT_CSV] = "CSV",
+	[CLOG_FORMAT_JSON] = "JSON",
+	[CLOG_FORMAT_NDJSON] = "NDJSON",
+	[CLOG_FORMAT_BINARY] = "BINARY"
+};
+#define NFORMATS (sizeof _formatnames / sizeof *_formatnames)
+
+enum output {
+	OUTPUT_NULL,
+	OUTPUT_FILE,
+	OUTPUT_PIPE
+};
+static const char *const _outputnames[] = {
+	[OUTPUT_NULL] = "null",
+	[OUTPUT_FILE] = "file",
+	[OUTPUT_PIPE] = "pipe"
+};
+#define NOUTPUTS (sizeof _outputnames / sizeof *_outputnames)
+
+/* The clean and escaped strings are of the same length */
+static const char *const _stringnames[] = {"text", "clean", "escaped"};
+static const char *const _strings[] = {
+	"text",
+	"a message of some plain words, as long as the other one!!!",
+	"a <message> of \"quoted\" words & tags, as long as the other"
+};
+#define NSTRINGS (sizeof _strings / sizeof *_strings)
+
+enum mode {
+	MODE_SYNC,
+	MODE_ASYNC,
+	MODE_SHARDED
+};
+static const char *const _modenames[] = {
+	[MODE_SYNC] = "sync",
+	[MODE_ASYNC] = "async",
+	[MODE_SHARDED] = "sharded"
+};
+#define NMODES (sizeof _modenames / sizeof *_modenames)
+
+/* The built-in locks, then the user functions */
+#define LOCK_USER (CLOG_LOCK_MUTEX + 1)
+static const char *const _locknames[] = {
+	[CLOG_LOCK_NONE] = "none",
+	[CLOG_LOCK_ADAPTIVE] = "adaptive",
+	[CLOG_LOCK_MUTEX] = "mutex",
+	[LOCK_USER] = "user"
+};
+#define NLOCKS (sizeof _locknames / sizeof *_locknames)
+
+struct config {
+	size_t nmsgs;
+	long bufsize; /* of the sink, or -1 to keep the buffer of the stream */
+	BatchPolicy batch; /* in async mode */
+	OutputFormat fmt;
+	int attrset;
+	int output;
+	int nthreads;
+	int string;
+	int mode;
+	int lock;
+	bool filtered;
+	bool stats;
+	char pad[6];
+};
+
+struct worker {
+	pthread_t thread;
+	long long *lat;
+	size_t nmsgs;
+	const char *string;
+	bool filtered;
+	char pad[7];
+};
+
+static pthread_barrier_t _start;
+static pthread_mutex_t _mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+static long long _now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* The count of write system calls of the process so far, or -1 if the kernel
+   does not account them */
+static long long _writecalls(void) {
+	FILE *const f = fopen("/proc/self/io", "r");
+	long long n = -1;
+	if(f == NULL)
+		return n;
+	char line[64];
+	while(fgets(line, sizeof line, f) && sscanf(line, "syscw: %lld", &n) != 1);
+	fclose(f);
+	return n;
+}
+
+static int _cmplat(const void *const a, const void *const b) {
+	const long long x = *(const long long*) a, y = *(const long long*) b;
+	return (x > y) - (x < y);
+}
+
+static void _lock(void *const m) {
+	pthread_mutex_lock(m);
+}
+
+static void _unlock(void *const m) {
+	pthread_mutex_unlock(m);
+}
+
+static void *_drain(void *const fd) {
+	char buf[65536];
+	while(read(*(int*) fd, buf, sizeof buf) > 0);
+	return NULL;
+}
+
+static void *_work(void *const u) {
+	struct worker *const w = u;
+	pthread_barrier_wait(&_start);
+	for(size_t i = 0; i < w->nmsgs; ++i) {
+		const long long t0 = _now();
+		if(w->filtered)
+			trace("bench message %zu: %s %d", i, w->string, 42);
+		else
+			info("bench message %zu: %s %d", i, w->string, 42);
+		w->lat[i] = _now() - t0;
+	}
+	return NULL;
+}
+
+
+/* The cost of one clock reading, included in the latencies */
+static long long _clockcost(void) {
+	long long lat[1001];
+	for(int i = 0; i < 1001; ++i) {
+		const long long t0 = _now();
+		lat[i] = _now() - t0;
+	}
+	qsort(lat, 1001, sizeof *lat, _cmplat);
+	return lat[500];
+}
+
+static bool _run(const struct config *const c) {
+	int fds[2] = {-1, -1};
+	pthread_t drainer;
+	FILE *f;
+	switch(c->output) {
+		case OUTPUT_NULL:
+			f = fopen("/dev/null", "w");
+			break;
+		case OUTPUT_FILE:
+			f = fopen(BENCH_FILE, "w");
+			break;
+		default:
+			if(pipe(fds) != 0)
+				return false;
+			f = fdopen(fds[1], "w");
+			pthread_create(&drainer, NULL, _drain, &fds[0]);
+			break;
+	}
+	if(f == NULL)
+		return false;
+
+	const OutputAttribute attrs = _attrsets[c->attrset].attrs;
+	if(c->mode == MODE_SHARDED) {
+		clog_init_sharded(BENCH_FILE, c->fmt, attrs);
+	} else {
+		if(c->mode == MODE_ASYNC) {
+			clog_init_async(c->fmt, attrs, ASYNC_CAPACITY);
+			clog_removesink(0); /* to stderr */
+			clog_setbatchpolicy(&c->batch);
+		}
+		if(c->bufsize >= 0)
+			setvbuf(f, NULL, _IONBF, 0);
+		const int sink = clog_addsink_stream(f, c->fmt, attrs, CLOG_TRACE);
+		if(c->bufsize > 0) {
+			const FlushPolicy flush = {(size_t) c->bufsize, CLOG_ERROR, 0, 0};
+			clog_setflushpolicy(sink, &flush);
+		}
+	}
+	clog_setfilterlevel(c->filtered ? CLOG_INFO : CLOG_TRACE);
+	clog_setstats(c->stats);
+	if(c->lock == LOCK_USER) {
+		clog_setlock(_lock);
+		clog_setunlock(_unlock);
+		clog_setlockuserdata(&_mutex);
+	} else {
+		clog_setlock(NULL);
+		clog_setunlock(NULL);
+		clog_setlocktype((LockType) c->lock);
+	}
+
+	const size_t n = c->nmsgs * (size_t) c->nthreads;
+	long long *const lat = malloc(n * sizeof *lat);
+	struct worker *const w = calloc((size_t) c->nthreads, sizeof *w);
+	if(lat == NULL || w == NULL) {
+		free(lat);
+		free(w);
+		clog_term();
+		fclose(f);
+		return false;
+	}
+	pthread_barrier_init(&_start, NULL, (unsigned int) c->nthreads + 1);
+	for(int i = 0; i < c->nthreads; ++i) {
+		w[i].lat = lat + (size_t) i * c->nmsgs;
+		w[i].nmsgs = c->nmsgs;
+		w[i].string = _strings[c->string];
+		w[i].filtered = c->filtered;
+		pthread_create(&w[i].thread, NULL, _work, &w[i]);
+	}
+	const long long calls = _writecalls();
+	pthread_barrier_wait(&_start);
+	const long long t0 = _now();
+	for(int i = 0; i < c->nthreads; ++i)
+		pthread_join(w[i].thread, NULL);
+	clog_flush();
+	const long long elapsed = _now() - t0;
+	char syscalls[24] = "-";
+	if(calls >= 0)
+		snprintf(syscalls, sizeof syscalls, "%.1f",
+		         (double) (_writecalls() - calls) * 1000 / (double) n);
+	pthread_barrier_destroy(&_start);
+	clog_term();
+	fclose(f);
+	if(c->mode == MODE_SHARDED) {
+		char shard[sizeof BENCH_FILE + 12];
+		for(int i = 0; i < c->nthreads; ++i) {
+			snprintf(shard, sizeof shard, "%s.%d", BENCH_FILE, i);
+			remove(shard);
+		}
+	}
+	if(fds[0] >= 0) {
+		pthread_join(drainer, NULL);
+		close(fds[0]);
+	}
+
+	qsort(lat, n, sizeof *lat, _cmplat);
+	char buf[24] = "-", batch[24] = "-";
+	if(c->bufsize >= 0 && c->mode != MODE_SHARDED)
+		snprintf(buf, sizeof buf, "%ld", c->bufsize);
+	if(c->mode == MODE_ASYNC)
+		snprintf(batch, sizeof batch, "%u:%u", c->batch.records,
+		         c->batch.latency);
+	printf("%-6s %-7s %-7s %-4s %2d %-7s %-8s %-6s %-8s %-8s %9lld %9lld "
+	       "%9lld %11.0f %8s\n",
+	       _formatnames[c->fmt], _attrsets[c->attrset].name,
+	       _stringnames[c->string], _outputnames[c->output], c->nthreads,
+	       _modenames[c->mode],
+	       c->mode == MODE_SYNC ? _locknames[c->lock] : "-", buf, batch,
+	       c->filtered ? "filtered" : "emitted", lat[n / 2],
+	       lat[(size_t) ((double) (n - 1) * 0.99)],
+	       lat[(size_t) ((double) (n - 1) * 0.999)],
+	       (double) n * 1e9 / (double) elapsed, syscalls);
+	fflush(stdout);
+	free(lat);
+	free(w);
+	return true;
+}
+
+static int _find(const char *const name, const char *const *const names,
+                 const size_t n) {
+	for(size_t i = 0; i < n; ++i) {
+		if(strcmp(name, names[i]) == 0)
+			return (int) i;
+	}
+	return -1;
+}
+
+static int _findattrs(const char *const name) {
+	for(size_t i = 0; i < NATTRSETS; ++i) {
+		if(strcmp(name, _attrsets[i].name) == 0)
+			return (int) i;
+	}
+	return -1;
+}
+
+static void _runall(struct config c) {
+	/* every format with every attributes */
+	for(size_t f = 0; f < NFORMATS; ++f) {
+		for(size_t a = 0; a < NATTRSETS; ++a) {
+			c.fmt = (OutputFormat) f;
+			c.attrset = (int) a;
+			_run(&c);
+		}
+	}
+	/* the cost of the escaping */
+	c.fmt = CLOG_FORMAT_XML;
+	c.attrset = _findattrs("MINIMAL");
+	for(int i = 0; i < 2; ++i) {
+		for(c.string = 1; c.string < (int) NSTRINGS; ++c.string)
+			_run(&c);
+		c.fmt = CLOG_FORMAT_JSON;
+	}
+	c.string = 0;
+
+	c.fmt = CLOG_FORMAT_TEXT;
+	c.attrset = _findattrs("VERBOSE");
+
+	c.filtered = true;
+	_run(&c);
+	c.filtered = false;
+
+	/* the contention and the cost of the outputs; the shards are files */
+	for(c.mode = MODE_SYNC; c.mode < (int) NMODES; ++c.mode) {
+		for(size_t o = 0; o < NOUTPUTS; ++o) {
+			c.output = (int) o;
+			if(c.mode == MODE_SHARDED && c.output != OUTPUT_FILE)
+				continue;
+			for(c.nthreads = 1; c.nthreads <= 8; c.nthreads *= 2)
+				_run(&c);
+		}
+	}
+	c.mode = MODE_SYNC;
+
+	/* the cost of the locks, under contention */
+	c.output = OUTPUT_NULL;
+	for(c.lock = CLOG_LOCK_ADAPTIVE; c.lock < (int) NLOCKS; ++c.lock) {
+		for(c.nthreads = 1; c.nthreads <= 64; c.nthreads *= 4)
+			_run(&c);
+	}
+	c.lock = CLOG_LOCK_ADAPTIVE;
+	c.nthreads = 1;
+
+	/* the cost of an unbuffered stream, and of the buffer of the sink */
+	for(c.bufsize = 0; c.bufsize <= 65536; c.bufsize += 65536)
+		_run(&c);
+	c.bufsize = -1;
+
+	/* the batches of the writer thread, and their system calls */
+	c.mode = MODE_ASYNC;
+	c.output = OUTPUT_FILE;
+	for(c.batch.records = 1; c.batch.records <= 1024; c.batch.records *= 32)
+		_run(&c);
+}
+
+int main(int argc, char **argv) {
+	struct config c = {
+		.nmsgs = 20000,
+		.fmt = CLOG_FORMAT_TEXT,
+		.attrset = 0,
+		.output = OUTPUT_NULL,
+		.nthreads = 1,
+		.string = 0,
+		.mode = MODE_SYNC,
+		.lock = CLOG_LOCK_ADAPTIVE,
+		.filtered = false,
+		.bufsize = -1,
+		.batch = {1, 100}
+	};
+	bool all = true;
+	int opt;
+	while((opt = getopt(argc, argv, "f:a:o:t:m:l:n:s:Fb:B:S")) != -1) {
+		int i = 0;
+		switch(opt) {
+			case 'f':
+				i = _find(optarg, _formatnames, NFORMATS);
+				c.fmt = (OutputFormat) i;
+				break;
+			case 'a':
+				i = c.attrset = _findattrs(optarg);
+				break;
+			case 'o':
+				i = c.output = _find(optarg, _outputnames, NOUTPUTS);
+				break;
+			case 't':
+				i = c.nthreads = atoi(optarg);
+				i = i > 0 ? 0 : -1;
+				break;
+			case 'm':
+				i = c.mode = _find(optarg, _modenames, NMODES);
+				break;
+			case 'l':
+				i = c.lock = _find(optarg, _locknames, NLOCKS);
+				break;
+			case 'n':
+				c.nmsgs = strtoul(optarg, NULL, 10);
+				i = c.nmsgs > 0 ? 0 : -1;
+				break;
+			case 's':
+				i = c.string = _find(optarg, _stringnames, NSTRINGS);
+				break;
+			case 'F':
+				c.filtered = true;
+				break;
+			case 'S':
+				c.stats = true;
+				break;
+			case 'b':
+				c.bufsize = atol(optarg);
+				i = c.bufsize >= 0 ? 0 : -1;
+				break;
+			case 'B':
+				i = sscanf(optarg, "%u:%u", &c.batch.records,
+				           &c.batch.latency) >= 1 && c.batch.records ? 0 : -1;
+				break;
+			default:
+				i = -1;
+				break;
+		}
+		if(i < 0) {
+			fprintf(stderr, "usage: %s [-f format] [-a attrs] [-o output] "
+			        "[-t threads] [-m mode] [-l lock] [-n count] [-s string] [-F] "
+			        "[-b size] [-B records:ms] [-S]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+		/* the count of messages and the statistics do not change the set of
+		   configurations */
+		all = all && (opt == 'n' || opt == 'S');
+	}
+
+	if(c.mode == MODE_SHARDED)
+		c.output = OUTPUT_FILE;
+
+	printf("clock reading: %lld ns (included in the latencies)\n\n",
+	       _clockcost());
+	printf("%-6s %-7s %-7s %-4s %2s %-7s %-8s %-6s %-8s %-8s %9s %9s %9s %11s "
+	       "%8s\n",
+	       "fmt", "attrs", "string", "out", "th", "mode", "lock", "buf",
+	       "batch", "calls",
+	       "p50(ns)",
+	       "p99(ns)", "p99.9(ns)", "msgs/s", "write/1k");
+	if(all)
+		_runall(c);
+	else if(!_run(&c))
+		return EXIT_FAILURE;
+	remove(BENCH_FILE);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,252 @@
+#include "binary.h"
+
+#include <stdint.h> /* for intmax_t, uintptr_t, uint64_t */
+#include <string.h> /* for memchr, memcpy, strlen */
+
+#include <PUCA/funcattrs.h> /* for INLINE */
+
+
+
+size_t _clog_putvarint(char *const out, unsigned long long v) {
+	size_t n = 0;
+	while(v >= 0x80) {
+		out[n++] = (char) ((v & 0x7F) | 0x80);
+		v >>= 7;
+	}
+	out[n++] = (char) v;
+	return n;
+}
+
+const char *_clog_getvarint(const char *in, const char *const end,
+                            unsigned long long *const v) {
+	*v = 0;
+	for(unsigned int shift = 0; in < end && shift < 64; shift += 7) {
+		const unsigned char c = (unsigned char) *in++;
+		*v |= (unsigned long long) (c & 0x7F) << shift;
+		if(!(c & 0x80))
+			return in;
+	}
+	return NULL;
+}
+
+void _clog_putle(char *const out, unsigned long long v, const size_t n) {
+	for(size_t i = 0; i < n; ++i, v >>= 8)
+		out[i] = (char) (v & 0xFF);
+}
+
+unsigned long long _clog_getle(const char *const in, const size_t n) {
+	unsigned long long v = 0;
+	for(size_t i = n; i > 0; --i)
+		v = v << 8 | (unsigned char) in[i - 1];
+	return v;
+}
+
+
+static INLINE unsigned long long _zigzag(const long long v) {
+	return v < 0 ? ~((unsigned long long) v << 1) : (unsigned long long) v << 1;
+}
+
+static INLINE long long _unzigzag(const unsigned long long z) {
+	return z & 1 ? -(long long) (z >> 1) - 1 : (long long) (z >> 1);
+}
+
+
+/* Appends to the output as much as it can hold (the output can be NULL if its
+   size is 0) */
+#define PUT(p, n) do {\
+	if((n) && len + (n) <= size)\
+		memcpy(out + len, p, n);\
+	len += (n);\
+} while(0)
+#define PUTVARINT(v) do {\
+	char _v[VARINT_MAX];\
+	const size_t _n = _clog_putvarint(_v, v);\
+	PUT(_v, _n);\
+} while(0)
+#define GET(T) (memcpy(&v.T, packed, sizeof v.T), packed += sizeof v.T, v.T)
+
+size_t _clog_encodeargs(char *const out, const size_t size,
+                        const struct argspec *const spec, const char *packed) {
+	size_t len = 0;
+	union {
+		int i;
+		long l;
+		long long ll;
+		intmax_t im;
+		size_t z;
+		ptrdiff_t t;
+		void *p;
+	} v;
+	for(size_t k = 0; k < spec->nargs; ++k) {
+		switch(spec->items[k].type) {
+			case ARG_INT: PUTVARINT(_zigzag(GET(i))); break;
+			case ARG_LONG: PUTVARINT(_zigzag(GET(l))); break;
+			case ARG_LLONG: PUTVARINT(_zigzag(GET(ll))); break;
+			case ARG_INTMAX: PUTVARINT(_zigzag(GET(im))); break;
+			case ARG_SIZE: PUTVARINT(GET(z)); break;
+			case ARG_PTRDIFF: PUTVARINT(_zigzag(GET(t))); break;
+			case ARG_POINTER: PUTVARINT((uintptr_t) GET(p)); break;
+			case ARG_DOUBLE: {
+				uint64_t bits; /* of the double */
+				memcpy(&bits, packed, sizeof bits);
+				packed += sizeof bits;
+				char le[8];
+				_clog_putle(le, bits, sizeof le);
+				PUT(le, sizeof le);
+				break;
+			}
+			case ARG_LDOUBLE:
+				PUT(packed, sizeof(long double));
+				packed += sizeof(long double);
+				break;
+			case ARG_STRING: {
+				const size_t n = strlen(packed);
+				PUTVARINT(n);
+				PUT(packed, n);
+				packed += n + 1;
+				break;
+			}
+			default: break;
+		}
+	}
+	return len;
+}
+
+
+/* Reads a varint of the input, or fails */
+#define GETVARINT(v) do {\
+	if((in = _clog_getvarint(in, end, &v)) == NULL)\
+		return ARGS_UNSUPPORTED;\
+} while(0)
+#define PUTVALUE(T, v) do {\
+	const T _v = (T) (v);\
+	PUT(&_v, sizeof _v);\
+} while(0)
+
+size_t _clog_decodeargs(char *const out, const size_t size,
+                        const struct argspec *const spec, const char *in,
+                        const char *const end) {
+	size_t len = 0;
+	unsigned long long v;
+	for(size_t i = 0; i < spec->nargs; ++i) {
+		switch(spec->items[i].type) {
+			case ARG_INT: GETVARINT(v); PUTVALUE(int, _unzigzag(v)); break;
+			case ARG_LONG: GETVARINT(v); PUTVALUE(long, _unzigzag(v)); break;
+			case ARG_LLONG:
+				GETVARINT(v);
+				PUTVALUE(long long, _unzigzag(v));
+				break;
+			case ARG_INTMAX:
+				GETVARINT(v);
+				PUTVALUE(intmax_t, _unzigzag(v));
+				break;
+			case ARG_SIZE: GETVARINT(v); PUTVALUE(size_t, v); break;
+			case ARG_PTRDIFF:
+				GETVARINT(v);
+				PUTVALUE(ptrdiff_t, _unzigzag(v));
+				break;
+			case ARG_POINTER:
+				GETVARINT(v);
+				PUTVALUE(void*, (uintptr_t) v);
+				break;
+			case ARG_DOUBLE: {
+				if(end - in < 8)
+					return ARGS_UNSUPPORTED;
+				const uint64_t bits = _clog_getle(in, 8);
+				in += 8;
+				double d;
+				memcpy(&d, &bits, sizeof d);
+				PUT(&d, sizeof d);
+				break;
+			}
+			case ARG_LDOUBLE:
+				if((size_t) (end - in) < sizeof(long double))
+					return ARGS_UNSUPPORTED;
+				PUT(in, sizeof(long double));
+				in += sizeof(long double);
+				break;
+			case ARG_STRING:
+				GETVARINT(v);
+				if((unsigned long long) (end - in) < v
+				   || memchr(in, '\0', (size_t) v) != NULL)
+					return ARGS_UNSUPPORTED;
+				PUT(in, (size_t) v);
+				PUT("", 1);
+				in += v;
+				break;
+			default: break;
+		}
+	}
+	return in == end ? len : ARGS_UNSUPPORTED;
+}
+
+
+size_t _clog_encodevalue(char *const out, const size_t size,
+                         const LogField *const f) {
+	size_t len = 0;
+	const char type = (char) f->type;
+	PUT(&type, 1);
+	switch(f->type) {
+		case CLOG_FIELD_INT: PUTVARINT(_zigzag(f->value.i)); break;
+		case CLOG_FIELD_UINT: PUTVARINT(f->value.u); break;
+		case CLOG_FIELD_DOUBLE: {
+			uint64_t bits;
+			memcpy(&bits, &f->value.d, sizeof bits);
+			char le[8];
+			_clog_putle(le, bits, 8);
+			PUT(le, 8);
+			break;
+		}
+		case CLOG_FIELD_BOOL: {
+			const char b = f->value.b;
+			PUT(&b, 1);
+			break;
+		}
+		default: {
+			const char *const s = f->value.s ? f->value.s : "(null)";
+			const size_t n = strlen(s);
+			PUTVARINT(n);
+			PUT(s, n);
+			break;
+		}
+	}
+	return len;
+}
+
+const char *_clog_decodevalue(const char *in, const char *const end,
+                              LogField *const f, size_t *const len) {
+	if(in == end)
+		return NULL;
+	f->type = (FieldType) (unsigned char) *in++;
+	unsigned long long v;
+	switch(f->type) {
+		case CLOG_FIELD_INT:
+			if((in = _clog_getvarint(in, end, &v)) != NULL)
+				f->value.i = _unzigzag(v);
+			return in;
+		case CLOG_FIELD_UINT:
+			return _clog_getvarint(in, end, &f->value.u);
+		case CLOG_FIELD_DOUBLE: {
+			if(end - in < 8)
+				return NULL;
+			const uint64_t bits = _clog_getle(in, 8);
+			memcpy(&f->value.d, &bits, sizeof f->value.d);
+			return in + 8;
+		}
+		case CLOG_FIELD_BOOL:
+			if(in == end)
+				return NULL;
+			f->value.b = *in != 0;
+			return in + 1;
+		case CLOG_FIELD_STR:
+			if((in = _clog_getvarint(in, end, &v)) == NULL
+			   || (unsigned long long) (end - in) < v
+			   || memchr(in, '\0', (size_t) v) != NULL)
+				return NULL;
+			f->value.s = in;
+			*len = (size_t) v;
+			return in + v;
+		default:
+			return NULL;
+	}
+}
@@ -0,0 +1,202 @@
+/**
+ * \file binary.h
+ * \author joH1
+ * \version 0.1
+ *
+ * Internal functions to encode and decode the binary log format.
+ *
+ * A binary log starts with a header:
+ *  - the magic \c "CLOG", the version of the format and the size of a
+ *    <tt>long double</tt> on the system that wrote it (one byte each), two
+ *    null bytes;
+ *  - the output attributes the log was set up with (4 bytes): they are the
+ *    default attributes of its decoding;
+ *  - the origin of the uptime, in nanoseconds since the Epoch (8 bytes).
+ *
+ * It is followed by entries, each starting with a tag byte:
+ *  - \c BINARY_STRING: a string of the string table, with its identifier and
+ *    its length (varints) then its characters;
+ *  - \c BINARY_RECORD: a record, with its time in nanoseconds since the Epoch
+ *    (8 bytes), its level (1 byte), its line (4 bytes), the identifiers of its
+ *    file, function and format strings (varints), the length of its
+ *    arguments (a varint) and the arguments, then its count of fields (a
+ *    varint) and the fields: each with its key (a string identifier), the
+ *    type of its value (1 byte) and its value.
+ *
+ * The fixed-size fields are little-endian, and the varints are written by
+ * groups of 7 bits, the least significant first. A string identifier is
+ * non-zero; \c 0 is followed by the string itself, with its length, instead.
+ * Strings are defined once per log, but not always before their first use.
+ *
+ * The arguments are in the order of the format string: signed integers as
+ * zigzag varints, unsigned ones and pointers as varints, doubles as 8 bytes,
+ * long doubles as their bytes on the writing system, and strings with their
+ * length. The values of the fields are encoded the same way, the integers as
+ * <tt>long long</tt> and the booleans as one byte.
+ */
+
+#ifndef CLOG_BINARY_H
+#define CLOG_BINARY_H
+
+#include "args.h" /* for struct argspec */
+#include "clog.h" /* for LogLevel */
+
+#include <stddef.h> /* for size_t */
+#include <time.h> /* for struct timespec */
+
+#include <PUCA/funcattrs.h> /* for NOTNULL, PURE */
+
+
+
+#define BINARY_MAGIC "CLOG"
+#define BINARY_VERSION 2 /* the version 1 had no fields */
+#define BINARY_HEADERSIZE 20
+#define BINARY_STRING 'S'
+#define BINARY_RECORD 'R'
+
+/**
+ * \brief The maximal length of a varint.
+ */
+#define VARINT_MAX 10
+
+
+/**
+ * \brief Writes a value as a varint.
+ *
+ * \param[out] out The destination, of at least \c VARINT_MAX bytes
+ * \param[in]  v   The value
+ *
+ * \return The length of the varint.
+ */
+size_t _clog_putvarint(char *out, unsigned long long v) NOTNULL(1);
+
+/**
+ * \brief Reads a varint.
+ *
+ * \param[in]  in  The varint
+ * \param[in]  end The end of the input
+ * \param[out] v   The value
+ *
+ * \return The position past the varint, or \c NULL if it is truncated.
+ */
+const char *_clog_getvarint(const char *in, const char *end,
+                            unsigned long long *v) NOTNULL(1, 2, 3);
+
+/**
+ * \brief Writes a little-endian value.
+ *
+ * \param[out] out The destination
+ * \param[in]  v   The value
+ * \param[in]  n   Its size, in bytes
+ */
+void _clog_putle(char *out, unsigned long long v, size_t n) NOTNULL(1);
+
+/**
+ * \brief Reads a little-endian value.
+ *
+ * \param[in] in The value
+ * \param[in] n  Its size, in bytes
+ *
+ * \return The value.
+ */
+unsigned long long _clog_getle(const char *in, size_t n) NOTNULL(1) PURE;
+
+/**
+ * \brief Encodes the packed arguments of a message.
+ *
+ * This function behaves as \a snprintf, without the null character.
+ *
+ * \param[out] out    The output buffer
+ * \param[in]  size   The size of the output buffer
+ * \param[in]  spec   The arguments specification (must be supported)
+ * \param[in]  packed The packed arguments, as output by \a _clog_capture
+ *
+ * \return The length of the encoded arguments.
+ */
+size_t _clog_encodeargs(char *out, size_t size, const struct argspec *spec,
+                        const char *packed) NOTNULL(3, 4);
+
+/**
+ * \brief Decodes the encoded arguments of a message to their packed form.
+ *
+ * \param[out] out  The output buffer
+ * \param[in]  size The size of the output buffer
+ * \param[in]  spec The arguments specification (must be supported)
+ * \param[in]  in   The encoded arguments
+ * \param[in]  end  The end of the encoded arguments
+ *
+ * \return The size of the packed arguments, as \a _clog_capture; or
+ *         \c ARGS_UNSUPPORTED if the encoded arguments are malformed.
+ */
+size_t _clog_decodeargs(char *out, size_t size, const struct argspec *spec,
+                        const char *in, const char *end) NOTNULL(3, 4, 5);
+
+/**
+ * \brief Encodes the value of a field, with its type.
+ *
+ * This function behaves as \a snprintf, without the null character.
+ *
+ * \param[out] out   The output buffer
+ * \param[in]  size  The size of the output buffer
+ * \param[in]  field The field
+ *
+ * \return The length of the encoded value.
+ */
+size_t _clog_encodevalue(char *out, size_t size, const LogField *field)
+NOTNULL(3);
+
+/**
+ * \brief Decodes the value of a field, with its type.
+ *
+ * The value of a string field points to the input, and is not terminated.
+ *
+ * \param[in]  in    The encoded value
+ * \param[in]  end   The end of the input
+ * \param[out] field The field, whose key is left as is
+ * \param[out] len   The length of the value of a string field
+ *
+ * \return The position past the value, or \c NULL if it is malformed.
+ */
+const char *_clog_decodevalue(const char *in, const char *end,
+                              LogField *field, size_t *len)
+NOTNULL(1, 2, 3, 4);
+
+/**
+ * \brief The identity of the thread of a record decoded from a binary log,
+ *        kept in its last fields ("tid", "thread" then "cpu").
+ */
+struct replayid {
+	const char *name; /**< The name of the thread, or \c NULL */
+	unsigned int tid; /**< The thread, or 0 if not logged */
+	int cpu; /**< The processor, or -1 if not logged */
+};
+
+/**
+ * \brief Logs a message decoded from a binary log, with its original time.
+ *
+ * This function is implemented in \c clog.c; it logs synchronously.
+ *
+ * \param[in] time    The time of the message
+ * \param[in] uptime  The time elapsed since the log system was set up
+ * \param[in] id      The identity of the thread, or \c NULL if not logged
+ * \param[in] file    The file name
+ * \param[in] line    The line number
+ * \param[in] func    The function name
+ * \param[in] lvl     The level
+ * \param[in] msg     The formatted message
+ * \param[in] newline Whether the message started with a new line
+ * \param[in] fields  The fields of the message
+ * \param[in] nfields The count of fields
+ */
+void _clog_replay(const struct timespec *time, const struct timespec *uptime,
+                  const struct replayid *id, const char *file,
+                  unsigned int line, const char *func, LogLevel lvl,
+                  const char *msg, bool newline, const LogField *fields,
+                  size_t nfields)
+NOTNULL(1, 2, 4, 6, 8);
+
+
+#include <PUCA/end.h>
+
+
+#endif /* CLOG_BINARY_H */
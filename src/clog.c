@@ -1,70 +1,261 @@
+#define _GNU_SOURCE /* for gettid, sched_getcpu, pthread_*, clock_gettime */
+
 #include "clog.h"
+#include "args.h"
+#include "binary.h"
+#include "escape.h"
+#include "lock.h"
+#include "recorder.h"
+#include "sinks.h"
 
-#include <time.h> /* for time_t, localtime, strftime */
+#include <pthread.h> /* for pthread_*, PTHREAD_* */
+#include <sched.h> /* for sched_getcpu, sched_yield */
+#include <stdatomic.h> /* for atomic_* */
+#include <stddef.h> /* for ptrdiff_t */
+#include <limits.h> /* for UINT_MAX */
+#include <math.h> /* for isfinite */
+#include <stdint.h> /* for uint32_t, uintptr_t */
+#include <stdlib.h> /* for malloc, realloc, free */
+#include <string.h> /* for memcpy, strdup, strlen */
+#include <time.h> /* for clock_gettime, localtime_r, gmtime_r, strftime */
+#include <unistd.h> /* for gethostname, getpid, gettid */
 
 #include <PUCA/funcattrs.h> /* for INLINE, PURE, NOTNULL */
 
 
 
-static void _init_text(void);
-static void _init_xml(void);
-static void _init_csv(void);
-static void _init_json(void);
-static void (*_initfuncs[])(void) = {
-	[CLOG_FORMAT_TEXT] = _init_text,
-	[CLOG_FORMAT_XML] = _init_xml,
-	[CLOG_FORMAT_CSV] = _init_csv,
-	[CLOG_FORMAT_JSON] = _init_json
-};
-static FILE *_logfile = NULL; /* cannot initialize to stderr :'( error is
-                                "initializer element is not constant" */
+#define ATTRS_TIME (CLOG_ATTR_TIME | CLOG_ATTR_TIME_US | CLOG_ATTR_TIME_NS)
+#define ATTRS_IDENTITY (CLOG_ATTR_THREAD | CLOG_ATTR_CPU)
 
-static OutputFormat _outputfmt = CLOG_FORMAT_TEXT;
+static struct timespec _inittime; /* the origin of CLOG_ATTR_UPTIME */
 
-static OutputAttribute _outputattrs = CLOG_ATTR_MINIMAL;
+/* Read without lock on every call, hence atomic */
+static atomic_int _filterlevel = CLOG_FILTER_ALL;
+/* The filter levels of the files, by prefix; each call site of the macros
+   caches its own level, until the generation changes */
+struct filter {
+	char *prefix;
+	size_t len;
+	LogLevel lvl;
+	char pad[4];
+};
+static struct filter *_filters = NULL;
+static size_t _nfilters = 0;
+static pthread_mutex_t _filtersmutex = PTHREAD_MUTEX_INITIALIZER;
+atomic_uint _clog_filtergen = 1; /* 0 is the generation of no site */
+/* The name of the levels, padded to the longest one, their color code and
+   their syslog severity */
+#define LEVELS(X) \
+	X(CLOG_TRACE, "TRACE", "TRACE  ", "90", 7) /* grey ("bright black") */ \
+	X(CLOG_DEBUG, "DEBUG", "DEBUG  ", "34", 7) /* blue */ \
+	X(CLOG_VERBOSE, "VERBOSE", "VERBOSE", "36", 6) /* cyan */ \
+	X(CLOG_INFO, "INFO", "INFO   ", "32", 6) /* green */ \
+	X(CLOG_NOTICE, "NOTICE", "NOTICE ", "33", 5) /* yellow */ \
+	X(CLOG_WARNING, "WARNING", "WARNING", "35", 4) /* magenta */ \
+	X(CLOG_ERROR, "ERROR", "ERROR  ", "31", 3) /* red */ \
+	X(CLOG_FATAL, "FATAL", "FATAL  ", "1;31", 2) /* bold red, critical */
 
-static LogLevel _filterlevel = CLOG_FILTER_ALL;
+#define LEVEL_NAME(lvl, name, padded, color, sev) [lvl] = name,
 static const char *const _levelnames[] = {
-		[CLOG_TRACE] = "TRACE",
-		[CLOG_DEBUG] = "DEBUG",
-		[CLOG_VERBOSE] = "VERBOSE",
-		[CLOG_INFO] = "INFO",
-		[CLOG_NOTICE] = "NOTICE",
-		[CLOG_WARNING] = "WARNING",
-		[CLOG_ERROR] = "ERROR",
-		[CLOG_FATAL] = "FATAL"
+	LEVELS(LEVEL_NAME)
+};
+
+/* The fragments of the records that depend only on the level, prerendered */
+struct fragment {
+	const char *str;
+	size_t len;
+};
+#define FRAGMENT(s) {s, sizeof s - 1}
+#define TEXT_LEVEL(lvl, name, padded, color, sev) [lvl] = FRAGMENT(padded " -- "),
+#define COLOR_START(lvl, name, padded, color, sev) \
+	[lvl] = FRAGMENT("\x1b[" color "m"),
+#define COLOR_LEVEL(lvl, name, padded, color, sev) \
+	[lvl] = FRAGMENT(padded " -- \x1b[0m"),
+#define COLOR_HEADER(lvl, name, padded, color, sev) \
+	[lvl] = FRAGMENT("\x1b[" color "m" padded " -- \x1b[0m"),
+#define XML_LEVEL(lvl, name, padded, color, sev) \
+	[lvl] = FRAGMENT("level=\"" name "\">"),
+#define CSV_LEVEL(lvl, name, padded, color, sev) [lvl] = FRAGMENT(name "\t"),
+#define JSON_LEVEL(lvl, name, padded, color, sev) \
+	[lvl] = FRAGMENT("\t\t\t\"level\": \"" name "\",\n"),
+#define NDJSON_LEVEL(lvl, name, padded, color, sev) \
+	[lvl] = FRAGMENT("\"level\":\"" name "\",\"msg\":\""),
+#define JOURNALD_LEVEL(lvl, name, padded, color, sev) \
+	[lvl] = FRAGMENT("PRIORITY=" #sev "\n"),
+#define SEVERITY(lvl, name, padded, color, sev) [lvl] = sev,
+static const struct fragment _textlevels[] = {LEVELS(TEXT_LEVEL)};
+static const struct fragment _colorstarts[] = {LEVELS(COLOR_START)};
+static const struct fragment _colorlevels[] = {LEVELS(COLOR_LEVEL)};
+/* the whole header, when it holds only the level */
+static const struct fragment _colorheaders[] = {LEVELS(COLOR_HEADER)};
+static const struct fragment _xmllevels[] = {LEVELS(XML_LEVEL)};
+static const struct fragment _csvlevels[] = {LEVELS(CSV_LEVEL)};
+static const struct fragment _jsonlevels[] = {LEVELS(JSON_LEVEL)};
+static const struct fragment _ndjsonlevels[] = {LEVELS(NDJSON_LEVEL)};
+static const struct fragment _journaldlevels[] = {LEVELS(JOURNALD_LEVEL)};
+static const unsigned char _severities[] = {LEVELS(SEVERITY)};
+
+/* A growable character buffer, in which a whole record is built before being
+   written to the log file at once */
+struct buffer {
+	char *data;
+	size_t len;
+	size_t size;
+};
+#define BUFFER_INITSIZE 256
+static _Thread_local struct buffer _msgbuf;
+static pthread_key_t _msgbufkey; /* only to free the buffers on thread exit */
+static pthread_once_t _msgbufonce = PTHREAD_ONCE_INIT;
+
+/* The identity of a thread, rendered once for the records that show it */
+#define THREADNAME_MAX 16
+struct identity {
+	unsigned int tid;
+	int cpu; /* the processor last seen */
+	char tidstr[12];
+	char cpustr[12];
+	char name[THREADNAME_MAX];
+	unsigned char tidlen; /* 0 until the thread is known */
+	unsigned char cpulen; /* 0 until the processor is known */
+	unsigned char namelen;
+	char pad[5];
+};
+static _Thread_local struct identity _identity;
+static pthread_once_t _identityonce = PTHREAD_ONCE_INIT;
+
+/* The data of one logging call, as given to the output functions */
+struct record {
+	const char *file;
+	const char *func;
+	const char *fmt;
+	va_list *args;
+	const char *msg; /* the message already formatted, or NULL to use fmt */
+	size_t msglen;
+	const struct argspec *spec; /* if not NULL, msg holds packed arguments */
+	const LogField *fields;
+	const char *const *keys; /* the keys as logged, which identify them in
+	                            binary, if the fields point to copies */
+	size_t nfields;
+	const struct identity *id; /* NULL unless an attribute shows it */
+	struct timespec time;
+	struct timespec uptime;
+	unsigned int line;
+	LogLevel lvl;
+};
+
+/* Renders a record in an output format, for a given set of attributes */
+typedef void (*formatter)(struct buffer*, const struct record*,
+                          OutputAttribute);
+static formatter _formatter(OutputFormat, OutputAttribute);
+struct sink;
+static void _vlogmsg_binary(struct buffer*, const struct record*,
+                            const struct sink*);
+
+/* The headers of the formats; only those of the CSV and binary formats depend
+   on the attributes, and are built by a function */
+static const struct fragment _headers[] = {
+	[CLOG_FORMAT_TEXT] = FRAGMENT(""),
+	[CLOG_FORMAT_XML] = FRAGMENT("<?xml version=\"1.0\" encoding=\"UTF-8\""
+	                             " standalone=\"no\"?>\n"
+	                             "<!DOCTYPE log SYSTEM \"clog.dtd\"><log>\n"),
+	[CLOG_FORMAT_CSV] = {NULL, 0},
+	[CLOG_FORMAT_JSON] = FRAGMENT("{\n\t\"log\": ["),
+	[CLOG_FORMAT_NDJSON] = FRAGMENT(""),
+	[CLOG_FORMAT_BINARY] = {NULL, 0},
+	[CLOG_FORMAT_SYSLOG] = FRAGMENT(""),
+	[CLOG_FORMAT_JOURNALD] = FRAGMENT("")
+};
+static void _init_csv(struct buffer*, OutputAttribute);
+static void _init_binary(struct buffer*, OutputAttribute);
+static void (*const _initfuncs[CLOG_FORMAT_JOURNALD + 1])(struct buffer*,
+                                                          OutputAttribute) = {
+	[CLOG_FORMAT_CSV] = _init_csv,
+	[CLOG_FORMAT_BINARY] = _init_binary
+};
+static const char *const _footers[] = {
+	[CLOG_FORMAT_TEXT] = "",
+	[CLOG_FORMAT_XML] = "</log>\n",
+	[CLOG_FORMAT_CSV] = "",
+	[CLOG_FORMAT_JSON] = "\n\t]\n}\n",
+	[CLOG_FORMAT_NDJSON] = "",
+	[CLOG_FORMAT_BINARY] = "",
+	[CLOG_FORMAT_SYSLOG] = "",
+	[CLOG_FORMAT_JOURNALD] = ""
+};
+
+/* A record of the batch written by the writer thread, by its offset */
+struct span {
+	size_t start;
+	size_t len;
+};
+
+/* The outputs of the log system, each with its own format and filter level */
+struct sink {
+	LogSink ops;
+	OutputFormat fmt;
+	OutputAttribute attrs;
+	atomic_int json1st; /* Necessary for the delimiter comma */
+	char pad[4];
+	const char *footer; /* empty if the sink writes it itself */
+	formatter format;
+	atomic_uint *strings; /* the strings defined by a binary sink, as bits */
+	FlushPolicy flush;
+	struct buffer pending; /* the records not written yet, if it buffers them */
+	struct span *spans; /* the records of the batch, for a file sink */
+	unsigned long long flushed; /* the time of the last flush, in ns */
+	unsigned long drops; /* of a binary socket sink, when it last checked */
+	unsigned int unflushed; /* the records written since the last flush */
+	unsigned int nspans;
 };
+#define MAX_SINKS CLOG_MAX_SINKS
+#define MAIN_SINK 0 /* the sink set up by clog_init*, or stderr by default */
 
-static const char *const _colorcodes[] = {
-	[CLOG_TRACE] = "90", /* grey ("bright black") */
-	[CLOG_DEBUG] = "34", /* blue */
-	[CLOG_VERBOSE] = "36", /* cyan */
-	[CLOG_INFO] = "32", /* green */
-	[CLOG_NOTICE] = "33", /* yellow */
-	[CLOG_WARNING] = "35", /* magenta */
-	[CLOG_ERROR] = "31", /* red */
-	[CLOG_FATAL] = "1;31", /* bold red */
+/* The configuration of the sinks: a snapshot never changed once published,
+   but replaced as a whole. The logging calls read it with no lock, and a
+   replaced one is retired once no call reads it anymore, with the sinks it
+   was the last to hold */
+struct config {
+	struct sink *sinks[MAX_SINKS]; /* NULL if the entry is free */
+	int levels[MAX_SINKS];
+	int nsinks;
+	int nbinary; /* the sinks in binary format */
 };
-#define BEGIN_COLOR(lvl) fprintf(_logfile, "\x1b[%sm", _colorcodes[lvl])
-#define END_COLORS() fputs("\x1b[0m", _logfile)
-
-static void _vlogmsg_text(const char*, unsigned int, const char*, LogLevel,
-                          const char*, va_list);
-static void _vlogmsg_xml(const char*, unsigned int, const char*, LogLevel,
-                         const char*, va_list);
-static void _vlogmsg_csv(const char*, unsigned int, const char*, LogLevel,
-                         const char*, va_list);
-static void _vlogmsg_json(const char*, unsigned int, const char*, LogLevel,
-                          const char*, va_list);
-static void (*_outputfuncs[])(const char*, unsigned int, const char*, LogLevel,
-                              const char*, va_list) = {
-	[CLOG_FORMAT_TEXT] = _vlogmsg_text,
-	[CLOG_FORMAT_XML] = _vlogmsg_xml,
-	[CLOG_FORMAT_CSV] = _vlogmsg_csv,
-	[CLOG_FORMAT_JSON] = _vlogmsg_json,
+static struct config _noconfig; /* with no sink */
+static _Atomic(struct config*) _config = &_noconfig;
+static pthread_mutex_t _configmutex = PTHREAD_MUTEX_INITIALIZER; /* for the
+                                                                    changes */
+
+/* The threads that read the configuration: each one shows the epoch it reads
+   in, and a configuration is retired once no thread reads in an epoch before
+   its replacement */
+struct reader {
+	atomic_uint epoch; /* 0 if the thread does not read */
+	unsigned int depth; /* of the nested readings */
+	struct reader *next;
+	bool registered;
+	char pad[7];
 };
+static _Thread_local struct reader _reader;
+static struct reader *_readers = NULL;
+static atomic_uint _epoch = 1;
+static pthread_mutex_t _readersmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t _readerkey;
+static pthread_once_t _readeronce = PTHREAD_ONCE_INIT;
 
-static bool _json1stmsg; /* Necessary for the delimiter comma */
+/* The strings of the binary records, interned by address: the identifier of a
+   string is its index in the table, plus one */
+#define STRINGS_BITS 12
+#define STRINGS_SIZE (1 << STRINGS_BITS)
+static _Atomic(const char*) _strings[STRINGS_SIZE];
+/* Derived from the configuration, for the filters */
+static atomic_int _allattrs = CLOG_ATTR_MINIMAL; /* of all the sinks */
+static atomic_int _sinkfloor = CLOG_TRACE; /* the lowest level of the sinks */
+/* The state of the sinks is changed under the thread lock, or in asynchronous
+   mode under this mutex, held by the writer thread while it writes */
+static pthread_mutex_t _sinksmutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* The message of a record output to several sinks, formatted only once */
+static _Thread_local struct buffer _textbuf;
 
 #define DO_LOCK 1
 #define DO_UNLOCK 0
@@ -73,98 +264,2233 @@ static void (*_lockfuncs[])(void*) = {
 	[DO_UNLOCK] = NULL
 };
 static void *_lockuserdata = NULL;
+/* The lock taken unless the lock functions are given */
+static LockType _locktype = CLOG_LOCK_ADAPTIVE;
+static atomic_uint _adaptivelock = LOCK_FREE;
+static pthread_mutex_t _mutexlock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Asynchronous mode: the logging calls push their records in a bounded ring
+   (a Vyukov queue: each slot holds a sequence number telling whether it is
+   free or full for the current lap), drained by a writer thread */
+#define SLOT_TEXTSIZE 384 /* longer messages are allocated on the heap */
+struct slot {
+	atomic_size_t seq;
+	struct record rec;
+	struct identity id; /* that of the thread, which may change once pushed */
+	_Alignas(LogField) char text[SLOT_TEXTSIZE]; /* the fields are aligned */
+};
+static struct slot *_ring = NULL;
+static size_t _ringmask;
+static _Alignas(64) atomic_size_t _ringhead; /* next position to fill */
+static _Alignas(64) atomic_size_t _ringtail; /* next position to drain */
+static _Alignas(64) atomic_int _producers; /* the threads pushing records */
+static _Alignas(64) atomic_size_t _ringdone; /* count of records drained */
+static atomic_size_t _ringwritten; /* count of records drained, then written
+                                      and flushed */
+static atomic_size_t _ringdropped;
+static atomic_bool _writersleeping;
+static atomic_int _producersblocked;
+static bool _writerstop;
+static atomic_bool _ringopen; /* cleared first when the mode stops */
+static atomic_bool _async = false;
+static OverflowPolicy _overflowpolicy = CLOG_OVERFLOW_BLOCK;
+static bool _deferred = false;
+static pthread_t _writer;
+static pthread_mutex_t _asyncmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _writerwakeup = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t _ringnotfull = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t _ringdrained = PTHREAD_COND_INITIALIZER;
+#define WRITER_TIMEOUT_MS 100
+#define PRODUCER_TIMEOUT_MS 1
+
+/* The batches of the writer thread: the records it drains are rendered one
+   after the other, and each file sink gathers the spans of its own, to write
+   them with a single writev */
+#define BATCH_SIZE 65536 /* the rendered records before they are written */
+#define BATCH_SPANS 64 /* per sink and writev, below IOV_MAX */
+static struct buffer _batchbuf;
+static _Thread_local bool _batching = false; /* while the writer drains */
+static atomic_uint _batchrecords = 1; /* queued to wake the writer up */
+static atomic_uint _batchlatency = WRITER_TIMEOUT_MS;
+
+/* Sharded mode: each thread writes its records to a file of its own, under a
+   lock that only clog_flush contends; the shards are listed for clog_flush
+   and clog_term to reach them, and closed once no thread writes to them */
+struct shard {
+	struct sink sink;
+	pthread_mutex_t lock;
+	struct shard *next;
+};
+static atomic_bool _sharded = false;
+static char *_shardprefix = NULL; /* the shards are named <prefix>.<index> */
+static OutputFormat _shardfmt;
+static OutputAttribute _shardattrs;
+static atomic_uint _shardindex; /* of the next shard */
+static struct shard *_shards = NULL;
+static atomic_uint _shardgen = 0; /* incremented by each set-up */
+static pthread_mutex_t _shardsmutex = PTHREAD_MUTEX_INITIALIZER;
+/* The shard of the thread, if gen is the current set-up (NULL if it could not
+   be opened) */
+struct threadshard {
+	struct shard *shard;
+	unsigned int gen;
+	char pad[4];
+};
+static _Thread_local struct threadshard _shard;
+static pthread_key_t _shardkey; /* only to close the shards on thread exit */
+static pthread_once_t _shardonce = PTHREAD_ONCE_INIT;
+
+/* The rate limit of the call sites, as the generic cell rate algorithm: a site
+   is due a message every interval, and can get ahead of it by the tolerance */
+static atomic_ullong _rateinterval = 0; /* in nanoseconds, 0 for no limit */
+static atomic_ullong _ratetolerance = 0;
+static bool _collapse = false;
+
+/* The sampling of the levels: one message in rate is kept, if the random
+   number drawn for it is at most the threshold */
+#define SAMPLE_ALL(lvl, name, padded, color, sev) [lvl] = 1,
+#define THRESHOLD_ALL(lvl, name, padded, color, sev) [lvl] = UINT32_MAX,
+static atomic_uint _samplerates[] = {LEVELS(SAMPLE_ALL)};
+_Atomic(uint32_t) _clog_samplethresholds[] = {LEVELS(THRESHOLD_ALL)};
+_Thread_local uint32_t _clog_samplestate = 0;
+static _Atomic(LogSite*) _lastsite = NULL; /* of the last message */
+
+/* The flight recorder: the records from its level are kept, rendered */
+#define RECORDER_OFF (CLOG_FATAL + 1)
+static atomic_int _recorderlevel = RECORDER_OFF;
+static OutputAttribute _recorderattrs = CLOG_ATTR_MINIMAL;
+static formatter _recorderformat;
+
+/* The identity of the syslog records, after their time (" host app pid - "),
+   and of the journal ones */
+static int _syslogfacility = 1; /* user */
+static char _syslogid[352];
+static size_t _syslogidlen = 0;
+static char _journalid[80]; /* "SYSLOG_IDENTIFIER=app\n" */
+static size_t _journalidlen = 0;
+
+/* The statistics, if enabled: each thread counts its own, on cache lines of
+   its own, and they are summed up when read; those of the threads that exited
+   are kept apart */
+#define NLEVELS (CLOG_FATAL + 1)
+struct threadstats {
+	atomic_ullong emitted[NLEVELS];
+	atomic_ullong filtered[NLEVELS];
+	atomic_ullong ratelimited[NLEVELS];
+	atomic_ullong dropped[NLEVELS];
+	atomic_ullong written[MAX_SINKS];
+	atomic_ullong lockwait[CLOG_STATS_BUCKETS];
+	atomic_ullong lockhold[CLOG_STATS_BUCKETS];
+	struct threadstats *next;
+};
+/* the counters are summed up in those of LogStats, in the same order */
+_Static_assert(offsetof(struct threadstats, next)
+               == offsetof(LogStats, highwater), "LogStats counters");
+#define STATS_LINE 64
+#define STATS_LOCKSAMPLING 16 /* one record in, per level, has its lock timed */
+static atomic_bool _statson = false;
+static _Thread_local struct threadstats *_threadstats = NULL;
+static struct threadstats *_allstats = NULL;
+static struct threadstats _exitedstats;
+static _Alignas(64) atomic_size_t _ringhighwater;
+static pthread_mutex_t _statsmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t _statskey; /* only to keep the counts on thread exit */
+static pthread_once_t _statsonce = PTHREAD_ONCE_INIT;
+static void _site_flushrepeats(LogSite*);
+
+
+static INLINE PURE int _is_space(const char c) {
+	return ('\t' <= c && c <= '\r') || c == ' ';
+}
+
+static INLINE PURE NOTNULL(1) int _msgblank(const char *msg) {
+	while(_is_space(*msg)) ++msg;
+	return !*msg;
+}
+
+/* The time of the last record logged by the thread is kept rendered, and only
+   its digits of seconds are updated within the same minute */
+static _Thread_local char _timestr[9];
+static _Thread_local time_t _timeminute = -60; /* forces the first rendering */
+
+static INLINE const char *_printtime(const time_t t) {
+	const time_t sec = t - _timeminute;
+	if(sec < 0 || sec >= 60) {
+		struct tm tm;
+		localtime_r(&t, &tm);
+		strftime(_timestr, sizeof _timestr, "%H:%M:%S", &tm);
+		_timeminute = t - tm.tm_sec;
+	} else {
+		_timestr[6] = (char) ('0' + sec / 10);
+		_timestr[7] = (char) ('0' + sec % 10);
+	}
+	return _timestr;
+}
+
+/* The same for the date and time in UTC, as in RFC 3339 */
+static _Thread_local char _datestr[20];
+static _Thread_local time_t _dateminute = -60;
+
+static INLINE const char *_printdate(const time_t t) {
+	const time_t sec = t - _dateminute;
+	if(sec < 0 || sec >= 60) {
+		struct tm tm;
+		gmtime_r(&t, &tm);
+		strftime(_datestr, sizeof _datestr, "%Y-%m-%dT%H:%M:%S", &tm);
+		_dateminute = t - tm.tm_sec;
+	} else {
+		_datestr[17] = (char) ('0' + sec / 10);
+		_datestr[18] = (char) ('0' + sec % 10);
+	}
+	return _datestr;
+}
+
+/* In the child of a fork, the thread is another one */
+static void _identity_atfork(void) {
+	_identity.tidlen = 0;
+}
+
+static void _identity_atforkonce(void) {
+	pthread_atfork(NULL, NULL, _identity_atfork);
+}
+
+static unsigned char _idstr(char *const out, const long long n) {
+	return (unsigned char) snprintf(out, 12, "%lld", n);
+}
+
+static void _identity_init(struct identity *const id) {
+	pthread_once(&_identityonce, _identity_atforkonce);
+	id->tid = (unsigned int) gettid();
+	id->tidlen = _idstr(id->tidstr, id->tid);
+}
+
+/* Retrieves the identity of the thread, with its processor if it is shown;
+   it is rendered again only once the processor changes */
+static INLINE const struct identity *_getidentity(const int a) {
+	struct identity *const id = &_identity;
+	if(id->tidlen == 0)
+		_identity_init(id);
+	if(a & CLOG_ATTR_CPU) {
+		const int cpu = sched_getcpu();
+		if(cpu != id->cpu || id->cpulen == 0) {
+			id->cpu = cpu;
+			id->cpulen = cpu < 0 ? 0 : _idstr(id->cpustr, cpu);
+		}
+	}
+	return id;
+}
+
+/* Reads the clocks, and the identity of the thread, needed by the output
+   attributes */
+static INLINE void _getcontext(struct record *const r) {
+	const int a = atomic_load_explicit(&_allattrs, memory_order_relaxed);
+	if(a & ATTRS_IDENTITY)
+		r->id = _getidentity(a);
+	if(a & ATTRS_TIME)
+		clock_gettime(CLOCK_REALTIME, &r->time);
+	if(a & CLOG_ATTR_UPTIME) {
+		clock_gettime(CLOCK_MONOTONIC, &r->uptime);
+		r->uptime.tv_sec -= _inittime.tv_sec;
+		r->uptime.tv_nsec -= _inittime.tv_nsec;
+		if(r->uptime.tv_nsec < 0) {
+			--r->uptime.tv_sec;
+			r->uptime.tv_nsec += 1000000000;
+		}
+	}
+}
+
+/* The monotonic time in ns, to the resolution of the scheduler tick */
+static INLINE unsigned long long _coarsenow(void) {
+	struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts); /* no system call */
+#else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+	return (unsigned long long) ts.tv_sec * 1000000000
+	       + (unsigned long long) ts.tv_nsec;
+}
+
+/* The monotonic time in ns */
+static INLINE unsigned long long _nsnow(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000
+	       + (unsigned long long) ts.tv_nsec;
+}
+
+static void _stats_exit(void *const u) {
+	struct threadstats *const t = u;
+	pthread_mutex_lock(&_statsmutex);
+	struct threadstats **p = &_allstats;
+	while(*p != t)
+		p = &(*p)->next;
+	*p = t->next;
+	atomic_ullong *const from = (atomic_ullong*) t;
+	atomic_ullong *const to = (atomic_ullong*) &_exitedstats;
+	for(size_t i = 0; i < offsetof(struct threadstats, next) / sizeof *from;
+	    ++i)
+		atomic_fetch_add_explicit(&to[i], atomic_load(&from[i]),
+		                          memory_order_relaxed);
+	pthread_mutex_unlock(&_statsmutex);
+	/* this is the exiting thread: a destructor that logs later counts in a
+	   new block */
+	_threadstats = NULL;
+	free(t);
+}
+
+static void _stats_makekey(void) {
+	pthread_key_create(&_statskey, _stats_exit);
+}
+
+static struct threadstats *_stats_register(void) {
+	const size_t size = (sizeof(struct threadstats) + STATS_LINE - 1)
+	                    / STATS_LINE * STATS_LINE;
+	struct threadstats *const t = aligned_alloc(STATS_LINE, size);
+	if(t == NULL)
+		return NULL;
+	memset(t, 0, size);
+	pthread_once(&_statsonce, _stats_makekey);
+	pthread_setspecific(_statskey, t);
+	pthread_mutex_lock(&_statsmutex);
+	t->next = _allstats;
+	_allstats = t;
+	pthread_mutex_unlock(&_statsmutex);
+	return _threadstats = t;
+}
+
+/* The statistics of the thread, or NULL if they are not enabled */
+static INLINE struct threadstats *_stats(void) {
+	if(!atomic_load_explicit(&_statson, memory_order_relaxed))
+		return NULL;
+	return _threadstats ? _threadstats : _stats_register();
+}
+
+/* Counts in a counter of the thread: it is the only one writing it */
+static INLINE void _stat_add(atomic_ullong *const c,
+                             const unsigned long long n) {
+	atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n,
+	                      memory_order_relaxed);
+}
+
+/* Counts a time in its bucket of a histogram */
+static INLINE void _stat_time(atomic_ullong *const histogram,
+                              unsigned long long ns) {
+	unsigned int i = 0;
+	while(ns >>= 1)
+		++i;
+	_stat_add(&histogram[i < CLOG_STATS_BUCKETS ? i : CLOG_STATS_BUCKETS - 1],
+	          1);
+}
+
+static INLINE void _stats_filtered(const LogLevel lvl) {
+	struct threadstats *const t = _stats();
+	if(t)
+		_stat_add(&t->filtered[lvl], 1);
+}
+
+static INLINE void _stats_ratelimited(const LogLevel lvl) {
+	struct threadstats *const t = _stats();
+	if(t)
+		_stat_add(&t->ratelimited[lvl], 1);
+}
+
+static INLINE void _stats_dropped(const LogLevel lvl) {
+	struct threadstats *const t = _stats();
+	if(t)
+		_stat_add(&t->dropped[lvl], 1);
+}
+
+static INLINE void _lock(int i) {
+	if(_lockfuncs[DO_LOCK]) {
+		if(_lockfuncs[i])
+			_lockfuncs[i](_lockuserdata);
+	} else if(_locktype == CLOG_LOCK_ADAPTIVE) {
+		if(i == DO_LOCK)
+			_clog_lock(&_adaptivelock);
+		else
+			_clog_unlock(&_adaptivelock);
+	} else if(_locktype == CLOG_LOCK_MUTEX) {
+		if(i == DO_LOCK)
+			pthread_mutex_lock(&_mutexlock);
+		else
+			pthread_mutex_unlock(&_mutexlock);
+	}
+}
+
+
+static void _buf_free(void *const unused) {
+	(void) unused;
+	free(_msgbuf.data);
+	_msgbuf.data = NULL;
+	_msgbuf.size = 0;
+	free(_textbuf.data);
+	_textbuf.data = NULL;
+	_textbuf.size = 0;
+}
+
+static void _buf_makekey(void) {
+	pthread_key_create(&_msgbufkey, _buf_free);
+}
+
+static bool _buf_grow(struct buffer *const b, const size_t n) {
+	size_t size = b->size ? b->size : BUFFER_INITSIZE;
+	while(size < b->len + n)
+		size *= 2;
+	char *const data = realloc(b->data, size);
+	if(data == NULL)
+		return false;
+	if(b->data == NULL) {
+		/* first allocation of a buffer of this thread */
+		pthread_once(&_msgbufonce, _buf_makekey);
+		pthread_setspecific(_msgbufkey, &_msgbuf);
+	}
+	b->data = data;
+	b->size = size;
+	return true;
+}
+
+static INLINE bool _buf_reserve(struct buffer *const b, const size_t n) {
+	return b->len + n <= b->size || _buf_grow(b, n);
+}
+
+static INLINE void _buf_append(struct buffer *const b, const char *const s,
+                               const size_t n) {
+	/* a fresh buffer has no data to copy to */
+	if(n && _buf_reserve(b, n)) {
+		memcpy(b->data + b->len, s, n);
+		b->len += n;
+	}
+}
+
+static INLINE void _buf_puts(struct buffer *const b, const char *const s) {
+	_buf_append(b, s, strlen(s));
+}
+
+static INLINE void _buf_putc(struct buffer *const b, const char c) {
+	if(_buf_reserve(b, 1))
+		b->data[b->len++] = c;
+}
+
+static void _buf_vprintf(struct buffer *const b, const char *const fmt,
+                         va_list args) {
+	/* there must be some room for vsnprintf to write to */
+	if(!_buf_reserve(b, 1))
+		return;
+	va_list copy;
+	va_copy(copy, args);
+	const int n = vsnprintf(b->data + b->len, b->size - b->len, fmt, copy);
+	va_end(copy);
+	if(n < 0)
+		return;
+	if((size_t) n >= b->size - b->len) {
+		/* the output was truncated, retry with enough room */
+		if(!_buf_reserve(b, (size_t) n + 1))
+			return;
+		vsnprintf(b->data + b->len, b->size - b->len, fmt, args);
+	}
+	b->len += (size_t) n;
+}
+
+static void _buf_expand(struct buffer *const b, const char *const fmt,
+                        const char *const packed) {
+	if(!_buf_reserve(b, 1))
+		return;
+	const int n = _clog_expand(b->data + b->len, b->size - b->len, fmt,
+	                           packed);
+	if(n < 0)
+		return;
+	if((size_t) n >= b->size - b->len) {
+		if(!_buf_reserve(b, (size_t) n + 1))
+			return;
+		_clog_expand(b->data + b->len, b->size - b->len, fmt, packed);
+	}
+	b->len += (size_t) n;
+}
+
+/* Appends a string literal, whose length is known at compile time */
+#define _buf_putlit(b, s) _buf_append(b, s, sizeof s - 1)
+
+/* The decimal digits of each number from 0 to 99 */
+static const char _digits[201] =
+	"000102030405060708091011121314151617181920212223242526272829"
+	"303132333435363738394041424344454647484950515253545556575859"
+	"606162636465666768697071727374757677787980818283848586878889"
+	"90919293949596979899";
+
+/* Appends an unsigned integer in decimal, two digits at a time */
+static INLINE void _buf_putuint(struct buffer *const b, unsigned long long n) {
+	char s[20];
+	char *p = s + sizeof s;
+	while(n >= 100) {
+		p -= 2;
+		memcpy(p, _digits + n % 100 * 2, 2);
+		n /= 100;
+	}
+	if(n >= 10) {
+		p -= 2;
+		memcpy(p, _digits + n * 2, 2);
+	} else {
+		*--p = (char) ('0' + n);
+	}
+	_buf_append(b, p, (size_t) (s + sizeof s - p));
+}
+
+static INLINE void _buf_putint(struct buffer *const b, const long long n) {
+	if(n < 0) {
+		_buf_putc(b, '-');
+		_buf_putuint(b, -(unsigned long long) n);
+	} else {
+		_buf_putuint(b, (unsigned long long) n);
+	}
+}
+
+/* The shortest of the two precisions that reads back as the same value */
+static void _buf_putdouble(struct buffer *const b, const double d) {
+	char s[32];
+	int n = snprintf(s, sizeof s, "%.15g", d);
+	if(strtod(s, NULL) != d)
+		n = snprintf(s, sizeof s, "%.17g", d);
+	_buf_append(b, s, (size_t) n);
+}
+
+static INLINE void _buf_putvarint(struct buffer *const b,
+                                  const unsigned long long v) {
+	if(_buf_reserve(b, VARINT_MAX))
+		b->len += _clog_putvarint(b->data + b->len, v);
+}
+
+static INLINE void _buf_putle(struct buffer *const b,
+                              const unsigned long long v, const size_t n) {
+	if(_buf_reserve(b, n)) {
+		_clog_putle(b->data + b->len, v, n);
+		b->len += n;
+	}
+}
+
+/* Appends an unsigned integer on a fixed count of digits, zero-padded */
+static INLINE void _buf_putfixed(struct buffer *const b, unsigned long n,
+                                 const size_t width) {
+	if(!_buf_reserve(b, width))
+		return;
+	char *p = b->data + b->len + width;
+	for(size_t i = width; i > 1; i -= 2) {
+		p -= 2;
+		memcpy(p, _digits + n % 100 * 2, 2);
+		n /= 100;
+	}
+	if(width & 1)
+		*--p = (char) ('0' + n % 10);
+	b->len += width;
+}
+
+/* Appends the fraction of second of a time, as per the output attributes */
+static INLINE void _buf_putfrac(struct buffer *const b, const long nsec,
+                                const OutputAttribute a) {
+	if(a & CLOG_ATTR_TIME_NS) {
+		_buf_putc(b, '.');
+		_buf_putfixed(b, (unsigned long) nsec, 9);
+	} else if(a & (CLOG_ATTR_TIME_US | CLOG_ATTR_UPTIME)) {
+		_buf_putc(b, '.');
+		_buf_putfixed(b, (unsigned long) nsec / 1000, 6);
+	}
+}
+
+static INLINE void _buf_puttime(struct buffer *const b,
+                                const struct record *const r,
+                                const OutputAttribute a) {
+	_buf_append(b, _printtime(r->time.tv_sec), 8);
+	if(a & (CLOG_ATTR_TIME_US | CLOG_ATTR_TIME_NS))
+		_buf_putfrac(b, r->time.tv_nsec, a);
+}
+
+static INLINE void _buf_putdate(struct buffer *const b,
+                                const struct record *const r,
+                                const OutputAttribute a) {
+	_buf_append(b, _printdate(r->time.tv_sec), 19);
+	if(a & (CLOG_ATTR_TIME_US | CLOG_ATTR_TIME_NS))
+		_buf_putfrac(b, r->time.tv_nsec, a);
+	_buf_putc(b, 'Z');
+}
+
+static INLINE void _buf_putuptime(struct buffer *const b,
+                                  const struct record *const r,
+                                  const OutputAttribute a) {
+	_buf_putuint(b, (unsigned long long) r->uptime.tv_sec);
+	_buf_putfrac(b, r->uptime.tv_nsec, a);
+}
+
+static INLINE void _buf_putmsg(struct buffer *const b,
+                               const struct record *const r) {
+	if(r->spec)
+		_buf_expand(b, r->fmt + (*r->fmt == '\n'), r->msg);
+	else if(r->msg)
+		_buf_append(b, r->msg, r->msglen);
+	else /* omit the leading new line, output before the header */
+		_buf_vprintf(b, r->fmt + (*r->fmt == '\n'), *r->args);
+}
+
+
+/* Escapes for JSON or XML what was appended to the buffer from an offset */
+static void _buf_escape(struct buffer *const b, const size_t from,
+                        const bool json) {
+	const size_t i = from + (json ? _clog_jsonspan : _clog_xmlspan)(
+	                     b->data + from, b->len - from);
+	if(i == b->len)
+		return;
+	/* move the rest to the end of the room of its escaped form: the output
+	   can then not overtake the characters not read yet */
+	const size_t n = b->len - i;
+	if(!_buf_reserve(b, n * (ESCAPE_MAX - 1))) {
+		b->len = i;
+		return;
+	}
+	char *w = b->data + i;
+	char *r = w + n * (ESCAPE_MAX - 1);
+	const char *const end = r + n;
+	memmove(r, w, n);
+	while(r < end) {
+		const char c = *r++;
+		w += json ? _clog_jsonescape(w, c) : _clog_xmlescape(w, c);
+		/* copy the next run of characters that need no escaping at once */
+		const size_t k = (json ? _clog_jsonspan : _clog_xmlspan)(
+		                     r, (size_t) (end - r));
+		memmove(w, r, k);
+		w += k;
+		r += k;
+	}
+	b->len = (size_t) (w - b->data);
+}
+
+static INLINE void _buf_putescaped(struct buffer *const b,
+                                   const char *const s, const bool json) {
+	const size_t from = b->len;
+	_buf_puts(b, s);
+	_buf_escape(b, from, json);
+}
+
+static INLINE void _buf_putescapedmsg(struct buffer *const b,
+                                      const struct record *const r,
+                                      const bool json) {
+	const size_t from = b->len;
+	_buf_putmsg(b, r);
+	_buf_escape(b, from, json);
+}
+
+/* The renderings of the values of the fields */
+#define VALUE_TEXT 0 /* the strings are quoted if they need to */
+#define VALUE_XML 1
+#define VALUE_JSON 2
+
+/* Tells whether a string would not read back as one value in text format */
+static INLINE PURE NOTNULL(1) bool _needsquotes(const char *s) {
+	if(*s == '\0')
+		return true;
+	for(; *s; ++s) {
+		if((unsigned char) *s <= ' ' || *s == '=' || *s == '"')
+			return true;
+	}
+	return false;
+}
+
+static void _buf_putvalue(struct buffer *const b, const LogField *const f,
+                          const int how) {
+	switch(f->type) {
+		case CLOG_FIELD_INT:
+			_buf_putint(b, f->value.i);
+			break;
+		case CLOG_FIELD_UINT:
+			_buf_putuint(b, f->value.u);
+			break;
+		case CLOG_FIELD_DOUBLE:
+			if(how == VALUE_JSON && !isfinite(f->value.d))
+				_buf_putlit(b, "null");
+			else
+				_buf_putdouble(b, f->value.d);
+			break;
+		case CLOG_FIELD_BOOL:
+			if(f->value.b)
+				_buf_putlit(b, "true");
+			else
+				_buf_putlit(b, "false");
+			break;
+		default: {
+			const char *const str = f->value.s ? f->value.s : "(null)";
+			if(how == VALUE_XML) {
+				_buf_putescaped(b, str, false);
+			} else if(how == VALUE_JSON || _needsquotes(str)) {
+				_buf_putc(b, '"');
+				_buf_putescaped(b, str, true);
+				_buf_putc(b, '"');
+			} else {
+				_buf_puts(b, str);
+			}
+			break;
+		}
+	}
+}
+
+/* The fields of a record, after its message: as " key=value" in text format,
+   or as "\tkey=value" in CSV */
+static void _buf_putfields(struct buffer *const b,
+                           const struct record *const r, const char sep) {
+	for(size_t i = 0; i < r->nfields; ++i) {
+		_buf_putc(b, sep);
+		_buf_puts(b, r->fields[i].key);
+		_buf_putc(b, '=');
+		_buf_putvalue(b, &r->fields[i], VALUE_TEXT);
+	}
+}
+
+static INLINE void _buf_putfrag(struct buffer *const b,
+                                const struct fragment *const f) {
+	_buf_append(b, f->str, f->len);
+}
+
+/* Appends a parameter value of syslog structured data, escaped */
+static void _buf_putsdvalue(struct buffer *const b, const char *s) {
+	for(const char *e; *(e = s + strcspn(s, "\"\\]")); s = e + 1) {
+		_buf_append(b, s, (size_t) (e - s));
+		_buf_putc(b, '\\');
+		_buf_putc(b, *e);
+	}
+	_buf_puts(b, s);
+}
+
+/* Appends the key of a field as that of a journal field: uppercased, with
+   the characters other than letters and digits replaced */
+static void _buf_putjournalkey(struct buffer *const b, const char *s) {
+	for(; *s; ++s) {
+		const char c = *s;
+		_buf_putc(b, 'a' <= c && c <= 'z' ? (char) (c - 'a' + 'A')
+		             : ('A' <= c && c <= 'Z') || ('0' <= c && c <= '9') ? c
+		             : '_');
+	}
+}
+
+/* Ends a journal field appended as KEY=value, whose value starts at an
+   offset; a value that holds new lines is given its length instead, as
+   KEY\n<length>value */
+static void _buf_endjournalfield(struct buffer *const b, const size_t start) {
+	const size_t n = b->len - start;
+	if(n && memchr(b->data + start, '\n', n) && _buf_reserve(b, 8)) {
+		memmove(b->data + start + 8, b->data + start, n);
+		b->data[start - 1] = '\n';
+		_clog_putle(b->data + start, n, 8);
+		b->len += 8;
+	}
+	_buf_putc(b, '\n');
+}
+
+
+/* Tells whether the records of a format stand on their own: a blank message
+   is still a record, and no empty line goes before one */
+static INLINE PURE bool _standalone(const OutputFormat fmt) {
+	return fmt == CLOG_FORMAT_NDJSON || fmt == CLOG_FORMAT_SYSLOG
+	       || fmt == CLOG_FORMAT_JOURNALD;
+}
+
+/* Renders the record in the output format of a sink */
+static void _format(struct buffer *const b, const struct record *const r,
+                    const struct sink *const s) {
+	if(s->fmt == CLOG_FORMAT_BINARY) {
+		_vlogmsg_binary(b, r, s);
+		return;
+	}
+	if(r->msg == r->fmt && !_standalone(s->fmt)) {
+		/* blank message: output as is */
+		_buf_putmsg(b, r);
+		return;
+	}
+	/* a JSON record must start with its delimiter comma, and the standalone
+	   ones must not be preceded by an empty line */
+	if(*r->fmt == '\n' && s->fmt != CLOG_FORMAT_JSON && !_standalone(s->fmt))
+		_buf_putc(b, '\n');
+	s->format(b, r, s->attrs);
+}
+
+static void _init_csv(struct buffer *const b, const OutputAttribute a) {
+	if(a & ATTRS_TIME)
+		_buf_putlit(b, "Time (hh:mm:ss)\t");
+	if(a & CLOG_ATTR_UPTIME)
+		_buf_putlit(b, "Uptime (s)\t");
+	if(a & CLOG_ATTR_THREAD)
+		_buf_putlit(b, "Thread id\tThread name\t");
+	if(a & CLOG_ATTR_CPU)
+		_buf_putlit(b, "CPU\t");
+	if(a & CLOG_ATTR_FILE)
+		_buf_putlit(b, "File name\tLine number\t");
+	if(a & CLOG_ATTR_FUNC)
+		_buf_putlit(b, "Function name\t");
+	_buf_putlit(b, "Level name\tMessage content\n");
+}
+static void _init_binary(struct buffer *const b, const OutputAttribute a) {
+	/* the origin of the uptime, on the clock of the records */
+	struct timespec now, mono;
+	clock_gettime(CLOCK_REALTIME, &now);
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	const long long origin = (now.tv_sec - mono.tv_sec + _inittime.tv_sec)
+	                         * 1000000000LL
+	                         + now.tv_nsec - mono.tv_nsec + _inittime.tv_nsec;
+	_buf_putlit(b, BINARY_MAGIC);
+	_buf_putc(b, BINARY_VERSION);
+	_buf_putc(b, (char) sizeof(long double));
+	_buf_putlit(b, "\0\0");
+	_buf_putle(b, (unsigned int) a, 4);
+	_buf_putle(b, (unsigned long long) origin, 8);
+}
+
+static void _buf_putheader(struct buffer *const b, const OutputFormat fmt,
+                           const OutputAttribute a) {
+	if(_initfuncs[fmt] != NULL)
+		_initfuncs[fmt](b, a);
+	else
+		_buf_putfrag(b, &_headers[fmt]);
+}
+
+/* Recomputes the state derived from the configuration */
+static void _config_derive(const struct config *const c) {
+	OutputAttribute attrs = CLOG_ATTR_MINIMAL;
+	int floor = CLOG_FATAL;
+	for(int i = 0; i < MAX_SINKS; ++i) {
+		if(c->sinks[i] == NULL)
+			continue;
+		attrs |= c->sinks[i]->attrs;
+		/* the binary records always hold their time */
+		if(c->sinks[i]->fmt == CLOG_FORMAT_BINARY)
+			attrs |= CLOG_ATTR_TIME;
+		if(c->levels[i] < floor)
+			floor = c->levels[i];
+	}
+	if(_sharded) {
+		/* the shards replace the sinks, and keep all the records */
+		attrs |= _shardattrs;
+		if(_shardfmt == CLOG_FORMAT_BINARY)
+			attrs |= CLOG_ATTR_TIME;
+		floor = CLOG_TRACE;
+	}
+	if(atomic_load(&_recorderlevel) != RECORDER_OFF)
+		attrs |= _recorderattrs;
+	atomic_store_explicit(&_allattrs, (int) attrs, memory_order_relaxed);
+	/* with no sink, the messages go to the default one */
+	atomic_store(&_sinkfloor, c->nsinks || _sharded ? floor : CLOG_TRACE);
+	atomic_fetch_add(&_clog_filtergen, 1);
+}
+
+static void _reader_exit(void *const unused) {
+	(void) unused;
+	pthread_mutex_lock(&_readersmutex);
+	struct reader **p = &_readers;
+	while(*p != &_reader)
+		p = &(*p)->next;
+	*p = _reader.next;
+	pthread_mutex_unlock(&_readersmutex);
+	_reader.registered = false;
+}
+
+static void _reader_makekey(void) {
+	pthread_key_create(&_readerkey, _reader_exit);
+}
+
+static void _reader_register(void) {
+	pthread_once(&_readeronce, _reader_makekey);
+	pthread_setspecific(_readerkey, &_reader);
+	pthread_mutex_lock(&_readersmutex);
+	_reader.next = _readers;
+	_readers = &_reader;
+	pthread_mutex_unlock(&_readersmutex);
+	_reader.registered = true;
+}
+
+/* Starts to read the configuration, which stays valid until _config_done */
+static INLINE const struct config *_config_read(void) {
+	struct reader *const r = &_reader;
+	if(r->depth++ == 0) {
+		if(!r->registered)
+			_reader_register();
+		/* the configuration is read after the epoch is shown */
+		atomic_store(&r->epoch, atomic_load(&_epoch));
+	}
+	return atomic_load(&_config);
+}
+
+static INLINE void _config_done(void) {
+	if(--_reader.depth == 0)
+		atomic_store_explicit(&_reader.epoch, 0, memory_order_release);
+}
+
+/* The configuration, as seen by the thread that changes it */
+static INLINE struct config *_config_locked(void) {
+	return atomic_load_explicit(&_config, memory_order_relaxed);
+}
+
+/* Copies the configuration, to change it; under _configmutex */
+static struct config *_config_copy(void) {
+	struct config *const c = malloc(sizeof *c);
+	if(c)
+		*c = *_config_locked();
+	return c;
+}
+
+/* Waits for the threads that started to read the configuration before the
+   call to be done, by a thread that does not read it */
+static void _readers_wait(void) {
+	const unsigned int epoch = atomic_fetch_add(&_epoch, 1) + 1;
+	/* the readers are scanned again after each wait, which the threads that
+	   start or end meanwhile do not hold up */
+	for(bool waiting = true; waiting;) {
+		pthread_mutex_lock(&_readersmutex);
+		waiting = false;
+		for(const struct reader *r = _readers; r && !waiting; r = r->next) {
+			const unsigned int e = atomic_load(&r->epoch);
+			waiting = e != 0 && (int) (e - epoch) < 0;
+		}
+		pthread_mutex_unlock(&_readersmutex);
+		if(waiting)
+			sched_yield();
+	}
+}
+
+static void _sink_teardown(struct sink*);
+
+/* Replaces the configuration, then retires the former one once no thread
+   reads it, and closes the sinks it held alone; under _configmutex, by a
+   thread that does not read the configuration */
+static void _config_publish(struct config *const c) {
+	if(c != &_noconfig) {
+		c->nsinks = c->nbinary = 0;
+		for(int i = 0; i < MAX_SINKS; ++i) {
+			c->nsinks += c->sinks[i] != NULL;
+			c->nbinary += c->sinks[i] && c->sinks[i]->fmt == CLOG_FORMAT_BINARY;
+		}
+	}
+	struct config *const old = atomic_exchange(&_config, c);
+	_config_derive(c);
+	_readers_wait();
+	for(int i = 0; i < MAX_SINKS; ++i) {
+		if(old->sinks[i] && old->sinks[i] != c->sinks[i]) {
+			_sink_teardown(old->sinks[i]);
+			free(old->sinks[i]);
+		}
+	}
+	if(old != &_noconfig && old != c)
+		free(old);
+}
+
+/* Appends a name of the syslog header: printable, with no space */
+static size_t _syslogname(char *const out, const char *s, const size_t max) {
+	size_t n = 0;
+	for(; *s && n < max; ++s)
+		out[n++] = '!' <= *s && *s <= '~' ? *s : '_';
+	return n;
+}
+
+/* Renders the identity of the syslog and journal records */
+static void _syslog_identify(const char *const app) {
+	char host[256];
+	if(gethostname(host, sizeof host) != 0 || *host == '\0')
+		strcpy(host, "-");
+	host[sizeof host - 1] = '\0';
+	size_t n = 0;
+	_syslogid[n++] = ' ';
+	n += _syslogname(_syslogid + n, host, 255);
+	_syslogid[n++] = ' ';
+	if(app && *app)
+		n += _syslogname(_syslogid + n, app, 48);
+	else
+		_syslogid[n++] = '-';
+	n += (size_t) snprintf(_syslogid + n, sizeof _syslogid - n, " %ld - ",
+	                       (long) getpid());
+	_syslogidlen = n;
+	n = 0;
+	if(app && *app) {
+		memcpy(_journalid, "SYSLOG_IDENTIFIER=", 18);
+		n = 18 + _syslogname(_journalid + 18, app, 48);
+		_journalid[n++] = '\n';
+	}
+	_journalidlen = n;
+}
+
+/* Sets up a sink; if it is framed, it writes the header and footer of its
+   format itself */
+static void _sink_setup(struct sink *const s, const LogSink *const ops,
+                        const OutputFormat fmt, const OutputAttribute a,
+                        const bool framed) {
+	if(fmt == CLOG_FORMAT_SYSLOG && _syslogidlen == 0)
+		_syslog_identify(NULL);
+	s->fmt = fmt;
+	s->attrs = a;
+	atomic_store(&s->json1st, true);
+	s->footer = framed ? "" : _footers[fmt];
+	s->format = _formatter(fmt, a);
+	s->strings = fmt == CLOG_FORMAT_BINARY
+	             ? calloc(STRINGS_SIZE / 32 + 1, sizeof *s->strings) : NULL;
+	s->flush = (FlushPolicy) {0, CLOG_FATAL, 0, 0};
+	s->pending = (struct buffer) {NULL, 0, 0};
+	s->spans = NULL;
+	s->unflushed = 0;
+	s->drops = 0;
+	s->nspans = 0;
+	s->ops = *ops;
+
+	if(!framed) {
+		struct buffer *const b = &_msgbuf;
+		b->len = 0;
+		_buf_putheader(b, fmt, a);
+		if(b->len)
+			s->ops.write(s->ops.userdata, b->data, b->len);
+	}
+}
+
+static void _batch_writesink(struct sink *const s) {
+	struct iovec iov[BATCH_SPANS];
+	for(unsigned int i = 0; i < s->nspans; ++i)
+		iov[i] = (struct iovec) {_batchbuf.data + s->spans[i].start,
+		                         s->spans[i].len};
+	_clog_filewritev(_clog_sinkfile(&s->ops), iov, (int) s->nspans);
+	s->nspans = 0;
+}
+
+/* Adds a record rendered in the batch to those of the file sink; returns
+   false if it must be written at once */
+static bool _batch_add(struct sink *const s, const char *const data,
+                       const size_t len) {
+	if(s->spans == NULL
+	   && (s->spans = malloc(BATCH_SPANS * sizeof *s->spans)) == NULL)
+		return false;
+	const size_t start = (size_t) (data - _batchbuf.data);
+	struct span *const last = s->nspans ? &s->spans[s->nspans - 1] : NULL;
+	if(last && last->start + last->len == start) {
+		last->len += len;
+		return true;
+	}
+	if(s->nspans == BATCH_SPANS)
+		_batch_writesink(s);
+	s->spans[s->nspans++] = (struct span) {start, len};
+	return true;
+}
+
+static void _sink_drain(struct sink *const s) {
+	if(s->pending.len) {
+		s->ops.write(s->ops.userdata, s->pending.data, s->pending.len);
+		s->pending.len = 0;
+	}
+	if(s->nspans)
+		_batch_writesink(s);
+}
+
+static void _sink_flush(struct sink *const s) {
+	_sink_drain(s);
+	if(s->ops.flush)
+		s->ops.flush(s->ops.userdata);
+	s->unflushed = 0;
+	if(s->flush.interval)
+		s->flushed = _coarsenow();
+}
+
+static void _sink_teardown(struct sink *const s) {
+	_sink_drain(s);
+	free(s->pending.data);
+	s->pending = (struct buffer) {NULL, 0, 0};
+	free(s->spans);
+	s->spans = NULL;
+	if(*s->footer)
+		s->ops.write(s->ops.userdata, s->footer, strlen(s->footer));
+	if(s->ops.close)
+		s->ops.close(s->ops.userdata);
+	else if(s->ops.flush)
+		s->ops.flush(s->ops.userdata);
+	s->ops.write = NULL;
+	free(s->strings);
+	s->strings = NULL;
+}
+
+/* Sets up a sink in an entry of the configuration, in place of the former
+   one; under _configmutex */
+static bool _sink_open(const int id, const LogSink *const ops,
+                       const OutputFormat fmt, const OutputAttribute a,
+                       const LogLevel lvl, const bool framed) {
+	struct config *const c = _config_copy();
+	struct sink *const s = c ? malloc(sizeof *s) : NULL;
+	if(s == NULL) {
+		free(c);
+		return false;
+	}
+	if(c->nsinks == 0 && !_sharded)
+		clock_gettime(CLOCK_MONOTONIC, &_inittime);
+	_sink_setup(s, ops, fmt, a, framed);
+	c->sinks[id] = s;
+	c->levels[id] = lvl;
+	_config_publish(c);
+	return true;
+}
+
+/* Removes a sink from the configuration; under _configmutex */
+static void _sink_close(const int id) {
+	struct config *const c = _config_copy();
+	if(c) {
+		c->sinks[id] = NULL;
+		_config_publish(c);
+	}
+}
+
+/* Starts a change of the configuration; in asynchronous mode, the messages
+   logged so far go to the former sinks */
+static void _config_lock(void) {
+	if(_async)
+		clog_flush();
+	pthread_mutex_lock(&_configmutex);
+}
+
+static void _config_unlock(void) {
+	pthread_mutex_unlock(&_configmutex);
+}
+
+/* Recomputes the state derived from the configuration, once a mode changed */
+static void _config_update(void) {
+	pthread_mutex_lock(&_configmutex);
+	_config_derive(_config_locked());
+	pthread_mutex_unlock(&_configmutex);
+}
+
+/* Creates a rotated file sink, which frames its files itself */
+static bool _rotatingsink(LogSink *const sink, const char *const filename,
+                          const OutputFormat fmt, const OutputAttribute a,
+                          const RotationPolicy *const policy) {
+	/* the string table of a binary log would be lost with its first file */
+	if(fmt == CLOG_FORMAT_BINARY)
+		return false;
+	struct buffer *const b = &_msgbuf;
+	b->len = 0;
+	_buf_putheader(b, fmt, a);
+	_buf_putc(b, '\0');
+	return b->len && _clog_rotatingsink(sink, filename, policy, b->data,
+	                                    _footers[fmt],
+	                                    fmt == CLOG_FORMAT_JSON ? ',' : '\0');
+}
+
+static void _sinks_flush(const struct config *const c) {
+	for(int i = 0; i < MAX_SINKS; ++i) {
+		if(c->sinks[i])
+			_sink_flush(c->sinks[i]);
+	}
+}
+
+/* Writes a record to a sink; returns the count of bytes written */
+static INLINE size_t _sink_write(struct sink *const s, const char *data,
+                                 size_t len, const bool blank,
+                                 const LogLevel lvl) {
+	if(len && !blank && s->fmt == CLOG_FORMAT_JSON
+	   && atomic_load_explicit(&s->json1st, memory_order_relaxed)
+	   && atomic_exchange(&s->json1st, false)) {
+		/* no comma before the first record */
+		++data;
+		--len;
+	}
+	if(len == 0)
+		return 0;
+	struct buffer *const p = &s->pending;
+	if(_batching && _clog_sinkfile(&s->ops)) {
+		if(p->len)
+			_sink_drain(s);
+		if(!_batch_add(s, data, len))
+			s->ops.write(s->ops.userdata, data, len);
+	} else if(p->size) {
+		if(p->len + len > p->size)
+			_sink_drain(s);
+		if(len < p->size) {
+			memcpy(p->data + p->len, data, len);
+			p->len += len;
+		} else {
+			s->ops.write(s->ops.userdata, data, len);
+		}
+	} else {
+		s->ops.write(s->ops.userdata, data, len);
+	}
+	++s->unflushed;
+	const FlushPolicy *const f = &s->flush;
+	if(lvl >= f->level || (f->records && s->unflushed >= f->records)
+	   || (f->interval && _coarsenow() - s->flushed
+	                      >= (unsigned long long) f->interval * 1000000))
+		_sink_flush(s);
+	return len;
+}
+
+/* The strings defined by a binary record that a socket sink dropped are
+   defined again by the next records, which are not gathered */
+static INLINE void _sink_checkdrops(struct sink *const s) {
+	const unsigned long drops = _clog_sinkdrops(&s->ops);
+	if(drops == s->drops)
+		return;
+	s->drops = drops;
+	for(size_t i = 0; i < STRINGS_SIZE / 32 + 1; ++i)
+		atomic_store_explicit(&s->strings[i], 0, memory_order_relaxed);
+}
+
+/* Packs the arguments of the message in the buffer, if possible */
+static const struct argspec *_capture(struct buffer *const b,
+                                      const struct record *const r) {
+	const struct argspec *const spec = _clog_argspec(r->fmt);
+	if(spec == NULL || spec->nargs == ARGS_UNSUPPORTED
+	   || !_buf_reserve(b, SLOT_TEXTSIZE))
+		return NULL;
+	va_list args;
+	va_copy(args, *r->args);
+	b->len = _clog_capture(b->data, b->size, spec, args);
+	va_end(args);
+	if(b->len > b->size) {
+		/* too many or too long strings, retry with enough room */
+		const size_t len = b->len;
+		b->len = 0;
+		if(!_buf_reserve(b, len))
+			return NULL;
+		b->len = _clog_capture(b->data, b->size, spec, *r->args);
+	}
+	return spec;
+}
+
+/* Writes the record to the sinks that do not filter it out; it is rendered
+   only once per distinct format and attributes */
+static void _dispatch(const struct config *const c, const struct record *r) {
+	struct record expanded;
+	if(c->nsinks > 1 && c->nbinary && r->msg == NULL) {
+		/* the arguments can be read only once: they are packed, for the
+		   binary sinks to keep them and the others to format them */
+		struct buffer *const t = &_textbuf;
+		t->len = 0;
+		expanded = *r;
+		expanded.spec = _capture(t, r);
+		if(expanded.spec) {
+			expanded.msg = t->data;
+			expanded.msglen = t->len;
+			r = &expanded;
+		}
+	}
+	if(c->nsinks > 1 && (r->msg == NULL || (r->spec && !c->nbinary))) {
+		/* the arguments can be read only once, the message is formatted
+		   before the records */
+		struct buffer *const t = &_textbuf;
+		t->len = 0;
+		_buf_putmsg(t, r);
+		expanded = *r;
+		expanded.msg = t->data ? t->data : "";
+		expanded.msglen = t->len;
+		expanded.spec = NULL;
+		r = &expanded;
+	}
+
+	struct rendering {
+		size_t start;
+		size_t len;
+		OutputFormat fmt;
+		OutputAttribute attrs;
+	} done[MAX_SINKS];
+	int ndone = 0;
+	struct threadstats *const t = _stats();
+	/* the records of a batch are kept until written */
+	struct buffer *const b = _batching ? &_batchbuf : &_msgbuf;
+	if(!_batching)
+		b->len = 0;
+	for(int i = 0; i < MAX_SINKS; ++i) {
+		struct sink *const s = c->sinks[i];
+		if(s == NULL || (int) r->lvl < c->levels[i])
+			continue;
+		/* a binary record depends on the strings the sink has defined */
+		int k = s->fmt == CLOG_FORMAT_BINARY ? ndone : 0;
+		while(k < ndone && (done[k].fmt != s->fmt || done[k].attrs != s->attrs))
+			++k;
+		if(k == ndone) {
+			done[k].start = b->len;
+			done[k].fmt = s->fmt;
+			done[k].attrs = s->attrs;
+			_format(b, r, s);
+			done[k].len = b->len - done[k].start;
+			++ndone;
+		}
+		/* the buffer may have moved while rendering another format */
+		const size_t n = _sink_write(s, b->data + done[k].start, done[k].len,
+		                             r->msg == r->fmt, r->lvl);
+		if(s->strings)
+			_sink_checkdrops(s);
+		if(t)
+			_stat_add(&t->written[i], n);
+	}
+}
+
+
+static void _deadline(struct timespec *const ts, const long ms) {
+	clock_gettime(CLOCK_REALTIME, ts);
+	ts->tv_nsec += ms * 1000000;
+	ts->tv_sec += ts->tv_nsec / 1000000000;
+	ts->tv_nsec %= 1000000000;
+}
+
+static void _async_wakewriter(void) {
+	pthread_mutex_lock(&_asyncmutex);
+	pthread_cond_signal(&_writerwakeup);
+	pthread_mutex_unlock(&_asyncmutex);
+}
+
+/* Reserves the slot at the head of the ring; returns NULL if it is full */
+static struct slot *_ring_claim(size_t *const pos) {
+	size_t p = atomic_load_explicit(&_ringhead, memory_order_relaxed);
+	for(;;) {
+		struct slot *const s = &_ring[p & _ringmask];
+		const size_t seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+		const ptrdiff_t dif = (ptrdiff_t) (seq - p);
+		if(dif == 0) {
+			if(atomic_compare_exchange_weak_explicit(&_ringhead, &p, p + 1,
+			                                         memory_order_relaxed,
+			                                         memory_order_relaxed)) {
+				*pos = p;
+				return s;
+			}
+		} else if(dif < 0) {
+			return NULL;
+		} else {
+			p = atomic_load_explicit(&_ringhead, memory_order_relaxed);
+		}
+	}
+}
+
+static INLINE void _ring_publish(struct slot *const s, const size_t pos) {
+	atomic_store_explicit(&s->seq, pos + 1, memory_order_release);
+}
+
+/* Takes the slot at the tail of the ring; returns NULL if it is empty */
+static struct slot *_ring_pop(size_t *const pos) {
+	size_t p = atomic_load_explicit(&_ringtail, memory_order_relaxed);
+	for(;;) {
+		struct slot *const s = &_ring[p & _ringmask];
+		const size_t seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+		const ptrdiff_t dif = (ptrdiff_t) (seq - (p + 1));
+		if(dif == 0) {
+			if(atomic_compare_exchange_weak_explicit(&_ringtail, &p, p + 1,
+			                                         memory_order_relaxed,
+			                                         memory_order_relaxed)) {
+				*pos = p;
+				return s;
+			}
+		} else if(dif < 0) {
+			return NULL;
+		} else {
+			p = atomic_load_explicit(&_ringtail, memory_order_relaxed);
+		}
+	}
+}
+
+static INLINE void _ring_release(struct slot *const s, const size_t pos) {
+	if(s->rec.msg != s->text)
+		free((char*) s->rec.msg);
+	atomic_store_explicit(&s->seq, pos + _ringmask + 1, memory_order_release);
+	atomic_fetch_add_explicit(&_ringdone, 1, memory_order_release);
+}
+
+static struct slot *_async_claim(size_t *const pos) {
+	struct slot *s;
+	while((s = _ring_claim(pos)) == NULL) {
+		switch(_overflowpolicy) {
+			case CLOG_OVERFLOW_DROP_NEWEST:
+				atomic_fetch_add_explicit(&_ringdropped, 1,
+				                          memory_order_relaxed);
+				return NULL;
+			case CLOG_OVERFLOW_DROP_OLDEST: {
+				size_t p;
+				struct slot *const old = _ring_pop(&p);
+				if(old) {
+					_stats_dropped(old->rec.lvl);
+					_ring_release(old, p);
+					atomic_fetch_add_explicit(&_ringdropped, 1,
+					                          memory_order_relaxed);
+				}
+				break;
+			}
+			default: {
+				struct timespec ts;
+				_deadline(&ts, PRODUCER_TIMEOUT_MS);
+				pthread_mutex_lock(&_asyncmutex);
+				atomic_fetch_add(&_producersblocked, 1);
+				pthread_cond_signal(&_writerwakeup);
+				pthread_cond_timedwait(&_ringnotfull, &_asyncmutex, &ts);
+				atomic_fetch_sub(&_producersblocked, 1);
+				pthread_mutex_unlock(&_asyncmutex);
+				break;
+			}
+		}
+	}
+	return s;
+}
+
+/* Packs the fields of a record after the message in the buffer: the fields,
+   aligned, the keys as logged, then copies of the keys and strings */
+static void _buf_packfields(struct buffer *const b,
+                            const struct record *const r) {
+	const size_t align = _Alignof(LogField);
+	const size_t pad = (align - b->len % align) % align;
+	const size_t n = r->nfields * sizeof *r->fields;
+	const size_t k = r->nfields * sizeof *r->keys;
+	if(!_buf_reserve(b, pad + n + k))
+		return;
+	memset(b->data + b->len, 0, pad);
+	memcpy(b->data + b->len + pad, r->fields, n);
+	const char **const keys = (const char**) (void*) (b->data + b->len + pad
+	                                                  + n);
+	for(size_t i = 0; i < r->nfields; ++i)
+		keys[i] = r->fields[i].key;
+	b->len += pad + n + k;
+	for(size_t i = 0; i < r->nfields; ++i) {
+		_buf_append(b, r->fields[i].key, strlen(r->fields[i].key) + 1);
+		if(r->fields[i].type == CLOG_FIELD_STR && r->fields[i].value.s)
+			_buf_append(b, r->fields[i].value.s,
+			            strlen(r->fields[i].value.s) + 1);
+	}
+}
+
+/* Points the record to its fields packed in its text after the message, and
+   the fields to their keys and strings */
+static void _unpackfields(struct record *const r, char *const text) {
+	const size_t align = _Alignof(LogField);
+	char *p = text + r->msglen + (align - r->msglen % align) % align;
+	LogField *const fields = (LogField*) (void*) p;
+	p += r->nfields * sizeof *fields;
+	r->keys = (const char *const*) (void*) p;
+	p += r->nfields * sizeof *r->keys;
+	for(size_t i = 0; i < r->nfields; ++i) {
+		fields[i].key = p;
+		p += strlen(p) + 1;
+		if(fields[i].type == CLOG_FIELD_STR && fields[i].value.s) {
+			fields[i].value.s = p;
+			p += strlen(p) + 1;
+		}
+	}
+	r->fields = fields;
+}
+
+/* Tells whether enough records are queued, up to the one at pos, for the
+   writer thread to write them */
+static INLINE bool _async_due(const size_t pos) {
+	const size_t queued = pos + 1 - atomic_load_explicit(&_ringtail,
+	                                                     memory_order_relaxed);
+	return queued >= atomic_load_explicit(&_batchrecords, memory_order_relaxed)
+	       || queued > _ringmask / 2;
+}
+
+static void _async_enqueue(const struct record *const r) {
+	/* format the message before claiming a slot, to hold it shortly */
+	struct buffer *const b = &_msgbuf;
+	b->len = 0;
+	const struct argspec *spec = NULL;
+	if(_deferred && r->msg == NULL)
+		spec = _capture(b, r);
+	if(spec == NULL) {
+		b->len = 0;
+		_buf_putmsg(b, r);
+	}
+	const size_t msglen = b->len;
+	if(r->nfields)
+		_buf_packfields(b, r);
+
+	size_t len = b->len;
+	char *heap = NULL;
+	if(len > SLOT_TEXTSIZE && (heap = malloc(len)) == NULL) {
+		if(spec) {
+			/* packed arguments cannot be truncated */
+			atomic_fetch_add_explicit(&_ringdropped, 1, memory_order_relaxed);
+			_stats_dropped(r->lvl);
+			return;
+		}
+		/* truncate rather than lose it; the fields are left out */
+		len = msglen < SLOT_TEXTSIZE ? msglen : SLOT_TEXTSIZE;
+	}
+
+	size_t pos;
+	struct slot *const s = _async_claim(&pos);
+	if(s == NULL) {
+		free(heap);
+		_stats_dropped(r->lvl);
+		return;
+	}
+	s->rec = *r;
+	s->rec.args = NULL;
+	if(r->id) {
+		s->id = *r->id;
+		s->rec.id = &s->id;
+	}
+	s->rec.msg = heap ? heap : s->text;
+	s->rec.msglen = len < msglen ? len : msglen;
+	s->rec.spec = spec;
+	if(len)
+		memcpy((char*) s->rec.msg, b->data, len);
+	if(len > msglen)
+		_unpackfields(&s->rec, (char*) s->rec.msg);
+	else
+		s->rec.nfields = 0;
+	if(r->msg == r->fmt)
+		s->rec.fmt = s->rec.msg; /* keep the blank message mark */
+	_ring_publish(s, pos);
+
+	/* wake the writer up if it went to sleep and the batch is due; the
+	   fence pairs with the one on the writer side so that either one sees the
+	   other's store */
+	atomic_thread_fence(memory_order_seq_cst);
+	if(atomic_load_explicit(&_writersleeping, memory_order_relaxed)
+	   && (r->lvl == CLOG_FATAL || _async_due(pos)))
+		_async_wakewriter();
+	if(atomic_load_explicit(&_statson, memory_order_relaxed)) {
+		const size_t queued = pos + 1 - atomic_load_explicit(
+		        &_ringtail, memory_order_relaxed);
+		size_t high = atomic_load_explicit(&_ringhighwater,
+		                                   memory_order_relaxed);
+		while(queued <= _ringmask + 1 && queued > high
+		      && !atomic_compare_exchange_weak_explicit(&_ringhighwater,
+		                                                &high, queued,
+		                                                memory_order_relaxed,
+		                                                memory_order_relaxed));
+	}
+}
+
+/* Pushes a record, unless the mode stops: the ring is released once none of
+   the producers uses it */
+static void _async_push(const struct record *const r) {
+	atomic_fetch_add(&_producers, 1);
+	if(atomic_load(&_ringopen))
+		_async_enqueue(r);
+	else
+		_stats_dropped(r->lvl);
+	atomic_fetch_sub_explicit(&_producers, 1, memory_order_release);
+}
+
+static void _async_reportdrops(const struct config *const c,
+                               size_t *const reported) {
+	const size_t dropped = atomic_load_explicit(&_ringdropped,
+	                                            memory_order_relaxed);
+	if(dropped == *reported)
+		return;
+	char msg[64];
+	const int n = snprintf(msg, sizeof msg, "%zu messages dropped",
+	                       dropped - *reported);
+	struct record r = {
+		.file = __FILE__,
+		.func = __func__,
+		.fmt = "",
+		.msg = msg,
+		.msglen = (size_t) n,
+		.line = __LINE__,
+		.lvl = CLOG_WARNING
+	};
+	_getcontext(&r);
+	_dispatch(c, &r);
+	*reported = dropped;
+}
+
+/* Writes the batch of each file sink */
+static void _batch_write(const struct config *const c) {
+	for(int i = 0; i < MAX_SINKS; ++i) {
+		if(c->sinks[i] && c->sinks[i]->nspans)
+			_batch_writesink(c->sinks[i]);
+	}
+	_batchbuf.len = 0;
+}
+
+static void *_async_run(void *const unused) {
+	(void) unused;
+	size_t reported = 0;
+	for(;;) {
+		size_t pos;
+		struct slot *s;
+		pthread_mutex_lock(&_sinksmutex);
+		const struct config *c = _config_read();
+		_batching = true;
+		while((s = _ring_pop(&pos)) != NULL) {
+			_dispatch(c, &s->rec);
+			_ring_release(s, pos);
+			if(_batchbuf.len >= BATCH_SIZE) {
+				_batch_write(c);
+				/* a long drain does not hold up the configuration changes */
+				_config_done();
+				c = _config_read();
+			}
+		}
+		/* the records drained so far are written once the sinks are */
+		const size_t done = atomic_load_explicit(&_ringdone,
+		                                         memory_order_acquire);
+		_batch_write(c);
+		_batching = false;
+		_async_reportdrops(c, &reported);
+		_sinks_flush(c);
+		_config_done();
+		pthread_mutex_unlock(&_sinksmutex);
+		atomic_store_explicit(&_ringwritten, done, memory_order_release);
+
+		pthread_mutex_lock(&_asyncmutex);
+		if(atomic_load(&_producersblocked))
+			pthread_cond_broadcast(&_ringnotfull);
+		pthread_cond_broadcast(&_ringdrained);
+		atomic_store(&_writersleeping, true);
+		atomic_thread_fence(memory_order_seq_cst);
+		const size_t seq = atomic_load_explicit(
+		        &_ring[atomic_load(&_ringtail) & _ringmask].seq,
+		        memory_order_acquire);
+		const bool empty = seq != atomic_load(&_ringtail) + 1;
+		if(empty && _writerstop) {
+			pthread_mutex_unlock(&_asyncmutex);
+			break;
+		}
+		if(empty) {
+			struct timespec ts;
+			_deadline(&ts, (long) atomic_load(&_batchlatency));
+			pthread_cond_timedwait(&_writerwakeup, &_asyncmutex, &ts);
+		}
+		atomic_store(&_writersleeping, false);
+		pthread_mutex_unlock(&_asyncmutex);
+	}
+	free(_batchbuf.data);
+	_batchbuf = (struct buffer) {NULL, 0, 0};
+	return NULL;
+}
+
+static bool _async_start(size_t capacity) {
+	if(_async)
+		return true; /* the ring and its writer go on, to the new sink */
+	size_t size = 1;
+	while(size < capacity)
+		size *= 2;
+	_ring = malloc(size * sizeof *_ring);
+	if(_ring == NULL)
+		return false;
+	for(size_t i = 0; i < size; ++i)
+		atomic_init(&_ring[i].seq, i);
+	_ringmask = size - 1;
+	atomic_init(&_ringhead, 0);
+	atomic_init(&_ringtail, 0);
+	atomic_init(&_ringdone, 0);
+	atomic_init(&_ringwritten, 0);
+	atomic_init(&_ringdropped, 0);
+	atomic_store(&_ringhighwater, 0);
+	_writerstop = false;
+	if(pthread_create(&_writer, NULL, _async_run, NULL) != 0) {
+		free(_ring);
+		_ring = NULL;
+		return false;
+	}
+	atomic_store(&_ringopen, true);
+	atomic_store(&_async, true);
+	return true;
+}
+
+static void _async_stop(void) {
+	/* the records pushed so far are written, the next ones are dropped */
+	atomic_store(&_ringopen, false);
+	while(atomic_load_explicit(&_producers, memory_order_acquire))
+		sched_yield();
+	pthread_mutex_lock(&_asyncmutex);
+	_writerstop = true;
+	pthread_cond_signal(&_writerwakeup);
+	pthread_mutex_unlock(&_asyncmutex);
+	pthread_join(_writer, NULL);
+	atomic_store(&_async, false);
+	free(_ring);
+	_ring = NULL;
+}
+
+
+/* Closes the shard of an exiting thread, unless clog_term did */
+static void _shard_exit(void *const unused) {
+	(void) unused;
+	pthread_mutex_lock(&_shardsmutex);
+	struct shard *const sh = _shard.shard;
+	if(sh && _sharded && _shard.gen == _shardgen) {
+		struct shard **p = &_shards;
+		while(*p != sh)
+			p = &(*p)->next;
+		*p = sh->next;
+		_sink_teardown(&sh->sink);
+		pthread_mutex_destroy(&sh->lock);
+		free(sh);
+	}
+	_shard.shard = NULL;
+	pthread_mutex_unlock(&_shardsmutex);
+}
+
+static void _shard_makekey(void) {
+	pthread_key_create(&_shardkey, _shard_exit);
+}
+
+/* Retrieves the shard of the thread, opened by its first record; while the
+   configuration is read */
+static struct shard *_shard_get(void) {
+	const unsigned int gen = atomic_load(&_shardgen);
+	if(_shard.gen == gen)
+		return _shard.shard;
+	/* a failure is not retried until the next set-up */
+	_shard.gen = gen;
+	_shard.shard = NULL;
+	const size_t size = strlen(_shardprefix) + 12;
+	char *const name = malloc(size);
+	struct shard *const sh = malloc(sizeof *sh);
+	LogSink ops;
+	if(name)
+		snprintf(name, size, "%s.%u", _shardprefix,
+		         atomic_fetch_add_explicit(&_shardindex, 1,
+		                                   memory_order_relaxed));
+	if(name == NULL || sh == NULL || !_clog_filesink(&ops, name)) {
+		free(name);
+		free(sh);
+		return NULL;
+	}
+	free(name);
+	_sink_setup(&sh->sink, &ops, _shardfmt, _shardattrs, false);
+	pthread_mutex_init(&sh->lock, NULL);
+
+	/* the shards of the set-up being closed are not listed any more */
+	pthread_mutex_lock(&_shardsmutex);
+	const bool listed = _sharded && gen == _shardgen;
+	if(listed) {
+		sh->next = _shards;
+		_shards = sh;
+	}
+	pthread_mutex_unlock(&_shardsmutex);
+	if(!listed) {
+		_sink_teardown(&sh->sink);
+		pthread_mutex_destroy(&sh->lock);
+		free(sh);
+		return NULL;
+	}
+	_shard.shard = sh;
+	pthread_once(&_shardonce, _shard_makekey);
+	pthread_setspecific(_shardkey, &_shard);
+	return sh;
+}
+
+static void _shard_write(const struct record *const r) {
+	/* the shards are closed once no thread reads: the mode is checked while
+	   reading */
+	(void) _config_read();
+	struct shard *const sh = _sharded ? _shard_get() : NULL;
+	if(sh) {
+		struct buffer *const b = &_msgbuf;
+		b->len = 0;
+		_format(b, r, &sh->sink);
+		pthread_mutex_lock(&sh->lock);
+		_sink_write(&sh->sink, b->data, b->len, r->msg == r->fmt, r->lvl);
+		pthread_mutex_unlock(&sh->lock);
+	}
+	_config_done();
+}
+
+static void _shards_flush(void) {
+	pthread_mutex_lock(&_shardsmutex);
+	for(struct shard *sh = _shards; sh; sh = sh->next) {
+		pthread_mutex_lock(&sh->lock);
+		sh->sink.ops.flush(sh->sink.ops.userdata);
+		pthread_mutex_unlock(&sh->lock);
+	}
+	pthread_mutex_unlock(&_shardsmutex);
+}
+
+static void _shards_close(void) {
+	pthread_mutex_lock(&_shardsmutex);
+	struct shard *sh = _shards;
+	_shards = NULL;
+	atomic_store(&_sharded, false);
+	pthread_mutex_unlock(&_shardsmutex);
+	/* the threads still writing to their shard, or opening it, are done
+	   first */
+	_readers_wait();
+	while(sh) {
+		struct shard *const next = sh->next;
+		_sink_teardown(&sh->sink);
+		pthread_mutex_destroy(&sh->lock);
+		free(sh);
+		sh = next;
+	}
+	free(_shardprefix);
+	_shardprefix = NULL;
+	_config_update();
+}
+
+
+/* Replaces the main sink; the logging calls under way end with the former
+   one */
+static bool _init(const LogSink *const s, const OutputFormat fmt,
+                  const OutputAttribute a, const bool framed) {
+	_config_lock();
+	const bool ok = _sink_open(MAIN_SINK, s, fmt, a, CLOG_TRACE, framed);
+	_config_unlock();
+	if(!ok && s->close)
+		s->close(s->userdata);
+	return ok;
+}
+
+bool clog_init_file(const char *const s, const OutputFormat fmt,
+                    const OutputAttribute a) {
+	LogSink sink;
+	return _clog_filesink(&sink, s) && _init(&sink, fmt, a, false);
+}
+
+bool clog_init(const OutputFormat fmt, const OutputAttribute a) {
+	LogSink sink;
+	_clog_streamsink(&sink, stderr);
+	return _init(&sink, fmt, a, false);
+}
+
+bool clog_init_mmap(const char *const s, const OutputFormat fmt,
+                    const OutputAttribute a, const size_t segsize) {
+	LogSink sink;
+	return _clog_mmapsink(&sink, s, segsize) && _init(&sink, fmt, a, false);
+}
+
+bool clog_init_file_rotating(const char *const s, const OutputFormat fmt,
+                             const OutputAttribute a,
+                             const RotationPolicy *const p) {
+	LogSink sink;
+	return _rotatingsink(&sink, s, fmt, a, p) && _init(&sink, fmt, a, true);
+}
+
+bool clog_init_file_compressed(const char *const s, const OutputFormat fmt,
+                               const OutputAttribute a,
+                               const CompressionPolicy *const p) {
+	LogSink sink;
+	return _clog_compressedsink(&sink, s, p) && _init(&sink, fmt, a, false);
+}
+
+bool clog_init_file_async(const char *const s, const OutputFormat fmt,
+                          const OutputAttribute a, const size_t capacity) {
+	if(!clog_init_file(s, fmt, a))
+		return false;
+	if(!_async_start(capacity)) {
+		_config_lock();
+		_sink_close(MAIN_SINK);
+		_config_unlock();
+		return false;
+	}
+	return true;
+}
+
+bool clog_init_async(const OutputFormat fmt, const OutputAttribute a,
+                     const size_t capacity) {
+	return clog_init(fmt, a) && _async_start(capacity);
+}
+
+bool clog_init_sharded(const char *const prefix, const OutputFormat fmt,
+                       const OutputAttribute a) {
+	char *const p = strdup(prefix);
+	if(p == NULL)
+		return false;
+	if(_sharded)
+		_shards_close();
+	pthread_mutex_lock(&_shardsmutex);
+	_shardprefix = p;
+	_shardfmt = fmt;
+	_shardattrs = a;
+	atomic_store(&_shardindex, 0);
+	atomic_fetch_add(&_shardgen, 1);
+	clock_gettime(CLOCK_MONOTONIC, &_inittime);
+	atomic_store(&_sharded, true);
+	pthread_mutex_unlock(&_shardsmutex);
+	_config_update();
+	return true;
+}
+
+void clog_flush(void) {
+	if(_sharded)
+		_shards_flush();
+	if(_async) {
+		const size_t target = atomic_load(&_ringhead);
+		pthread_mutex_lock(&_asyncmutex);
+		while(atomic_load(&_ringwritten) < target) {
+			struct timespec ts;
+			_deadline(&ts, WRITER_TIMEOUT_MS);
+			pthread_cond_signal(&_writerwakeup);
+			pthread_cond_timedwait(&_ringdrained, &_asyncmutex, &ts);
+		}
+		pthread_mutex_unlock(&_asyncmutex);
+	} else {
+		const struct config *const c = _config_read();
+		_lock(DO_LOCK);
+		_sinks_flush(c);
+		_lock(DO_UNLOCK);
+		_config_done();
+	}
+}
+
+void clog_term(void) {
+	/* the repetitions of the last message go to the sinks about to close */
+	LogSite *const last = atomic_exchange(&_lastsite, NULL);
+	if(last)
+		_site_flushrepeats(last);
+	if(_sharded)
+		_shards_close();
+	if(_async)
+		_async_stop();
+	pthread_mutex_lock(&_configmutex);
+	_config_publish(&_noconfig);
+	pthread_mutex_unlock(&_configmutex);
+}
+
+
+/* Locks the state of the sinks, to change it while they are written to */
+static void _sinks_lock(void) {
+	if(_async) {
+		/* the messages logged so far go to the former sinks */
+		clog_flush();
+		pthread_mutex_lock(&_sinksmutex);
+	} else {
+		_lock(DO_LOCK);
+	}
+}
+
+static void _sinks_unlock(void) {
+	if(_async)
+		pthread_mutex_unlock(&_sinksmutex);
+	else
+		_lock(DO_UNLOCK);
+}
+
+static int _addsink(const LogSink *const sink, const OutputFormat fmt,
+                    const OutputAttribute a, const LogLevel lvl,
+                    const bool framed) {
+	_config_lock();
+	const struct config *const c = _config_locked();
+	int id = MAIN_SINK + 1;
+	while(id < MAX_SINKS && c->sinks[id])
+		++id;
+	if(id == MAX_SINKS || !_sink_open(id, sink, fmt, a, lvl, framed))
+		id = -1;
+	_config_unlock();
+	return id;
+}
+
+int clog_addsink(const LogSink *const sink, const OutputFormat fmt,
+                 const OutputAttribute a, const LogLevel lvl) {
+	return _addsink(sink, fmt, a, lvl, false);
+}
+
+int clog_addsink_file(const char *const s, const OutputFormat fmt,
+                      const OutputAttribute a, const LogLevel lvl) {
+	LogSink sink;
+	if(!_clog_filesink(&sink, s))
+		return -1;
+	const int id = clog_addsink(&sink, fmt, a, lvl);
+	if(id < 0)
+		sink.close(sink.userdata);
+	return id;
+}
+
+int clog_addsink_rotating(const char *const s, const OutputFormat fmt,
+                          const OutputAttribute a, const LogLevel lvl,
+                          const RotationPolicy *const p) {
+	LogSink sink;
+	if(!_rotatingsink(&sink, s, fmt, a, p))
+		return -1;
+	const int id = _addsink(&sink, fmt, a, lvl, true);
+	if(id < 0)
+		sink.close(sink.userdata);
+	return id;
+}
+
+int clog_addsink_compressed(const char *const s, const OutputFormat fmt,
+                            const OutputAttribute a, const LogLevel lvl,
+                            const CompressionPolicy *const p) {
+	LogSink sink;
+	if(!_clog_compressedsink(&sink, s, p))
+		return -1;
+	const int id = clog_addsink(&sink, fmt, a, lvl);
+	if(id < 0)
+		sink.close(sink.userdata);
+	return id;
+}
+
+int clog_addsink_stream(FILE *const f, const OutputFormat fmt,
+                        const OutputAttribute a, const LogLevel lvl) {
+	LogSink sink;
+	_clog_streamsink(&sink, f);
+	return clog_addsink(&sink, fmt, a, lvl);
+}
+
+#define SOCKET_FLUSH_MS 10 /* the records gather at most that long, in
+                              synchronous mode */
+int clog_addsink_socket(const char *const address, const SocketType type,
+                        const OutputFormat fmt, const OutputAttribute a,
+                        const LogLevel lvl, const size_t backlog) {
+	/* the strings of a binary log are defined once, in order */
+	if(fmt == CLOG_FORMAT_BINARY && type != CLOG_SOCKET_TCP)
+		return -1;
+	/* a new connection would miss the header of the format */
+	const bool reconnect = _headers[fmt].str && _headers[fmt].len == 0;
+	LogSink sink;
+	if(!_clog_socketsink(&sink, address, type, backlog, reconnect))
+		return -1;
+	const int id = clog_addsink(&sink, fmt, a, lvl);
+	if(id < 0) {
+		sink.close(sink.userdata);
+	} else if(!_async) {
+		/* the records are sent by batches, shortly after being logged, and
+		   the errors at once; in asynchronous mode, the writer thread sends
+		   all those it has at once */
+		const FlushPolicy batches = {0, CLOG_ERROR, 0, SOCKET_FLUSH_MS};
+		clog_setflushpolicy(id, &batches);
+	}
+	return id;
+}
+
+void clog_setsyslogident(const char *const app, const int facility) {
+	_syslogfacility = 0 <= facility && facility < 24 ? facility : 1;
+	_syslog_identify(app);
+}
+
+void clog_setthreadname(const char *const name) {
+	/* the name is output as is in every format */
+	struct identity *const id = &_identity;
+	unsigned char n = 0;
+	for(const char *c = name ? name : ""; *c && n < THREADNAME_MAX - 1; ++c)
+		id->name[n++] = '!' <= *c && *c <= '~' && !strchr("\"&'<>\\]", *c)
+		                ? *c : '_';
+	id->name[n] = '\0';
+	id->namelen = n;
+}
 
-static void _init_text(void) {}
-static void _init_xml(void) {
-	fputs("<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"no\"?>\n",
-		  _logfile);
-	fputs("<!DOCTYPE log SYSTEM \"clog.dtd\">", _logfile);
-	fputs("<log>\n", _logfile);
-}
-static void _init_csv(void) {
-	if(_outputattrs && CLOG_ATTR_TIME)
-		fputs("Time (hh:mm:ss)\t", _logfile);
-	if(_outputattrs && CLOG_ATTR_FILE)
-		fputs("File name\tLine number\t", _logfile);
-	if(_outputattrs && CLOG_ATTR_FUNC)
-		fputs("Function name\t", _logfile);
-	fputs("Level name\tMessage content\n", _logfile);
-}
-static void _init_json(void) {
-	_json1stmsg = true;
-	fputs("{\n\t\"log\": [", _logfile);
-}
-static INLINE bool _init(FILE *const f, const OutputFormat fmt,
-                         const OutputAttribute a) {
-	_logfile = f;
-	_outputattrs = a;
-	_initfuncs[_outputfmt = fmt]();
-	return true;
+static INLINE PURE bool _sink_valid(const struct config *const c,
+                                    const int id) {
+	return 0 <= id && id < MAX_SINKS && c->sinks[id];
 }
 
-static INLINE PURE int _is_space(const char c) {
-	return ('\t' <= c && c <= '\r') || c == ' ';
+unsigned long clog_getsinkdrops(const int id) {
+	const struct config *const c = _config_read();
+	const unsigned long n = _sink_valid(c, id)
+	                        ? _clog_sinkdrops(&c->sinks[id]->ops) : 0;
+	_config_done();
+	return n;
 }
 
-static INLINE PURE NOTNULL(1) int _msgblank(const char *msg) {
-	while(_is_space(*msg)) ++msg;
-	return !*msg;
+void clog_removesink(const int id) {
+	_config_lock();
+	if(_sink_valid(_config_locked(), id))
+		_sink_close(id);
+	_config_unlock();
 }
 
-static INLINE void _printtime(char s[9]) {
-	time_t t;
-	time(&t);
-	strftime(s, 9, "%H:%M:%S", localtime(&t));
+void clog_setsinklevel(const int id, const LogLevel lvl) {
+	_config_lock();
+	struct config *const c = _sink_valid(_config_locked(), id) ? _config_copy()
+	                                                           : NULL;
+	if(c) {
+		c->levels[id] = lvl;
+		_config_publish(c);
+	}
+	_config_unlock();
 }
 
-static INLINE void _lock(int i) {
-	if(_lockfuncs[i])
-		_lockfuncs[i](_lockuserdata);
+LogLevel clog_getsinklevel(const int id) {
+	const struct config *const c = _config_read();
+	const LogLevel lvl = _sink_valid(c, id) ? (LogLevel) c->levels[id]
+	                                        : CLOG_FATAL;
+	_config_done();
+	return lvl;
 }
 
+bool clog_setflushpolicy(const int id, const FlushPolicy *const p) {
+	/* the sink stays while the lock of its state is held */
+	_config_lock();
+	_sinks_lock();
+	bool ok = _sink_valid(_config_locked(), id);
+	if(ok) {
+		struct sink *const s = _config_locked()->sinks[id];
+		_sink_flush(s);
+		/* the datagrams cannot be gathered, nor the binary records that a
+		   socket may drop */
+		const size_t size = _clog_sinkdatagrams(&s->ops)
+		                    || (s->strings && _clog_sinksocket(&s->ops))
+		                    ? 0 : p->bufsize;
+		if(size != s->pending.size) {
+			char *const data = size ? malloc(size) : NULL;
+			ok = data || size == 0;
+			if(ok) {
+				free(s->pending.data);
+				s->pending.data = data;
+				s->pending.size = size;
+			}
+		}
+		if(ok) {
+			s->flush = *p;
+			if(s->flush.level > CLOG_FATAL)
+				s->flush.level = CLOG_FATAL;
+			s->flushed = _coarsenow();
+		}
+	}
+	_sinks_unlock();
+	_config_unlock();
+	return ok;
+}
 
-bool clog_init_file(const char *const s, const OutputFormat fmt,
-                    const OutputAttribute a) {
-	FILE *const f = fopen(s, "w");
-	return (f != NULL) && _init(f, fmt, a);
+
+bool clog_setrecorder(const RecorderPolicy *const p) {
+	const bool on = p && p->capacity;
+	/* the sites stop recording before the ring changes */
+	atomic_store(&_recorderlevel, RECORDER_OFF);
+	const bool ok = _clog_recorder_setup(on ? p->capacity : 0,
+	                                     on ? p->fd : -1,
+	                                     on && p->signals);
+	if(on && ok) {
+		_recorderattrs = p->attrs;
+		_recorderformat = _formatter(CLOG_FORMAT_TEXT, p->attrs);
+		atomic_store(&_recorderlevel, (int) p->level);
+	}
+	_config_update();
+	return ok;
 }
 
-bool clog_init(const OutputFormat fmt, const OutputAttribute a) {
-	return _init(stderr, fmt, a);
+void clog_setstats(const bool enabled) {
+	atomic_store(&_statson, enabled);
+	/* the sites pass their messages filtered out, or no longer */
+	atomic_fetch_add(&_clog_filtergen, 1);
 }
 
-void clog_term(void) {
-	switch(_outputfmt) {
-		case CLOG_FORMAT_XML:
-			fputs("</log>\n", _logfile);
-			break;
-		case CLOG_FORMAT_JSON:
-			fputs("\n\t]\n}\n", _logfile);
-			break;
-		default: break;
+void clog_getstats(LogStats *const stats) {
+	*stats = (LogStats) {.highwater = atomic_load(&_ringhighwater)};
+	unsigned long long *const to = (unsigned long long*) stats;
+	pthread_mutex_lock(&_statsmutex);
+	for(const struct threadstats *t = &_exitedstats; t;
+	    t = t == &_exitedstats ? _allstats : t->next) {
+		const atomic_ullong *const from = (const atomic_ullong*) t;
+		for(size_t i = 0; i < offsetof(LogStats, highwater) / sizeof *to; ++i)
+			to[i] += atomic_load_explicit(&from[i], memory_order_relaxed);
 	}
-	fclose(_logfile);
+	pthread_mutex_unlock(&_statsmutex);
+}
+
+size_t clog_dumprecorder(void) {
+	return _clog_recorder_dump();
 }
 
 
 FILE *clog_getlogfile(void) {
-	return _logfile;
+	const struct config *const c = _config_read();
+	FILE *const f = c->sinks[MAIN_SINK]
+	                ? _clog_sinkfile(&c->sinks[MAIN_SINK]->ops) : NULL;
+	_config_done();
+	return f;
 }
 
 void clog_setfilterlevel(const LogLevel lvl) {
-	_filterlevel = lvl;
+	atomic_store(&_filterlevel, lvl);
+	atomic_fetch_add(&_clog_filtergen, 1);
+}
+
+static struct filter *_findfilter(const char *const prefix) {
+	for(size_t i = 0; i < _nfilters; ++i) {
+		if(strcmp(_filters[i].prefix, prefix) == 0)
+			return &_filters[i];
+	}
+	return NULL;
+}
+
+bool clog_setfilterlevel_for(const char *const prefix, const LogLevel lvl) {
+	bool ok = true;
+	pthread_mutex_lock(&_filtersmutex);
+	struct filter *f = _findfilter(prefix);
+	if(f == NULL) {
+		struct filter *const filters = realloc(_filters, (_nfilters + 1)
+		                                                 * sizeof *filters);
+		char *const p = filters ? strdup(prefix) : NULL;
+		if(filters)
+			_filters = filters;
+		if(p) {
+			f = &_filters[_nfilters++];
+			f->prefix = p;
+			f->len = strlen(p);
+		}
+		ok = p != NULL;
+	}
+	if(f) {
+		f->lvl = lvl;
+		atomic_fetch_add(&_clog_filtergen, 1);
+	}
+	pthread_mutex_unlock(&_filtersmutex);
+	return ok;
+}
+
+void clog_unsetfilterlevel_for(const char *const prefix) {
+	pthread_mutex_lock(&_filtersmutex);
+	struct filter *const f = _findfilter(prefix);
+	if(f) {
+		free(f->prefix);
+		*f = _filters[--_nfilters];
+		atomic_fetch_add(&_clog_filtergen, 1);
+	}
+	pthread_mutex_unlock(&_filtersmutex);
+}
+
+/* Tells whether a file is in a module: its path starts with the prefix, or
+   has it after a separator */
+static bool _inmodule(const char *file, const struct filter *const f) {
+	for(;;) {
+		if(strncmp(file, f->prefix, f->len) == 0)
+			return true;
+		if((file = strchr(file, '/')) == NULL)
+			return false;
+		++file;
+	}
+}
+
+unsigned int _clog_siteresolve(LogSite *const site) {
+	/* the generation is read with the filters it goes with; the longest
+	   prefix of the file gives its level */
+	pthread_mutex_lock(&_filtersmutex);
+	const unsigned int gen = atomic_load(&_clog_filtergen);
+	int lvl = atomic_load(&_filterlevel);
+	size_t len = 0;
+	for(size_t i = 0; i < _nfilters; ++i) {
+		if(_filters[i].len > len && _inmodule(site->file, &_filters[i])) {
+			len = _filters[i].len;
+			lvl = _filters[i].lvl;
+		}
+	}
+	pthread_mutex_unlock(&_filtersmutex);
+	const int floor = atomic_load(&_sinkfloor);
+	if(lvl < floor)
+		lvl = floor;
+	/* the site may only keep its messages in the recorder, or pass them all
+	   to be counted */
+	const int rec = atomic_load(&_statson) ? CLOG_TRACE
+	                                       : atomic_load(&_recorderlevel);
+	const unsigned int filter = gen << 2 * CLOG_SITE_LEVELBITS
+	                            | (unsigned int) lvl << CLOG_SITE_LEVELBITS
+	                            | (unsigned int) (rec < lvl ? rec : lvl);
+	atomic_store_explicit(&site->filter, filter, memory_order_relaxed);
+	return filter;
 }
 
 LogLevel clog_getfilterlevel(void) {
-	return _filterlevel;
+	return atomic_load_explicit(&_filterlevel, memory_order_relaxed);
 }
 
 const char *clog_getfiltername(void) {
-	return _levelnames[_filterlevel];
+	return _levelnames[clog_getfilterlevel()];
 }
 
 OutputAttribute clog_getoutputattrs(void) {
-	return _outputattrs;
+	const struct config *const c = _config_read();
+	const OutputAttribute a = c->sinks[MAIN_SINK] ? c->sinks[MAIN_SINK]->attrs
+	                                              : CLOG_ATTR_MINIMAL;
+	_config_done();
+	return a;
+}
+
+OutputFormat clog_getoutputformat(void) {
+	const struct config *const c = _config_read();
+	const OutputFormat fmt = c->sinks[MAIN_SINK] ? c->sinks[MAIN_SINK]->fmt
+	                                             : CLOG_FORMAT_TEXT;
+	_config_done();
+	return fmt;
+}
+
+void clog_setlocktype(const LockType t) {
+	_locktype = t;
+}
+
+LockType clog_getlocktype(void) {
+	return _locktype;
 }
 
 void clog_setlock(void (*const f)(void*)) {
@@ -183,6 +2509,112 @@ void *clog_getlockuserdata(void) {
 	return _lockuserdata;
 }
 
+void clog_setoverflowpolicy(const OverflowPolicy p) {
+	_overflowpolicy = p;
+}
+
+OverflowPolicy clog_getoverflowpolicy(void) {
+	return _overflowpolicy;
+}
+
+void clog_setdeferred(const bool d) {
+	_deferred = d;
+}
+
+bool clog_getdeferred(void) {
+	return _deferred;
+}
+
+void clog_setbatchpolicy(const BatchPolicy *const p) {
+	atomic_store(&_batchrecords, p->records ? p->records : 1);
+	atomic_store(&_batchlatency, p->latency ? p->latency : 1);
+}
+
+void clog_setratelimit(const unsigned int rate, const unsigned int burst) {
+	const unsigned long long interval = rate ? 1000000000ULL / rate : 0;
+	atomic_store(&_ratetolerance, interval * (burst ? burst - 1 : 0));
+	atomic_store(&_rateinterval, interval);
+}
+
+void clog_setcollapse(const bool c) {
+	_collapse = c;
+}
+
+bool clog_getcollapse(void) {
+	return _collapse;
+}
+
+void clog_setsamplerate(const LogLevel lvl, const unsigned int rate) {
+	atomic_store(&_clog_samplethresholds[lvl],
+	             rate > 1 ? UINT32_MAX / rate : UINT32_MAX);
+	atomic_store(&_samplerates[lvl], rate > 1 ? rate : 1);
+}
+
+unsigned int clog_getsamplerate(const LogLevel lvl) {
+	return atomic_load(&_samplerates[lvl]);
+}
+
+uint32_t _clog_sampleseed(void) {
+	/* the threads draw from different seeds, mixed (as in splitmix64) from
+	   the address of their state and the time */
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	uint64_t x = (uintptr_t) &_clog_samplestate
+	             ^ (uint64_t) now.tv_sec * 1000000000U ^ (uint64_t) now.tv_nsec;
+	x = (x ^ x >> 30) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ x >> 27) * 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	/* 0 is the only state the generator does not leave */
+	const uint32_t seed = (uint32_t) x ? (uint32_t) x : 1;
+	_clog_samplestate = seed;
+	return seed;
+}
+
+void _clog_replay(const struct timespec *const time,
+                  const struct timespec *const uptime,
+                  const struct replayid *const id, const char *const file,
+                  const unsigned int line, const char *const func,
+                  const LogLevel lvl, const char *const msg,
+                  const bool newline, const LogField *const fields,
+                  const size_t nfields) {
+	if((int) lvl < atomic_load_explicit(&_filterlevel, memory_order_relaxed)
+	   || (int) lvl < atomic_load_explicit(&_sinkfloor, memory_order_relaxed))
+		return;
+	/* the identity is rendered as that of the thread which logged */
+	struct identity ident = {.cpu = -1};
+	if(id) {
+		if(id->tid)
+			ident.tidlen = _idstr(ident.tidstr, ident.tid = id->tid);
+		if(id->cpu >= 0)
+			ident.cpulen = _idstr(ident.cpustr, ident.cpu = id->cpu);
+		for(const char *c = id->name ? id->name : "";
+		    *c && ident.namelen < THREADNAME_MAX - 1; ++c)
+			ident.name[ident.namelen++] = *c;
+	}
+	const struct record r = {
+		.id = id ? &ident : NULL,
+		.file = file,
+		.func = func,
+		/* a blank message is output as is, as when it was logged */
+		.fmt = _msgblank(msg) && nfields == 0 ? msg : newline ? "\n" : "",
+		.args = NULL,
+		.msg = msg,
+		.msglen = strlen(msg),
+		.spec = NULL,
+		.fields = fields,
+		.nfields = nfields,
+		.time = *time,
+		.uptime = *uptime,
+		.line = line,
+		.lvl = lvl
+	};
+	const struct config *const c = _config_read();
+	_lock(DO_LOCK);
+	_dispatch(c, &r);
+	_lock(DO_UNLOCK);
+	_config_done();
+}
+
 void logmsg(const char *const file, const unsigned int line,
             const char *const func, const LogLevel level, const char *const fmt,
             ...) {
@@ -192,69 +2624,454 @@ void logmsg(const char *const file, const unsigned int line,
 	va_end(args);
 }
 
-void vlogmsg(const char *const file, const unsigned int line,
-             const char *const func, const LogLevel lvl, const char *fmt,
-             va_list args) {
-	/* acquire thread lock */
-	_lock(DO_LOCK);
-
-	if(_logfile == NULL) {
-		/* _logfile has not yet been initialized, we do it now */
-		_logfile = stderr;
+/* Sets up the default sink, unless another thread did */
+static void _config_default(void) {
+	pthread_mutex_lock(&_configmutex);
+	if(_config_locked()->nsinks == 0) {
+		LogSink sink;
+		_clog_streamsink(&sink, stderr);
+		_sink_open(MAIN_SINK, &sink, CLOG_FORMAT_TEXT, CLOG_ATTR_MINIMAL,
+		           CLOG_TRACE, false);
 	}
+	pthread_mutex_unlock(&_configmutex);
+}
 
-	if(_filterlevel <= lvl) {
-		if(_msgblank(fmt)) {
-			fputs(fmt, _logfile);
-			_lock(DO_UNLOCK);
-			return;
+/* Outputs a record that passed the filters, as per the mode of the system */
+static void _logrecord(const struct record *const r) {
+	struct threadstats *t = _stats();
+	if(t) {
+		/* the lock is timed for some of the records only */
+		_stat_add(&t->emitted[r->lvl], 1);
+		if(atomic_load_explicit(&t->emitted[r->lvl], memory_order_relaxed)
+		   % STATS_LOCKSAMPLING != 1)
+			t = NULL;
+	}
+	if(_sharded) {
+		_shard_write(r);
+	} else if(_async) {
+		_async_push(r);
+	} else {
+		const struct config *c = _config_read();
+		if(c->nsinks == 0) {
+			/* no sink has been set up yet, we log to stderr */
+			_config_done();
+			_config_default();
+			c = _config_read();
 		}
-		if(*fmt == '\n') {
-			fputs("\n", _logfile);
-			++fmt; /* omit the new line from the message */
+
+		/* acquire thread lock */
+		unsigned long long t0 = t ? _nsnow() : 0;
+		_lock(DO_LOCK);
+		if(t) {
+			const unsigned long long t1 = _nsnow();
+			_stat_time(t->lockwait, t1 - t0);
+			t0 = t1;
 		}
 
-		_outputfuncs[_outputfmt](file, line, func, lvl, fmt, args);
+		_dispatch(c, r);
 
 		/* release thread lock */
+		if(t)
+			_stat_time(t->lockhold, _nsnow() - t0);
 		_lock(DO_UNLOCK);
+		_config_done();
+	}
+}
+
+/* Keeps a record in the flight recorder */
+static void _record(const struct record *const r) {
+	struct buffer *const b = &_msgbuf;
+	b->len = 0;
+	if(r->msg == r->fmt) {
+		_buf_putmsg(b, r);
+	} else {
+		if(*r->fmt == '\n')
+			_buf_putc(b, '\n');
+		_recorderformat(b, r, _recorderattrs);
+	}
+	if(b->len)
+		_clog_recorder_put(b->data, b->len);
+}
+
+static INLINE bool _recorded(const LogLevel lvl) {
+	return (int) lvl >= atomic_load_explicit(&_recorderlevel,
+	                                         memory_order_relaxed);
+}
+
+/* Writes out the recorder after a fatal record, once the sinks have it */
+static INLINE void _recorder_onfatal(const LogLevel lvl) {
+	if(lvl == CLOG_FATAL && _recorded(lvl)) {
+		clog_flush();
+		_clog_recorder_dump();
+	}
+}
+
+/* Logs a message that passed the filters, if it is output; it is kept in the
+   recorder if its level is recorded. A message sampled holds its rate */
+static void _vlogmsg(const char *const file, const unsigned int line,
+                     const char *const func, const LogLevel lvl,
+                     const char *const fmt, va_list args, const bool output,
+                     const unsigned int rate) {
+	va_list copy;
+	va_copy(copy, args);
+	struct record r = {
+		.file = file,
+		.func = func,
+		.fmt = fmt,
+		.args = &copy,
+		.msg = NULL,
+		.msglen = 0,
+		.spec = NULL,
+		.line = line,
+		.lvl = lvl
+	};
+	_getcontext(&r);
+	if(_msgblank(fmt)) {
+		/* the message is output as is, with no formatting */
+		r.msg = fmt;
+		r.msglen = strlen(fmt);
+	}
+	const LogField sampled = CLOG_UINT("sample_rate", rate);
+	if(rate > 1 && r.msg == NULL) {
+		r.fields = &sampled;
+		r.nfields = 1;
+	}
+	if(_recorded(lvl)) {
+		/* the arguments are read by each rendering */
+		va_list again;
+		va_copy(again, args);
+		struct record rr = r;
+		rr.args = &again;
+		_record(&rr);
+		va_end(again);
+	}
+	if(output) {
+		_logrecord(&r);
+		_recorder_onfatal(lvl);
 	}
+	va_end(copy);
 }
 
+void vlogmsg(const char *const file, const unsigned int line,
+             const char *const func, const LogLevel lvl, const char *const fmt,
+             va_list args) {
+	/* filter out before anything else, a relaxed read is enough here */
+	const bool output =
+	        (int) lvl >= atomic_load_explicit(&_filterlevel, memory_order_relaxed)
+	        && (int) lvl >= atomic_load_explicit(&_sinkfloor,
+	                                             memory_order_relaxed);
+	if(output || _recorded(lvl))
+		_vlogmsg(file, line, func, lvl, fmt, args, output, 1);
+	if(!output)
+		_stats_filtered(lvl);
+}
+
+
+/* Logs a notice about the messages of a site, as if from the site */
+static void _sitemsg(const LogSite *const site, const LogLevel lvl,
+                     const char *const fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	_vlogmsg(site->file, site->line, site->func, lvl, fmt, args, true, 1);
+	va_end(args);
+}
+
+/* Logs the count of the repetitions of the last message of a site, if any */
+static void _site_flushrepeats(LogSite *const site) {
+	const unsigned long n = atomic_exchange_explicit(&site->repeats, 0,
+	                                                 memory_order_relaxed);
+	if(n)
+		_sitemsg(site, (LogLevel) atomic_load_explicit(&site->level,
+		                                               memory_order_relaxed),
+		         "last message repeated %lu times", n);
+}
+
+/* Tells whether the rate limit of a site lets a message through; a message
+   that it does not is counted */
+static INLINE bool _site_admit(LogSite *const site) {
+	const unsigned long long interval =
+	        atomic_load_explicit(&_rateinterval, memory_order_relaxed);
+	if(interval == 0)
+		return true;
+	const unsigned long long tolerance =
+	        atomic_load_explicit(&_ratetolerance, memory_order_relaxed);
+	const unsigned long long now = _coarsenow();
+	unsigned long long due = atomic_load_explicit(&site->due,
+	                                              memory_order_relaxed);
+	do {
+		if(due > now + tolerance) {
+			atomic_fetch_add_explicit(&site->suppressed, 1,
+			                          memory_order_relaxed);
+			return false;
+		}
+	} while(!atomic_compare_exchange_weak_explicit(&site->due, &due,
+	                                               (due > now ? due : now)
+	                                               + interval,
+	                                               memory_order_relaxed,
+	                                               memory_order_relaxed));
+	return true;
+}
+
+/* Hashes a message (FNV-1a), from its packed arguments if they can be */
+static unsigned long long _msghash(const struct record *const r) {
+	struct buffer *const t = &_textbuf;
+	t->len = 0;
+	if(_capture(t, r) == NULL) {
+		t->len = 0;
+		_buf_putmsg(t, r);
+	}
+	unsigned long long h = 14695981039346656037ULL ^ (uintptr_t) r->fmt;
+	for(size_t i = 0; i < t->len; ++i)
+		h = (h ^ (unsigned char) t->data[i]) * 1099511628211ULL;
+	return h ? h : 1; /* 0 is the hash of no message */
+}
 
-static void _vlogmsg_text(const char *const file, const unsigned int line,
-                          const char *const func, const LogLevel lvl,
+/* Tells whether a message repeats the last one, which it counts; the former
+   last message is otherwise done repeating */
+static bool _site_repeats(LogSite *const site, const LogLevel lvl,
                           const char *const fmt, va_list args) {
+	va_list copy;
+	va_copy(copy, args);
+	const struct record r = {
+		.fmt = fmt,
+		.args = &copy,
+		.msg = NULL,
+		.spec = NULL
+	};
+	const unsigned long long h = _msghash(&r);
+	va_end(copy);
+	if(atomic_load_explicit(&_lastsite, memory_order_relaxed) == site
+	   && atomic_load_explicit(&site->hash, memory_order_relaxed) == h) {
+		atomic_fetch_add_explicit(&site->repeats, 1, memory_order_relaxed);
+		return true;
+	}
+	LogSite *const last = atomic_exchange(&_lastsite, site);
+	if(last)
+		_site_flushrepeats(last);
+	atomic_store_explicit(&site->hash, h, memory_order_relaxed);
+	atomic_store_explicit(&site->level, (int) lvl, memory_order_relaxed);
+	return false;
+}
+
+/* Logs the count of the messages of a site that were rate limited, if any */
+static INLINE void _site_reportsuppressed(LogSite *const site,
+                                          const LogLevel lvl) {
+	if(atomic_load_explicit(&site->suppressed, memory_order_relaxed)) {
+		const unsigned long n = atomic_exchange_explicit(&site->suppressed, 0,
+		                                                 memory_order_relaxed);
+		if(n)
+			_sitemsg(site, lvl, "%lu messages suppressed", n);
+	}
+}
+
+/* The rate a message of a site was sampled at, by the site and its level */
+static INLINE unsigned int _site_rate(const LogSite *const site,
+                                      const LogLevel lvl) {
+	const unsigned long long rate =
+	        (unsigned long long) (site->rate ? site->rate : 1)
+	        * atomic_load_explicit(&_samplerates[lvl], memory_order_relaxed);
+	return rate < UINT_MAX ? (unsigned int) rate : UINT_MAX;
+}
+
+/* Tells whether a message of an enabled site is output, and not only kept in
+   the recorder */
+static INLINE bool _site_outputs(const LogSite *const site,
+                                 const LogLevel lvl) {
+	const unsigned int filter = atomic_load_explicit(&site->filter,
+	                                                 memory_order_relaxed);
+	return (unsigned int) lvl >= (filter >> CLOG_SITE_LEVELBITS
+	                              & ((1u << CLOG_SITE_LEVELBITS) - 1));
+}
+
+void logsite(LogSite *const site, const LogLevel lvl, const char *const fmt,
+             ...) {
+	if(!_clog_siteenabled(site, lvl))
+		return;
+	va_list args;
+	if(!_site_outputs(site, lvl)) {
+		/* with the statistics, the site passes all its messages */
+		_stats_filtered(lvl);
+		if(!_recorded(lvl))
+			return;
+		va_start(args, fmt);
+		_vlogmsg(site->file, site->line, site->func, lvl, fmt, args, false,
+		         _site_rate(site, lvl));
+		va_end(args);
+		return;
+	}
+	/* the suppressed messages are not even formatted */
+	if(!_site_admit(site)) {
+		_stats_ratelimited(lvl);
+		return;
+	}
+	_site_reportsuppressed(site, lvl);
+	va_start(args, fmt);
+	if(!_collapse || !_site_repeats(site, lvl, fmt, args))
+		_vlogmsg(site->file, site->line, site->func, lvl, fmt, args, true,
+		         _site_rate(site, lvl));
+	va_end(args);
+}
+
+/* The format of the messages with fields, which are not formatted; it is not
+   that of a blank message */
+static const char _nofmt[] = "";
+
+void logfields(LogSite *const site, const LogLevel lvl, const char *const msg,
+               const LogField *const fields, const size_t nfields) {
+	if(!_clog_siteenabled(site, lvl))
+		return;
+	const bool output = _site_outputs(site, lvl);
+	if(!output) {
+		_stats_filtered(lvl);
+		if(!_recorded(lvl))
+			return;
+	} else {
+		if(!_site_admit(site)) {
+			_stats_ratelimited(lvl);
+			return;
+		}
+		_site_reportsuppressed(site, lvl);
+		if(_collapse) {
+			/* not collapsed, but the repetitions of the last message end
+			   here */
+			LogSite *const last = atomic_exchange(&_lastsite, NULL);
+			if(last)
+				_site_flushrepeats(last);
+		}
+	}
+	struct record r = {
+		.file = site->file,
+		.func = site->func,
+		.fmt = _nofmt,
+		.args = NULL,
+		.msg = msg,
+		.msglen = strlen(msg),
+		.spec = NULL,
+		.fields = fields,
+		.nfields = nfields,
+		.line = site->line,
+		.lvl = lvl
+	};
+	/* the rate of a message sampled is one more field, after its own */
+	const unsigned int rate = _site_rate(site, lvl);
+	LogField sampled[rate > 1 ? nfields + 1 : 1];
+	if(rate > 1) {
+		if(nfields)
+			memcpy(sampled, fields, nfields * sizeof *fields);
+		sampled[nfields] = CLOG_UINT("sample_rate", rate);
+		r.fields = sampled;
+		r.nfields = nfields + 1;
+	}
+	_getcontext(&r);
+	if(_recorded(lvl))
+		_record(&r);
+	if(output) {
+		_logrecord(&r);
+		_recorder_onfatal(lvl);
+	}
+}
+
+
+/* The formatters are specialized for each set of core attributes: the
+   attributes tested in their body are constants, and the tests are folded */
+#define CORE_TIME 0x1
+#define CORE_UPTIME 0x2
+#define CORE_FILE 0x4
+#define CORE_FUNC 0x8
+#define CORE_COLORED 0x10 /* in text format only */
+#ifdef __GNUC__
+# define SPECIALIZED INLINE __attribute__((always_inline))
+#else
+# define SPECIALIZED INLINE
+#endif
+
+/* The identity of the thread of a record is shown if it is known; it comes
+   prerendered */
+static INLINE bool _showsthread(const struct record *const r,
+                                const OutputAttribute a) {
+	return (a & CLOG_ATTR_THREAD) && r->id && r->id->tidlen;
+}
+
+static INLINE bool _showscpu(const struct record *const r,
+                             const OutputAttribute a) {
+	return (a & CLOG_ATTR_CPU) && r->id && r->id->cpulen;
+}
+
+#define _buf_putid(b, r, str, len) \
+	_buf_append(b, (r)->id->str, (r)->id->len)
+
+/* Appends the identity of the thread in text: (tid name@cpu) */
+static void _buf_putidentity(struct buffer *const b,
+                             const struct record *const r,
+                             const OutputAttribute a) {
+	_buf_putc(b, '(');
+	if(_showsthread(r, a)) {
+		_buf_putid(b, r, tidstr, tidlen);
+		if(r->id->namelen) {
+			_buf_putc(b, ' ');
+			_buf_putid(b, r, name, namelen);
+		}
+	}
+	if(_showscpu(r, a)) {
+		_buf_putc(b, '@');
+		_buf_putid(b, r, cpustr, cpulen);
+	}
+	_buf_putlit(b, ") ");
+}
+
+static SPECIALIZED void _vlogmsg_text(struct buffer *const b,
+                                      const struct record *const r,
+                                      const OutputAttribute a,
+                                      const int core) {
 	/*
 	[15:36:23] myfile.c:42, main() WARNING -- There is a bug!
 	*/
-	if(_outputattrs & CLOG_ATTR_COLORED)
-		BEGIN_COLOR(lvl);
-	if(_outputattrs & CLOG_ATTR_TIME) {
-		char tstr[9];
-		_printtime(tstr);
-		fprintf(_logfile, "[%s] ", tstr);
-	}
-	if(_outputattrs & CLOG_ATTR_FILE) {
-		fprintf(_logfile, "%s:%u", file, line);
-		if(_outputattrs & CLOG_ATTR_FUNC)
-			fputc(',', _logfile);
-		fputc(' ', _logfile);
-	}
-	if(_outputattrs & CLOG_ATTR_FUNC)
-		fprintf(_logfile, "%s() ", func);
-	fprintf(_logfile, "%-7s -- ", _levelnames[lvl]);
-	if(_outputattrs & CLOG_ATTR_COLORED)
-		END_COLORS();
+	if(core == CORE_COLORED && !(a & ATTRS_IDENTITY)) {
+		/* the level is all of the header: a single copy */
+		_buf_putfrag(b, &_colorheaders[r->lvl]);
+		_buf_putmsg(b, r);
+		_buf_putfields(b, r, ' ');
+		_buf_putc(b, '\n');
+		return;
+	}
+	if(core & CORE_COLORED)
+		_buf_putfrag(b, &_colorstarts[r->lvl]);
+	if(core & CORE_TIME) {
+		_buf_putc(b, '[');
+		_buf_puttime(b, r, a);
+		_buf_putlit(b, "] ");
+	}
+	if(core & CORE_UPTIME) {
+		_buf_putlit(b, "[+");
+		_buf_putuptime(b, r, a);
+		_buf_putlit(b, "] ");
+	}
+	if((a & ATTRS_IDENTITY) && r->id)
+		_buf_putidentity(b, r, a);
+	if(core & CORE_FILE) {
+		_buf_puts(b, r->file);
+		_buf_putc(b, ':');
+		_buf_putuint(b, r->line);
+		if(core & CORE_FUNC)
+			_buf_putc(b, ',');
+		_buf_putc(b, ' ');
+	}
+	if(core & CORE_FUNC) {
+		_buf_puts(b, r->func);
+		_buf_putlit(b, "() ");
+	}
+	_buf_putfrag(b, core & CORE_COLORED ? &_colorlevels[r->lvl]
+	                                    : &_textlevels[r->lvl]);
 
 	/* The mesage itself */
-	vfprintf(_logfile, fmt, args);
-	fprintf(_logfile, "\n");
+	_buf_putmsg(b, r);
+	_buf_putfields(b, r, ' ');
+	_buf_putc(b, '\n');
 }
 
-static void _vlogmsg_xml(const char *const file, const unsigned int line,
-                         const char *const func, const LogLevel lvl,
-                         const char *const fmt, va_list args) {
+static SPECIALIZED void _vlogmsg_xml(struct buffer *const b,
+                                     const struct record *const r,
+                                     const OutputAttribute a, const int core) {
 	/*
 	<log>
 		<message time="15:36:23" file="myfile.c" line="42" func="main" level="WARNING">
@@ -262,49 +3079,110 @@ static void _vlogmsg_xml(const char *const file, const unsigned int line,
 		</message>
 	</log>
 	*/
-	fputs("\t<message ", _logfile);
-	if(_outputattrs & CLOG_ATTR_TIME) {
-		char tstr[9];
-		_printtime(tstr);
-		fprintf(_logfile, "time=\"%s\" ", tstr);
-	}
-	if(_outputattrs & CLOG_ATTR_FILE)
-		fprintf(_logfile, "file=\"%s\" line=\"%u\" ", file, line);
-	if(_outputattrs & CLOG_ATTR_FUNC)
-		fprintf(_logfile, "func=\"%s\" ", func);
-	fprintf(_logfile, "level=\"%s\">", _levelnames[lvl]);
+	_buf_putlit(b, "\t<message ");
+	if(core & CORE_TIME) {
+		_buf_putlit(b, "time=\"");
+		_buf_puttime(b, r, a);
+		_buf_putlit(b, "\" ");
+	}
+	if(core & CORE_UPTIME) {
+		_buf_putlit(b, "uptime=\"");
+		_buf_putuptime(b, r, a);
+		_buf_putlit(b, "\" ");
+	}
+	if(_showsthread(r, a)) {
+		_buf_putlit(b, "tid=\"");
+		_buf_putid(b, r, tidstr, tidlen);
+		_buf_putlit(b, "\" ");
+		if(r->id->namelen) {
+			_buf_putlit(b, "thread=\"");
+			_buf_putid(b, r, name, namelen);
+			_buf_putlit(b, "\" ");
+		}
+	}
+	if(_showscpu(r, a)) {
+		_buf_putlit(b, "cpu=\"");
+		_buf_putid(b, r, cpustr, cpulen);
+		_buf_putlit(b, "\" ");
+	}
+	if(core & CORE_FILE) {
+		_buf_putlit(b, "file=\"");
+		_buf_putescaped(b, r->file, false);
+		_buf_putlit(b, "\" line=\"");
+		_buf_putuint(b, r->line);
+		_buf_putlit(b, "\" ");
+	}
+	if(core & CORE_FUNC) {
+		_buf_putlit(b, "func=\"");
+		_buf_putescaped(b, r->func, false);
+		_buf_putlit(b, "\" ");
+	}
+	for(size_t i = 0; i < r->nfields; ++i) {
+		_buf_puts(b, r->fields[i].key);
+		_buf_putlit(b, "=\"");
+		_buf_putvalue(b, &r->fields[i], VALUE_XML);
+		_buf_putlit(b, "\" ");
+	}
+	_buf_putfrag(b, &_xmllevels[r->lvl]);
 
 	/* The mesage itself */
-	vfprintf(_logfile, fmt, args);
-	fprintf(_logfile, "</message>\n");
+	_buf_putescapedmsg(b, r, false);
+	_buf_putlit(b, "</message>\n");
 }
 
-static void _vlogmsg_csv(const char *const file, const unsigned int line,
-                         const char *const func, const LogLevel lvl,
-                         const char *const fmt, va_list args) {
+static SPECIALIZED void _vlogmsg_csv(struct buffer *const b,
+                                     const struct record *const r,
+                                     const OutputAttribute a, const int core) {
 	/*
 	Time (hh:mm:ss)	File name	Line number	Function name	Level name	Message content
 	15:36:23	myfile.c	42	main	WARNING	There is a bug!
 	*/
-	if(_outputattrs & CLOG_ATTR_TIME) {
-		char tstr[9];
-		_printtime(tstr);
-		fprintf(_logfile, "%s\t", tstr);
+	if(core & CORE_TIME) {
+		_buf_puttime(b, r, a);
+		_buf_putc(b, '\t');
+	}
+	if(core & CORE_UPTIME) {
+		_buf_putuptime(b, r, a);
+		_buf_putc(b, '\t');
 	}
-	if(_outputattrs & CLOG_ATTR_FILE)
-		fprintf(_logfile, "%s\t%u\t", file, line);
-	if(_outputattrs & CLOG_ATTR_FUNC)
-		fprintf(_logfile, "%s\t", func);
-	fprintf(_logfile, "%s\t", _levelnames[lvl]);
+	/* the columns are there even if empty */
+	if(a & CLOG_ATTR_THREAD) {
+		if(r->id) {
+			_buf_putid(b, r, tidstr, tidlen);
+			_buf_putc(b, '\t');
+			_buf_putid(b, r, name, namelen);
+			_buf_putc(b, '\t');
+		} else {
+			_buf_putlit(b, "\t\t");
+		}
+	}
+	if(a & CLOG_ATTR_CPU) {
+		if(_showscpu(r, a))
+			_buf_putid(b, r, cpustr, cpulen);
+		_buf_putc(b, '\t');
+	}
+	if(core & CORE_FILE) {
+		_buf_puts(b, r->file);
+		_buf_putc(b, '\t');
+		_buf_putuint(b, r->line);
+		_buf_putc(b, '\t');
+	}
+	if(core & CORE_FUNC) {
+		_buf_puts(b, r->func);
+		_buf_putc(b, '\t');
+	}
+	_buf_putfrag(b, &_csvlevels[r->lvl]);
 
 	/* The mesage itself */
-	vfprintf(_logfile, fmt, args);
-	fprintf(_logfile, "\n");
+	_buf_putmsg(b, r);
+	_buf_putfields(b, r, '\t');
+	_buf_putc(b, '\n');
 }
 
-static void _vlogmsg_json(const char *const file, const unsigned int line,
-                          const char *const func, const LogLevel lvl,
-                          const char *const fmt, va_list args) {
+static SPECIALIZED void _vlogmsg_json(struct buffer *const b,
+                                      const struct record *const r,
+                                      const OutputAttribute a,
+                                      const int core) {
 	/*
 	{
 		"log": [
@@ -319,27 +3197,442 @@ static void _vlogmsg_json(const char *const file, const unsigned int line,
 		]
 	}
 	*/
-	if(_json1stmsg) {
-		_json1stmsg = false;
-	} else
-		fputc(',', _logfile);
-	fputs("\n\t\t{\n", _logfile);
-	if(_outputattrs & CLOG_ATTR_TIME) {
-		char tstr[9];
-		_printtime(tstr);
-		fprintf(_logfile, "\t\t\t\"time\": \"%s\",\n", tstr);
-	}
-	if(_outputattrs & CLOG_ATTR_FILE)
-		fprintf(_logfile, "\t\t\t\"file\": \"%s\",\n\t\t\t\"line\": %u,\n",
-		        file, line);
-	if(_outputattrs & CLOG_ATTR_FUNC)
-		fprintf(_logfile, "\t\t\t\"func\": \"%s\",\n", func);
-	fprintf(_logfile, "\t\t\t\"level\": \"%s\",\n", _levelnames[lvl]);
+	/* the comma is skipped by the sink for its first record */
+	_buf_putlit(b, ",\n\t\t{\n");
+	if(core & CORE_TIME) {
+		_buf_putlit(b, "\t\t\t\"time\": \"");
+		_buf_puttime(b, r, a);
+		_buf_putlit(b, "\",\n");
+	}
+	if(core & CORE_UPTIME) {
+		_buf_putlit(b, "\t\t\t\"uptime\": ");
+		_buf_putuptime(b, r, a);
+		_buf_putlit(b, ",\n");
+	}
+	if(_showsthread(r, a)) {
+		_buf_putlit(b, "\t\t\t\"tid\": ");
+		_buf_putid(b, r, tidstr, tidlen);
+		_buf_putlit(b, ",\n");
+		if(r->id->namelen) {
+			_buf_putlit(b, "\t\t\t\"thread\": \"");
+			_buf_putid(b, r, name, namelen);
+			_buf_putlit(b, "\",\n");
+		}
+	}
+	if(_showscpu(r, a)) {
+		_buf_putlit(b, "\t\t\t\"cpu\": ");
+		_buf_putid(b, r, cpustr, cpulen);
+		_buf_putlit(b, ",\n");
+	}
+	if(core & CORE_FILE) {
+		_buf_putlit(b, "\t\t\t\"file\": \"");
+		_buf_putescaped(b, r->file, true);
+		_buf_putlit(b, "\",\n\t\t\t\"line\": ");
+		_buf_putuint(b, r->line);
+		_buf_putlit(b, ",\n");
+	}
+	if(core & CORE_FUNC) {
+		_buf_putlit(b, "\t\t\t\"func\": \"");
+		_buf_putescaped(b, r->func, true);
+		_buf_putlit(b, "\",\n");
+	}
+	_buf_putfrag(b, &_jsonlevels[r->lvl]);
+
+	/* The mesage itself */
+	_buf_putlit(b, "\t\t\t\"msg\": \"");
+	_buf_putescapedmsg(b, r, true);
+	_buf_putc(b, '"');
+	for(size_t i = 0; i < r->nfields; ++i) {
+		_buf_putlit(b, ",\n\t\t\t\"");
+		_buf_putescaped(b, r->fields[i].key, true);
+		_buf_putlit(b, "\": ");
+		_buf_putvalue(b, &r->fields[i], VALUE_JSON);
+	}
+	_buf_putlit(b, "\n\t\t}");
+}
+
+static SPECIALIZED void _vlogmsg_ndjson(struct buffer *const b,
+                                        const struct record *const r,
+                                        const OutputAttribute a,
+                                        const int core) {
+	/*
+	{"time":"15:36:23","file":"myfile.c","line":42,"func":"main","level":"WARNING","msg":"There is a bug!"}
+	*/
+	_buf_putc(b, '{');
+	if(core & CORE_TIME) {
+		_buf_putlit(b, "\"time\":\"");
+		_buf_puttime(b, r, a);
+		_buf_putlit(b, "\",");
+	}
+	if(core & CORE_UPTIME) {
+		_buf_putlit(b, "\"uptime\":");
+		_buf_putuptime(b, r, a);
+		_buf_putc(b, ',');
+	}
+	if(_showsthread(r, a)) {
+		_buf_putlit(b, "\"tid\":");
+		_buf_putid(b, r, tidstr, tidlen);
+		_buf_putc(b, ',');
+		if(r->id->namelen) {
+			_buf_putlit(b, "\"thread\":\"");
+			_buf_putid(b, r, name, namelen);
+			_buf_putlit(b, "\",");
+		}
+	}
+	if(_showscpu(r, a)) {
+		_buf_putlit(b, "\"cpu\":");
+		_buf_putid(b, r, cpustr, cpulen);
+		_buf_putc(b, ',');
+	}
+	if(core & CORE_FILE) {
+		_buf_putlit(b, "\"file\":\"");
+		_buf_putescaped(b, r->file, true);
+		_buf_putlit(b, "\",\"line\":");
+		_buf_putuint(b, r->line);
+		_buf_putc(b, ',');
+	}
+	if(core & CORE_FUNC) {
+		_buf_putlit(b, "\"func\":\"");
+		_buf_putescaped(b, r->func, true);
+		_buf_putlit(b, "\",");
+	}
+	_buf_putfrag(b, &_ndjsonlevels[r->lvl]);
+
+	/* The mesage itself */
+	_buf_putescapedmsg(b, r, true);
+	_buf_putc(b, '"');
+	for(size_t i = 0; i < r->nfields; ++i) {
+		_buf_putlit(b, ",\"");
+		_buf_putescaped(b, r->fields[i].key, true);
+		_buf_putlit(b, "\":");
+		_buf_putvalue(b, &r->fields[i], VALUE_JSON);
+	}
+	_buf_putlit(b, "}\n");
+}
+
+static SPECIALIZED void _vlogmsg_syslog(struct buffer *const b,
+                                        const struct record *const r,
+                                        const OutputAttribute a,
+                                        const int core) {
+	/*
+	<12>1 2018-05-06T15:36:23Z host app 4242 - [clog@32473 file="myfile.c" line="42" func="main"] There is a bug!
+	*/
+	_buf_putc(b, '<');
+	_buf_putuint(b, (unsigned int) _syslogfacility * 8 + _severities[r->lvl]);
+	_buf_putlit(b, ">1 ");
+	if(core & CORE_TIME)
+		_buf_putdate(b, r, a);
+	else
+		_buf_putc(b, '-');
+	_buf_append(b, _syslogid, _syslogidlen);
+
+	/* The structured data: the context of the message, and its fields */
+	if((core & (CORE_UPTIME | CORE_FILE | CORE_FUNC)) || r->nfields
+	   || _showsthread(r, a) || _showscpu(r, a)) {
+		_buf_putlit(b, "[clog@32473");
+		if(core & CORE_UPTIME) {
+			_buf_putlit(b, " uptime=\"");
+			_buf_putuptime(b, r, a);
+			_buf_putc(b, '"');
+		}
+		if(_showsthread(r, a)) {
+			_buf_putlit(b, " tid=\"");
+			_buf_putid(b, r, tidstr, tidlen);
+			_buf_putc(b, '"');
+			if(r->id->namelen) {
+				_buf_putlit(b, " thread=\"");
+				_buf_putid(b, r, name, namelen);
+				_buf_putc(b, '"');
+			}
+		}
+		if(_showscpu(r, a)) {
+			_buf_putlit(b, " cpu=\"");
+			_buf_putid(b, r, cpustr, cpulen);
+			_buf_putc(b, '"');
+		}
+		if(core & CORE_FILE) {
+			_buf_putlit(b, " file=\"");
+			_buf_putsdvalue(b, r->file);
+			_buf_putlit(b, "\" line=\"");
+			_buf_putuint(b, r->line);
+			_buf_putc(b, '"');
+		}
+		if(core & CORE_FUNC) {
+			_buf_putlit(b, " func=\"");
+			_buf_putsdvalue(b, r->func);
+			_buf_putc(b, '"');
+		}
+		for(size_t i = 0; i < r->nfields; ++i) {
+			const LogField *const f = &r->fields[i];
+			_buf_putc(b, ' ');
+			_buf_puts(b, f->key);
+			_buf_putlit(b, "=\"");
+			if(f->type == CLOG_FIELD_STR)
+				_buf_putsdvalue(b, f->value.s ? f->value.s : "(null)");
+			else
+				_buf_putvalue(b, f, VALUE_TEXT);
+			_buf_putc(b, '"');
+		}
+		_buf_putlit(b, "] ");
+	} else {
+		_buf_putlit(b, "- ");
+	}
+
+	/* The mesage itself */
+	_buf_putmsg(b, r);
+	_buf_putc(b, '\n');
+}
+
+static SPECIALIZED void _vlogmsg_journald(struct buffer *const b,
+                                          const struct record *const r,
+                                          const OutputAttribute a,
+                                          const int core) {
+	/*
+	PRIORITY=4
+	SYSLOG_IDENTIFIER=app
+	CODE_FILE=myfile.c
+	CODE_LINE=42
+	CODE_FUNC=main
+	MESSAGE=There is a bug!
+
+	*/
+	_buf_putfrag(b, &_journaldlevels[r->lvl]);
+	_buf_append(b, _journalid, _journalidlen);
+	if(_showsthread(r, a)) {
+		_buf_putlit(b, "TID=");
+		_buf_putid(b, r, tidstr, tidlen);
+		_buf_putc(b, '\n');
+		if(r->id->namelen) {
+			_buf_putlit(b, "THREAD_NAME=");
+			_buf_putid(b, r, name, namelen);
+			_buf_putc(b, '\n');
+		}
+	}
+	if(_showscpu(r, a)) {
+		_buf_putlit(b, "CPU=");
+		_buf_putid(b, r, cpustr, cpulen);
+		_buf_putc(b, '\n');
+	}
+	if(core & CORE_FILE) {
+		_buf_putlit(b, "CODE_FILE=");
+		_buf_puts(b, r->file);
+		_buf_putlit(b, "\nCODE_LINE=");
+		_buf_putuint(b, r->line);
+		_buf_putc(b, '\n');
+	}
+	if(core & CORE_FUNC) {
+		_buf_putlit(b, "CODE_FUNC=");
+		_buf_puts(b, r->func);
+		_buf_putc(b, '\n');
+	}
 
 	/* The mesage itself */
-	fputs("\t\t\t\"msg: \"", _logfile);
-	vfprintf(_logfile, fmt, args);
-	fprintf(_logfile, "\"\n\t\t}");
+	_buf_putlit(b, "MESSAGE=");
+	size_t start = b->len;
+	_buf_putmsg(b, r);
+	_buf_endjournalfield(b, start);
+	for(size_t i = 0; i < r->nfields; ++i) {
+		const LogField *const f = &r->fields[i];
+		_buf_putjournalkey(b, f->key);
+		_buf_putc(b, '=');
+		start = b->len;
+		if(f->type == CLOG_FIELD_STR)
+			_buf_puts(b, f->value.s ? f->value.s : "(null)");
+		else
+			_buf_putvalue(b, f, VALUE_TEXT);
+		_buf_endjournalfield(b, start);
+	}
+	_buf_putc(b, '\n');
+}
+
+/* One formatter per format and set of core attributes */
+#define CORES16(X, f) X(f, 0) X(f, 1) X(f, 2) X(f, 3) X(f, 4) X(f, 5) X(f, 6) \
+                      X(f, 7) X(f, 8) X(f, 9) X(f, 10) X(f, 11) X(f, 12) \
+                      X(f, 13) X(f, 14) X(f, 15)
+#define CORES32(X, f) CORES16(X, f) X(f, 16) X(f, 17) X(f, 18) X(f, 19) \
+                      X(f, 20) X(f, 21) X(f, 22) X(f, 23) X(f, 24) X(f, 25) \
+                      X(f, 26) X(f, 27) X(f, 28) X(f, 29) X(f, 30) X(f, 31)
+#define SPECIALIZE(f, core) \
+	static void _vlogmsg_##f##_##core(struct buffer *const b, \
+	                                  const struct record *const r, \
+	                                  const OutputAttribute a) { \
+		_vlogmsg_##f(b, r, a, core); \
+	}
+#define FORMATTER(f, core) _vlogmsg_##f##_##core,
+
+CORES32(SPECIALIZE, text)
+CORES16(SPECIALIZE, xml)
+CORES16(SPECIALIZE, csv)
+CORES16(SPECIALIZE, json)
+CORES16(SPECIALIZE, ndjson)
+CORES16(SPECIALIZE, syslog)
+CORES16(SPECIALIZE, journald)
+
+static const formatter _textformatters[] = {CORES32(FORMATTER, text)};
+static const formatter _xmlformatters[] = {CORES16(FORMATTER, xml)};
+static const formatter _csvformatters[] = {CORES16(FORMATTER, csv)};
+static const formatter _jsonformatters[] = {CORES16(FORMATTER, json)};
+static const formatter _ndjsonformatters[] = {CORES16(FORMATTER, ndjson)};
+static const formatter _syslogformatters[] = {CORES16(FORMATTER, syslog)};
+static const formatter _journaldformatters[] = {CORES16(FORMATTER, journald)};
+
+static formatter _formatter(const OutputFormat fmt, const OutputAttribute a) {
+	const int core = (a & ATTRS_TIME ? CORE_TIME : 0)
+	                 | (a & CLOG_ATTR_UPTIME ? CORE_UPTIME : 0)
+	                 | (a & CLOG_ATTR_FILE ? CORE_FILE : 0)
+	                 | (a & CLOG_ATTR_FUNC ? CORE_FUNC : 0);
+	switch(fmt) {
+		case CLOG_FORMAT_XML: return _xmlformatters[core];
+		case CLOG_FORMAT_CSV: return _csvformatters[core];
+		case CLOG_FORMAT_JSON: return _jsonformatters[core];
+		case CLOG_FORMAT_NDJSON: return _ndjsonformatters[core];
+		case CLOG_FORMAT_SYSLOG: return _syslogformatters[core];
+		case CLOG_FORMAT_JOURNALD: return _journaldformatters[core];
+		default:
+			return _textformatters[core | (a & CLOG_ATTR_COLORED
+			                               ? CORE_COLORED : 0)];
+	}
+}
+
+
+/* Retrieves the identifier of a string, or 0 if the table is full */
+static unsigned int _intern(const char *const str) {
+	/* Fibonacci hashing of the address */
+	size_t i = (size_t) ((uint32_t) (uintptr_t) str * 2654435769u
+	                     >> (32 - STRINGS_BITS));
+	for(size_t probe = 0; probe < STRINGS_SIZE; ++probe) {
+		const char *s = atomic_load_explicit(&_strings[i],
+		                                     memory_order_relaxed);
+		if(s == NULL
+		   && atomic_compare_exchange_strong_explicit(&_strings[i], &s, str,
+		                                              memory_order_relaxed,
+		                                              memory_order_relaxed))
+			return (unsigned int) i + 1;
+		/* another thread may have taken the entry first; s is its value */
+		if(s == str)
+			return (unsigned int) i + 1;
+		i = (i + 1) & (STRINGS_SIZE - 1);
+	}
+	return 0;
+}
+
+/* Defines a string in the table of a binary sink, unless it already is;
+   returns its identifier */
+static unsigned int _binary_define(struct buffer *const b,
+                                   const struct sink *const s,
+                                   const char *const str) {
+	const unsigned int id = s->strings ? _intern(str) : 0;
+	const unsigned int bit = 1u << id % 32;
+	if(id && !(atomic_fetch_or_explicit(&s->strings[id / 32], bit,
+	                                        memory_order_relaxed) & bit)) {
+		const size_t len = strlen(str);
+		_buf_putc(b, BINARY_STRING);
+		_buf_putvarint(b, id);
+		_buf_putvarint(b, len);
+		_buf_append(b, str, len);
+	}
+	return id;
+}
+
+static INLINE void _buf_putstrid(struct buffer *const b,
+                                 const unsigned int id, const char *const str) {
+	_buf_putvarint(b, id);
+	if(id == 0) {
+		/* not in the table: the string itself */
+		const size_t len = strlen(str);
+		_buf_putvarint(b, len);
+		_buf_append(b, str, len);
+	}
+}
+
+/* The key of a field as logged: a copy of it would be interned by the address
+   of the copy */
+static INLINE const char *_fieldkey(const struct record *const r,
+                                    const size_t i) {
+	return r->keys ? r->keys[i] : r->fields[i].key;
+}
+
+/* Encodes a field of a binary record, whose key is defined already */
+static INLINE void _buf_putfield(struct buffer *const b,
+                                 const struct sink *const s,
+                                 const LogField *const f,
+                                 const char *const key) {
+	_buf_putstrid(b, _binary_define(b, s, key), key);
+	const size_t n = _clog_encodevalue(NULL, 0, f);
+	if(_buf_reserve(b, n)) {
+		_clog_encodevalue(b->data + b->len, n, f);
+		b->len += n;
+	}
+}
+
+/* The format of the messages stored formatted in the binary records */
+static const char _strfmt[] = "\n%s";
+
+static void _vlogmsg_binary(struct buffer *const b,
+                            const struct record *const r,
+                            const struct sink *const s) {
+	const struct argspec *spec = r->spec;
+	const char *args = r->msg;
+	size_t len = r->msglen;
+	if(args == NULL) {
+		struct buffer *const t = &_textbuf;
+		t->len = 0;
+		spec = _capture(t, r);
+		if(spec == NULL) {
+			t->len = 0;
+			_buf_putmsg(t, r);
+		}
+		args = t->data ? t->data : "";
+		len = t->len;
+	}
+	/* a formatted message is the argument of "%s", or of "\n%s" */
+	const char *const fmt = spec ? r->fmt : _strfmt + (*r->fmt != '\n');
+
+	/* the identity of the thread is kept as more fields */
+	LogField ids[3];
+	size_t nids = 0;
+	if(_showsthread(r, s->attrs)) {
+		ids[nids++] = CLOG_UINT("tid", r->id->tid);
+		if(r->id->namelen)
+			ids[nids++] = CLOG_STR("thread", r->id->name);
+	}
+	if(_showscpu(r, s->attrs))
+		ids[nids++] = CLOG_INT("cpu", r->id->cpu);
+
+	const unsigned int file = _binary_define(b, s, r->file);
+	const unsigned int func = _binary_define(b, s, r->func);
+	const unsigned int f = _binary_define(b, s, fmt);
+	for(size_t i = 0; i < r->nfields; ++i)
+		_binary_define(b, s, _fieldkey(r, i));
+	for(size_t i = 0; i < nids; ++i)
+		_binary_define(b, s, ids[i].key);
+	_buf_putc(b, BINARY_RECORD);
+	_buf_putle(b, (unsigned long long) r->time.tv_sec * 1000000000
+	              + (unsigned long long) r->time.tv_nsec, 8);
+	_buf_putc(b, (char) r->lvl);
+	_buf_putle(b, r->line, 4);
+	_buf_putstrid(b, file, r->file);
+	_buf_putstrid(b, func, r->func);
+	_buf_putstrid(b, f, fmt);
+	if(spec) {
+		const size_t n = _clog_encodeargs(NULL, 0, spec, args);
+		_buf_putvarint(b, n);
+		if(_buf_reserve(b, n)) {
+			_clog_encodeargs(b->data + b->len, n, spec, args);
+			b->len += n;
+		}
+	} else {
+		char v[VARINT_MAX];
+		const size_t n = _clog_putvarint(v, len);
+		_buf_putvarint(b, n + len);
+		_buf_append(b, v, n);
+		_buf_append(b, args, len);
+	}
+	_buf_putvarint(b, r->nfields + nids);
+	for(size_t i = 0; i < r->nfields; ++i)
+		_buf_putfield(b, s, &r->fields[i], _fieldkey(r, i));
+	for(size_t i = 0; i < nids; ++i)
+		_buf_putfield(b, s, &ids[i], ids[i].key);
 }
 
 
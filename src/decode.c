@@ -0,0 +1,586 @@
+#define _POSIX_C_SOURCE 200809L /* for getopt */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#include "args.h"
+#include "binary.h"
+#include "clog.h"
+
+/*
+ * Decodes binary logs (CLOG_FORMAT_BINARY) to another format:
+ *   -f format  TEXT (by default), XML, CSV, JSON, NDJSON, SYSLOG or
+ *              JOURNALD
+ *   -a attrs   the output attributes, separated by commas: MINIMAL, TIME,
+ *              TIME_US, TIME_NS, UPTIME, FILE, FUNC, THREAD, CPU, COLORED or
+ *              VERBOSE (see _attrnames); those the log was written with by
+ *              default
+ *   -m         merges the records of the logs by time, as the shards of a
+ *              sharded log (see clog_init_sharded); the logs are decoded one
+ *              after the other otherwise
+ * The logs are read from the files given, or from the standard input ("-"),
+ * and decoded to the standard output.
+ */
+
+static const char *const _formatnames[] = {
+	[CLOG_FORMAT_TEXT] = "TEXT",
+	[CLOG_FORMAT_XML] = "XML",
+	[CLOG_FORMAT_CSV] = "CSV",
+	[CLOG_FORMAT_JSON] = "JSON",
+	[CLOG_FORMAT_NDJSON] = "NDJSON",
+	[CLOG_FORMAT_SYSLOG] = "SYSLOG",
+	[CLOG_FORMAT_JOURNALD] = "JOURNALD"
+};
+#define NFORMATS (sizeof _formatnames / sizeof *_formatnames)
+
+struct attrname {
+	const char *name;
+	OutputAttribute attrs;
+	char pad[4];
+};
+static const struct attrname _attrnames[] = {
+	{"MINIMAL", CLOG_ATTR_MINIMAL, ""},
+	{"TIME", CLOG_ATTR_TIME, ""},
+	{"TIME_US", CLOG_ATTR_TIME_US, ""},
+	{"TIME_NS", CLOG_ATTR_TIME_NS, ""},
+	{"UPTIME", CLOG_ATTR_UPTIME, ""},
+	{"FILE", CLOG_ATTR_FILE, ""},
+	{"FUNC", CLOG_ATTR_FUNC, ""},
+	{"THREAD", CLOG_ATTR_THREAD, ""},
+	{"CPU", CLOG_ATTR_CPU, ""},
+	{"COLORED", CLOG_ATTR_COLORED, ""},
+	{"VERBOSE", CLOG_ATTR_VERBOSE, ""}
+};
+#define NATTRNAMES (sizeof _attrnames / sizeof *_attrnames)
+
+/* The contents of a log, and its string table */
+struct log {
+	const char *name;
+	const char *data;
+	const char *end;
+	const char *next; /* the next record to decode, past its tag */
+	char **strings;
+	size_t nstrings;
+	unsigned long long origin;
+	size_t failed; /* the records that could not be decoded */
+	OutputAttribute attrs;
+	unsigned char version;
+	char pad[3];
+};
+#define MAX_STRINGS (1 << 24) /* the identifiers are sparse up to there */
+
+/* A buffer grown as needed */
+struct buffer {
+	char *data;
+	size_t size;
+};
+
+
+static bool _reserve(struct buffer *const b, const size_t n) {
+	if(n <= b->size)
+		return true;
+	char *const data = realloc(b->data, n);
+	if(data == NULL)
+		return false;
+	b->data = data;
+	b->size = n;
+	return true;
+}
+
+static char *_readall(FILE *const f, size_t *const len) {
+	struct buffer b = {NULL, 0};
+	*len = 0;
+	for(;;) {
+		if(!_reserve(&b, b.size ? 2 * b.size : 65536)) {
+			free(b.data);
+			return NULL;
+		}
+		*len += fread(b.data + *len, 1, b.size - *len, f);
+		if(*len < b.size)
+			break;
+	}
+	if(ferror(f)) {
+		free(b.data);
+		return NULL;
+	}
+	return b.data;
+}
+
+
+/* Reads a string reference: its identifier, or the string itself */
+static const char *_getstring(const char *in, const char *const end,
+                              unsigned long long *const id,
+                              const char **const str, size_t *const len) {
+	if((in = _clog_getvarint(in, end, id)) == NULL)
+		return NULL;
+	if(*id != 0)
+		return in;
+	unsigned long long n;
+	if((in = _clog_getvarint(in, end, &n)) == NULL
+	   || (unsigned long long) (end - in) < n)
+		return NULL;
+	*str = in;
+	*len = (size_t) n;
+	return in + n;
+}
+
+static bool _define(struct log *const l, const unsigned long long id,
+                    const char *const str, const size_t len) {
+	if(id == 0 || id >= MAX_STRINGS || memchr(str, '\0', len))
+		return false;
+	if(id >= l->nstrings) {
+		size_t n = l->nstrings ? l->nstrings : 64;
+		while(n <= id)
+			n *= 2;
+		char **const strings = realloc(l->strings, n * sizeof *strings);
+		if(strings == NULL)
+			return false;
+		memset(strings + l->nstrings, 0, (n - l->nstrings) * sizeof *strings);
+		l->strings = strings;
+		l->nstrings = n;
+	}
+	if(l->strings[id] == NULL) {
+		if((l->strings[id] = malloc(len + 1)) == NULL)
+			return false;
+		memcpy(l->strings[id], str, len);
+		l->strings[id][len] = '\0';
+	}
+	return true;
+}
+
+/* Skips the fields of a record; returns the position past them, or NULL if
+   they are malformed */
+static const char *_skipfields(const char *in, const char *const end) {
+	unsigned long long n;
+	if((in = _clog_getvarint(in, end, &n)) == NULL)
+		return NULL;
+	for(unsigned long long i = 0; i < n && in; ++i) {
+		unsigned long long id;
+		const char *str;
+		size_t len;
+		LogField f;
+		if((in = _getstring(in, end, &id, &str, &len)) != NULL)
+			in = _clog_decodevalue(in, end, &f, &len);
+	}
+	return in;
+}
+
+/* Reads the fields of a record, whose keys and strings are copied to a buffer
+   once its size is known; returns the position past them, or NULL if they
+   cannot be read */
+static const char *_getfields(const struct log *const l, const char *const at,
+                              const char *const end, struct buffer *const fb,
+                              struct buffer *const sb, size_t *const n) {
+	const char *in = NULL;
+	for(int pass = 0; pass < 2; ++pass) {
+		unsigned long long count;
+		/* a field takes two bytes at least */
+		if((in = _clog_getvarint(at, end, &count)) == NULL
+		   || count > (unsigned long long) (end - in) / 2
+		   || (pass == 0 && !_reserve(fb, (size_t) count * sizeof(LogField))))
+			return NULL;
+		LogField *const fields = (LogField*) (void*) fb->data;
+		size_t size = 0;
+		for(size_t i = 0; i < count; ++i) {
+			LogField *const f = &fields[i];
+			unsigned long long id;
+			const char *str = NULL;
+			size_t len = 0;
+			if((in = _getstring(in, end, &id, &str, &len)) == NULL)
+				return NULL;
+			if(id != 0) {
+				if(id >= l->nstrings || l->strings[id] == NULL)
+					return NULL;
+				f->key = l->strings[id];
+			} else {
+				if(pass) {
+					memcpy(sb->data + size, str, len);
+					sb->data[size + len] = '\0';
+					f->key = sb->data + size;
+				}
+				size += len + 1;
+			}
+			if((in = _clog_decodevalue(in, end, f, &len)) == NULL)
+				return NULL;
+			if(f->type == CLOG_FIELD_STR) {
+				if(pass) {
+					memcpy(sb->data + size, f->value.s, len);
+					sb->data[size + len] = '\0';
+					f->value.s = sb->data + size;
+				}
+				size += len + 1;
+			}
+		}
+		if(pass == 0 && !_reserve(sb, size))
+			return NULL;
+		*n = (size_t) count;
+	}
+	return in;
+}
+
+/* Reads the header and the string table of a log: the strings may be defined
+   after their first use */
+static bool _load(struct log *const l) {
+	if(l->end - l->data < BINARY_HEADERSIZE
+	   || memcmp(l->data, BINARY_MAGIC, 4) != 0
+	   || l->data[4] < 1 || l->data[4] > BINARY_VERSION
+	   || l->data[5] != (char) sizeof(long double))
+		return false;
+	l->version = (unsigned char) l->data[4];
+	l->attrs = (OutputAttribute) _clog_getle(l->data + 8, 4);
+	l->origin = _clog_getle(l->data + 12, 8);
+
+	const char *in = l->data + BINARY_HEADERSIZE;
+	while(in && in < l->end) {
+		unsigned long long id, n;
+		const char *str;
+		size_t len;
+		switch(*in++) {
+			case BINARY_STRING:
+				if((in = _clog_getvarint(in, l->end, &id)) == NULL
+				   || (in = _clog_getvarint(in, l->end, &n)) == NULL
+				   || (unsigned long long) (l->end - in) < n
+				   || !_define(l, id, in, (size_t) n))
+					return false;
+				in += n;
+				break;
+			case BINARY_RECORD:
+				if(l->end - in < 13)
+					return false;
+				in += 13;
+				for(int i = 0; i < 3 && in; ++i)
+					in = _getstring(in, l->end, &id, &str, &len);
+				if(in == NULL || (in = _clog_getvarint(in, l->end, &n)) == NULL
+				   || (unsigned long long) (l->end - in) < n)
+					return false;
+				in += n;
+				if(l->version > 1)
+					in = _skipfields(in, l->end);
+				break;
+			default:
+				return false;
+		}
+	}
+	return in != NULL;
+}
+
+/* Resolves a string reference; an inline string is copied to the buffer */
+static const char *_resolve(const struct log *const l,
+                            const unsigned long long id, const char *const str,
+                            const size_t len, struct buffer *const b) {
+	if(id != 0)
+		return id < l->nstrings ? l->strings[id] : NULL;
+	if(!_reserve(b, len + 1))
+		return NULL;
+	memcpy(b->data, str, len);
+	b->data[len] = '\0';
+	return b->data;
+}
+
+/* Expands the message of a record, from its packed arguments: they are
+   packed back in bufs[3], and the message written in bufs[4] */
+static bool _expandmsg(const struct argspec *const spec, const char *const fmt,
+                       const char *const args, const char *const argsend,
+                       struct buffer bufs[static 7]) {
+	size_t size = _clog_decodeargs(bufs[3].data, bufs[3].size, spec, args,
+	                               argsend);
+	if(size == ARGS_UNSUPPORTED)
+		return false;
+	if(size > bufs[3].size) {
+		if(!_reserve(&bufs[3], size))
+			return false;
+		_clog_decodeargs(bufs[3].data, bufs[3].size, spec, args, argsend);
+	}
+	int len = _clog_expand(bufs[4].data, bufs[4].size, fmt, bufs[3].data);
+	if(len < 0)
+		return false;
+	if((size_t) len >= bufs[4].size) {
+		if(!_reserve(&bufs[4], (size_t) len + 1))
+			return false;
+		_clog_expand(bufs[4].data, bufs[4].size, fmt, bufs[3].data);
+	}
+	return true;
+}
+
+/* Takes the identity of the thread off the last fields of a record, where
+   the log keeps it if it shows the thread or the processor */
+static bool _getidentity(const struct log *const l,
+                         const LogField *const fields, size_t *const n,
+                         struct replayid *const id) {
+	*id = (struct replayid) {NULL, 0, -1};
+	size_t i = *n;
+#define LASTIS(k, t) (i && fields[i - 1].type == (t) \
+                      && strcmp(fields[i - 1].key, (k)) == 0)
+	if((l->attrs & CLOG_ATTR_CPU) && LASTIS("cpu", CLOG_FIELD_INT))
+		id->cpu = (int) fields[--i].value.i;
+	if(l->attrs & CLOG_ATTR_THREAD) {
+		const size_t named = LASTIS("thread", CLOG_FIELD_STR);
+		i -= named;
+		if(LASTIS("tid", CLOG_FIELD_UINT)) {
+			id->tid = (unsigned int) fields[--i].value.u;
+			id->name = named ? fields[i + 1].value.s : NULL;
+		} else {
+			i += named; /* a field of the message */
+		}
+	}
+#undef LASTIS
+	const bool found = i < *n;
+	*n = i;
+	return found;
+}
+
+/* Decodes then logs the record at in, which was checked by _load; returns
+   the position past it, and whether it could be decoded */
+static const char *_decode(const struct log *const l, const char *in,
+                           struct buffer bufs[static 7], bool *const ok) {
+	const char *const end = l->end;
+	const unsigned long long ns = _clog_getle(in, 8);
+	const LogLevel lvl = (LogLevel) (unsigned char) in[8];
+	const unsigned int line = (unsigned int) _clog_getle(in + 9, 4);
+	in += 13;
+	const char *strs[3];
+	unsigned long long id = 0;
+	*ok = lvl <= CLOG_FATAL;
+	for(int i = 0; i < 3; ++i) {
+		const char *str = NULL;
+		size_t len = 0;
+		in = _getstring(in, end, &id, &str, &len);
+		strs[i] = _resolve(l, id, str, len, &bufs[i]);
+		*ok = *ok && strs[i];
+	}
+	unsigned long long n;
+	in = _clog_getvarint(in, end, &n);
+	const char *const args = in;
+	const char *const argsend = in += n;
+	size_t nfields = 0;
+	if(l->version > 1) {
+		const char *const past = _getfields(l, in, end, &bufs[5], &bufs[6],
+		                                    &nfields);
+		*ok = *ok && past;
+		in = past ? past : _skipfields(in, end);
+	}
+	if(!*ok)
+		return in;
+	*ok = false;
+
+	/* the arguments, packed back, then the message; an inline format is
+	   copied to the buffer of the former one, so its address does not
+	   identify it (id is that of the format), and the cache may be full */
+	const char *const fmt = strs[2];
+	struct argspec *own = NULL;
+	const struct argspec *spec = id ? _clog_argspec(fmt) : NULL;
+	if(spec == NULL)
+		spec = own = _clog_parseargspec(fmt);
+	const bool newline = *fmt == '\n';
+	const bool expanded = spec && spec->nargs != ARGS_UNSUPPORTED
+	                      && _expandmsg(spec, fmt + newline, args, argsend,
+	                                    bufs);
+	free(own);
+	if(!expanded)
+		return in;
+
+	const struct timespec time = {
+		.tv_sec = (time_t) (ns / 1000000000),
+		.tv_nsec = (long) (ns % 1000000000)
+	};
+	const unsigned long long up = ns > l->origin ? ns - l->origin : 0;
+	const struct timespec uptime = {
+		.tv_sec = (time_t) (up / 1000000000),
+		.tv_nsec = (long) (up % 1000000000)
+	};
+	const LogField *const fields = (const LogField*) (void*) bufs[5].data;
+	struct replayid ident;
+	const bool identified = _getidentity(l, fields, &nfields, &ident);
+	_clog_replay(&time, &uptime, identified ? &ident : NULL, strs[0], line,
+	             strs[1], lvl, bufs[4].data ? bufs[4].data : "", newline,
+	             fields, nfields);
+	*ok = true;
+	return in;
+}
+
+/* Skips the strings from a position of a log; returns the next record, past
+   its tag, or NULL at the end of the log */
+static const char *_nextrecord(const struct log *const l, const char *in) {
+	unsigned long long n;
+	while(in < l->end) {
+		if(*in++ == BINARY_RECORD)
+			return in;
+		/* a string, loaded already */
+		in = _clog_getvarint(in, l->end, &n);
+		in = _clog_getvarint(in, l->end, &n);
+		in += n;
+	}
+	return NULL;
+}
+
+#define NBUFS 7 /* the inline file, func and format strings, the packed
+                   arguments, the message, the fields and their strings */
+
+/* Decodes all the records of the logs one after the other, or merged by time;
+   returns the count of those that could not be decoded */
+static size_t _decodeall(struct log *const logs, const size_t n,
+                         const bool merge) {
+	struct buffer bufs[NBUFS] = {{NULL, 0}};
+	size_t failed = 0;
+	for(size_t i = 0; i < n; ++i)
+		logs[i].next = _nextrecord(&logs[i], logs[i].data + BINARY_HEADERSIZE);
+	for(size_t i = 0; i < n;) {
+		struct log *l = &logs[i];
+		if(merge) {
+			/* the log whose next record is the earliest; the shards are few */
+			for(size_t k = i + 1; k < n; ++k) {
+				if(logs[k].next && (l->next == NULL
+				                    || _clog_getle(logs[k].next, 8)
+				                       < _clog_getle(l->next, 8)))
+					l = &logs[k];
+			}
+		}
+		if(l->next == NULL) {
+			/* all the logs are done if they are merged */
+			i = merge ? n : i + 1;
+			continue;
+		}
+		bool ok;
+		l->next = _nextrecord(l, _decode(l, l->next, bufs, &ok));
+		l->failed += !ok;
+		failed += !ok;
+	}
+	for(int i = 0; i < NBUFS; ++i)
+		free(bufs[i].data);
+	return failed;
+}
+
+/* Reads and loads a log; it is reported if it cannot be */
+static bool _openlog(struct log *const l, const char *const name) {
+	*l = (struct log) {
+		.name = name,
+		.data = NULL,
+		.end = NULL,
+		.next = NULL,
+		.strings = NULL,
+		.nstrings = 0,
+		.origin = 0,
+		.failed = 0,
+		.attrs = CLOG_ATTR_MINIMAL
+	};
+	const bool file = strcmp(name, "-") != 0;
+	FILE *const f = file ? fopen(name, "rb") : stdin;
+	if(f == NULL) {
+		fprintf(stderr, "clog-decode: %s: cannot be opened\n", name);
+		return false;
+	}
+	size_t len;
+	char *const data = _readall(f, &len);
+	if(file)
+		fclose(f);
+	if(data == NULL) {
+		fprintf(stderr, "clog-decode: %s: cannot be read\n", name);
+		return false;
+	}
+	l->data = data;
+	l->end = data + len;
+	if(!_load(l)) {
+		fprintf(stderr, "clog-decode: %s: malformed binary log\n", name);
+		return false;
+	}
+	return true;
+}
+
+static void _closelog(struct log *const l) {
+	for(size_t i = 0; i < l->nstrings; ++i)
+		free(l->strings[i]);
+	free(l->strings);
+	free((char*) l->data);
+}
+
+
+static int _findattrs(char *const names, OutputAttribute *const attrs) {
+	*attrs = CLOG_ATTR_MINIMAL;
+	for(char *name = strtok(names, ","); name; name = strtok(NULL, ",")) {
+		size_t i = 0;
+		while(i < NATTRNAMES && strcmp(name, _attrnames[i].name) != 0)
+			++i;
+		if(i == NATTRNAMES)
+			return -1;
+		*attrs |= _attrnames[i].attrs;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	OutputFormat fmt = CLOG_FORMAT_TEXT;
+	OutputAttribute attrs = CLOG_ATTR_MINIMAL;
+	bool given = false, merge = false;
+	int opt;
+	while((opt = getopt(argc, argv, "f:a:m")) != -1) {
+		int i = 0;
+		switch(opt) {
+			case 'f':
+				/* there is no name for the binary format */
+				while(i < (int) NFORMATS && (_formatnames[i] == NULL
+				                             || strcmp(optarg,
+				                                       _formatnames[i]) != 0))
+					++i;
+				fmt = (OutputFormat) i;
+				i = i < (int) NFORMATS ? 0 : -1;
+				break;
+			case 'a':
+				i = _findattrs(optarg, &attrs);
+				given = true;
+				break;
+			case 'm':
+				merge = true;
+				break;
+			default:
+				i = -1;
+				break;
+		}
+		if(i < 0) {
+			fprintf(stderr, "usage: %s [-m] [-f format] [-a attr,...] "
+			        "[file...]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	/* all the logs are loaded first, to be merged */
+	const size_t nfiles = optind < argc ? (size_t) (argc - optind) : 1;
+	struct log *const logs = malloc(nfiles * sizeof *logs);
+	if(logs == NULL) {
+		fputs("clog-decode: out of memory\n", stderr);
+		return EXIT_FAILURE;
+	}
+	bool ok = true;
+	size_t n = 0;
+	for(size_t i = 0; i < nfiles; ++i) {
+		const char *const name = optind < argc ? argv[optind + (int) i] : "-";
+		if(_openlog(&logs[n], name)) {
+			++n;
+		} else {
+			_closelog(&logs[n]);
+			ok = false;
+		}
+	}
+
+	/* the records were filtered when written */
+	clog_setfilterlevel(CLOG_TRACE);
+	if(n) {
+		/* the output attributes are by default those of the first log */
+		ok = clog_addsink_stream(stdout, fmt, given ? attrs : logs[0].attrs,
+		                         CLOG_TRACE) >= 0 && ok;
+		ok = _decodeall(logs, n, merge) == 0 && ok;
+	}
+	for(size_t i = 0; i < n; ++i) {
+		if(logs[i].failed)
+			fprintf(stderr, "clog-decode: %s: %zu records could not be "
+			        "decoded\n", logs[i].name, logs[i].failed);
+		_closelog(&logs[i]);
+	}
+	free(logs);
+	/* writes the footer of the format */
+	clog_term();
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
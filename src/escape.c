@@ -0,0 +1,183 @@
+#include "escape.h"
+
+#include <stdbool.h> /* for bool */
+#include <string.h> /* for memcpy */
+#if defined(__GNUC__) && defined(__AVX2__)
+# include <immintrin.h> /* for _mm256_* */
+#elif defined(__GNUC__) && defined(__SSE2__)
+# include <emmintrin.h> /* for _mm_* */
+#elif defined(__GNUC__) && defined(__ARM_NEON)
+# include <arm_neon.h> /* for v* */
+#endif
+
+#include <PUCA/funcattrs.h> /* for INLINE */
+
+
+
+static INLINE bool _jsonspecial(const char c) {
+	return (unsigned char) c < 0x20 || c == '"' || c == '\\';
+}
+
+static INLINE bool _xmlspecial(const char c) {
+	return c == '<' || c == '>' || c == '&' || c == '"';
+}
+
+
+/* The mask of a block has SCAN_BITS bits set for each character to escape, in
+   the order of the bytes */
+#if defined(__GNUC__) && defined(__AVX2__)
+# define SCAN_BLOCK 32
+# define SCAN_BITS 1
+typedef unsigned int scanmask;
+# define SCAN_CTZ(m) __builtin_ctz(m)
+
+static INLINE __m256i _eq(const __m256i v, const char c) {
+	return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c));
+}
+
+static INLINE scanmask _scanmask(const char *const p, const bool json) {
+	const __m256i v = _mm256_loadu_si256((const __m256i*) p);
+	__m256i m = _eq(v, '"');
+	if(json) {
+		/* the control characters are those left unchanged by min(c, 0x1F) */
+		m = _mm256_or_si256(m, _eq(v, '\\'));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(
+		        _mm256_min_epu8(v, _mm256_set1_epi8(0x1F)), v));
+	} else {
+		m = _mm256_or_si256(m, _eq(v, '<'));
+		m = _mm256_or_si256(m, _eq(v, '>'));
+		m = _mm256_or_si256(m, _eq(v, '&'));
+	}
+	return (scanmask) _mm256_movemask_epi8(m);
+}
+#elif defined(__GNUC__) && defined(__SSE2__)
+# define SCAN_BLOCK 16
+# define SCAN_BITS 1
+typedef unsigned int scanmask;
+# define SCAN_CTZ(m) __builtin_ctz(m)
+
+static INLINE __m128i _eq(const __m128i v, const char c) {
+	return _mm_cmpeq_epi8(v, _mm_set1_epi8(c));
+}
+
+static INLINE scanmask _scanmask(const char *const p, const bool json) {
+	const __m128i v = _mm_loadu_si128((const __m128i*) p);
+	__m128i m = _eq(v, '"');
+	if(json) {
+		/* the control characters are those left unchanged by min(c, 0x1F) */
+		m = _mm_or_si128(m, _eq(v, '\\'));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x1F)),
+		                                   v));
+	} else {
+		m = _mm_or_si128(m, _eq(v, '<'));
+		m = _mm_or_si128(m, _eq(v, '>'));
+		m = _mm_or_si128(m, _eq(v, '&'));
+	}
+	return (scanmask) _mm_movemask_epi8(m);
+}
+#elif defined(__GNUC__) && defined(__ARM_NEON)
+# define SCAN_BLOCK 16
+# define SCAN_BITS 4
+typedef unsigned long long scanmask;
+# define SCAN_CTZ(m) __builtin_ctzll(m)
+
+static INLINE scanmask _scanmask(const char *const p, const bool json) {
+	const uint8x16_t v = vld1q_u8((const uint8_t*) p);
+	uint8x16_t m = vceqq_u8(v, vdupq_n_u8('"'));
+	if(json) {
+		m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('\\')));
+		m = vorrq_u8(m, vcltq_u8(v, vdupq_n_u8(0x20)));
+	} else {
+		m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('<')));
+		m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('>')));
+		m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('&')));
+	}
+	/* narrow each byte of the mask to 4 bits, there is no movemask */
+	const uint8x8_t n = vshrn_n_u16(vreinterpretq_u16_u8(m), 4);
+	return vget_lane_u64(vreinterpret_u64_u8(n), 0);
+}
+#endif
+
+static INLINE size_t _span(const char *const s, const size_t n,
+                           const bool json) {
+	size_t i = 0;
+#ifdef SCAN_BLOCK
+	if(n >= SCAN_BLOCK) {
+		for(; i + SCAN_BLOCK <= n; i += SCAN_BLOCK) {
+			const scanmask m = _scanmask(s + i, json);
+			if(m)
+				return i + (size_t) SCAN_CTZ(m) / SCAN_BITS;
+		}
+		if(i == n)
+			return n;
+		/* the last block overlaps the previous one, which had no match */
+		i = n - SCAN_BLOCK;
+		const scanmask m = _scanmask(s + i, json);
+		return m ? i + (size_t) SCAN_CTZ(m) / SCAN_BITS : n;
+	}
+#endif
+	while(i < n && !(json ? _jsonspecial(s[i]) : _xmlspecial(s[i])))
+		++i;
+	return i;
+}
+
+size_t _clog_jsonspan(const char *const s, const size_t n) {
+	return _span(s, n, true);
+}
+
+size_t _clog_xmlspan(const char *const s, const size_t n) {
+	return _span(s, n, false);
+}
+
+
+static const char _hexdigits[] = "0123456789abcdef";
+
+size_t _clog_jsonescape(char *const dst, const char c) {
+	char e;
+	switch(c) {
+		case '"':
+		case '\\':
+			e = c;
+			break;
+		case '\b':
+			e = 'b';
+			break;
+		case '\f':
+			e = 'f';
+			break;
+		case '\n':
+			e = 'n';
+			break;
+		case '\r':
+			e = 'r';
+			break;
+		case '\t':
+			e = 't';
+			break;
+		default:
+			memcpy(dst, "\\u00", 4);
+			dst[4] = _hexdigits[(unsigned char) c >> 4];
+			dst[5] = _hexdigits[(unsigned char) c & 0xF];
+			return 6;
+	}
+	dst[0] = '\\';
+	dst[1] = e;
+	return 2;
+}
+
+size_t _clog_xmlescape(char *const dst, const char c) {
+	switch(c) {
+		case '<':
+			memcpy(dst, "&lt;", 4);
+			return 4;
+		case '>':
+			memcpy(dst, "&gt;", 4);
+			return 4;
+		case '&':
+			memcpy(dst, "&amp;", 5);
+			return 5;
+		default: /* '"' */
+			memcpy(dst, "&quot;", 6);
+			return 6;
+	}
+}
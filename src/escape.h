@@ -0,0 +1,77 @@
+/**
+ * \file escape.h
+ * \author joH1
+ * \version 0.1
+ *
+ * Internal functions to escape the messages in the JSON strings and the XML
+ * text of the output.
+ *
+ * The characters to escape are searched for by blocks of 16 or 32 bytes with
+ * the vector instructions of the target (AVX2, SSE2 or NEON), or one at a
+ * time if there are none.
+ */
+
+#ifndef CLOG_ESCAPE_H
+#define CLOG_ESCAPE_H
+
+#include <stddef.h> /* for size_t */
+
+#include <PUCA/funcattrs.h> /* for NOTNULL, PURE */
+
+
+
+/**
+ * \brief The maximal length of the escape sequence of a character.
+ */
+#define ESCAPE_MAX 6
+
+
+/**
+ * \brief Measures the leading run of characters that are written as is in a
+ *        JSON string.
+ *
+ * \param[in] s The characters
+ * \param[in] n Their count
+ *
+ * \return The index of the first character to escape, or \a n if there is
+ *         none.
+ */
+size_t _clog_jsonspan(const char *s, size_t n) NOTNULL(1) PURE;
+
+/**
+ * \brief Measures the leading run of characters that are written as is in XML
+ *        text or attribute values.
+ *
+ * \param[in] s The characters
+ * \param[in] n Their count
+ *
+ * \return The index of the first character to escape, or \a n if there is
+ *         none.
+ */
+size_t _clog_xmlspan(const char *s, size_t n) NOTNULL(1) PURE;
+
+/**
+ * \brief Writes the escape sequence of a character in a JSON string.
+ *
+ * \param[out] dst The destination, of at least \c ESCAPE_MAX characters
+ * \param[in]  c   A character for which \c _clog_jsonspan stops
+ *
+ * \return The length of the sequence written.
+ */
+size_t _clog_jsonescape(char *dst, char c) NOTNULL(1);
+
+/**
+ * \brief Writes the entity reference of a character in XML.
+ *
+ * \param[out] dst The destination, of at least \c ESCAPE_MAX characters
+ * \param[in]  c   A character for which \c _clog_xmlspan stops
+ *
+ * \return The length of the reference written.
+ */
+size_t _clog_xmlescape(char *dst, char c) NOTNULL(1);
+
+
+#include <PUCA/end.h>
+
+
+#endif /* CLOG_ESCAPE_H */
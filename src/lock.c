@@ -0,0 +1,58 @@
+#define _DEFAULT_SOURCE /* for syscall */
+
+#include "lock.h"
+
+#ifdef __linux__
+# include <linux/futex.h> /* for FUTEX_* */
+# include <sys/syscall.h> /* for SYS_futex */
+# include <unistd.h> /* for syscall */
+#else
+# include <sched.h> /* for sched_yield */
+#endif
+
+
+
+#define LOCK_SPINS 100 /* the attempts to take the lock before sleeping */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__GNUC__) && defined(__aarch64__)
+# define CPU_RELAX() __asm__ __volatile__("yield")
+#else
+# define CPU_RELAX() ((void) 0)
+#endif
+
+
+void _clog_lockwait(atomic_uint *const lock) {
+	/* a record is written shortly, the holder may give the lock back soon */
+	for(int i = 0; i < LOCK_SPINS; ++i) {
+		unsigned int s = atomic_load_explicit(lock, memory_order_relaxed);
+		if(s == LOCK_FREE
+		   && atomic_compare_exchange_weak_explicit(lock, &s, LOCK_HELD,
+		                                            memory_order_acquire,
+		                                            memory_order_relaxed))
+			return;
+		if(s == LOCK_CONTENDED)
+			break; /* others sleep already */
+		CPU_RELAX();
+	}
+	/* the lock is marked as contended, for its holder to wake a waiter up;
+	   it is taken as such, as there may be other waiters */
+	while(atomic_exchange_explicit(lock, LOCK_CONTENDED, memory_order_acquire)
+	      != LOCK_FREE) {
+#ifdef __linux__
+		syscall(SYS_futex, lock, FUTEX_WAIT_PRIVATE, LOCK_CONTENDED, NULL,
+		        NULL, 0);
+#else
+		sched_yield();
+#endif
+	}
+}
+
+void _clog_lockwake(atomic_uint *const lock) {
+#ifdef __linux__
+	syscall(SYS_futex, lock, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+	(void) lock; /* the waiters yield until the lock is free */
+#endif
+}
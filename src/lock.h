@@ -0,0 +1,70 @@
+/**
+ * \file lock.h
+ * \author joH1
+ * \version 0.1
+ *
+ * The built-in thread lock of the log system: an adaptive lock, that spins a
+ * short while before waiting in the kernel.
+ *
+ * The lock is a word with three states: free, held, or held with waiters. It
+ * is taken and given back with a single atomic operation when uncontended; the
+ * waiters sleep on a futex on Linux, and yield the processor elsewhere.
+ */
+
+#ifndef CLOG_LOCK_H
+#define CLOG_LOCK_H
+
+#include <stdatomic.h> /* for atomic_* */
+
+#include <PUCA/funcattrs.h> /* for INLINE, NOTNULL */
+
+
+
+#define LOCK_FREE 0u
+#define LOCK_HELD 1u
+#define LOCK_CONTENDED 2u /* held, and other threads may be waiting */
+
+
+/**
+ * \brief Waits for a held lock, then takes it.
+ *
+ * \param[in,out] lock The lock
+ */
+void _clog_lockwait(atomic_uint *lock) NOTNULL(1);
+
+/**
+ * \brief Wakes up one of the threads waiting for a lock just freed.
+ *
+ * \param[in,out] lock The lock
+ */
+void _clog_lockwake(atomic_uint *lock) NOTNULL(1);
+
+/**
+ * \brief Takes a lock.
+ *
+ * \param[in,out] lock The lock
+ */
+static INLINE NOTNULL(1) void _clog_lock(atomic_uint *const lock) {
+	unsigned int free = LOCK_FREE;
+	if(!atomic_compare_exchange_strong_explicit(lock, &free, LOCK_HELD,
+	                                            memory_order_acquire,
+	                                            memory_order_relaxed))
+		_clog_lockwait(lock);
+}
+
+/**
+ * \brief Gives a lock back.
+ *
+ * \param[in,out] lock The lock
+ */
+static INLINE NOTNULL(1) void _clog_unlock(atomic_uint *const lock) {
+	if(atomic_exchange_explicit(lock, LOCK_FREE, memory_order_release)
+	   == LOCK_CONTENDED)
+		_clog_lockwake(lock);
+}
+
+
+#include <PUCA/end.h>
+
+
+#endif /* CLOG_LOCK_H */
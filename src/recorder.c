@@ -0,0 +1,147 @@
+#define _XOPEN_SOURCE 700 /* for sigaction, SA_ONSTACK */
+
+#include "recorder.h"
+
+#include <errno.h> /* for errno, EINTR */
+#include <signal.h> /* for sigaction, raise, SIG* */
+#include <stdatomic.h> /* for atomic_* */
+#include <stdlib.h> /* for calloc, free */
+#include <string.h> /* for memcpy */
+#include <unistd.h> /* for write */
+
+
+
+struct recslot {
+	atomic_size_t seq; /* the index of its record plus one, 0 while written */
+	size_t len;
+	char text[RECORDER_TEXTSIZE];
+};
+static struct recslot *_slots = NULL;
+static size_t _capacity = 0;
+static atomic_size_t _head; /* the index of the next record */
+static int _fd = STDERR_FILENO;
+
+static const int _signals[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT};
+#define NSIGNALS (sizeof _signals / sizeof *_signals)
+static struct sigaction _former[NSIGNALS]; /* the handlers replaced */
+static bool _handling = false;
+
+static const char _begin[] = "--- flight recorder, oldest record first ---\n";
+static const char _end[] = "--- end of the flight recorder ---\n";
+
+
+static void _write(const char *p, size_t n) {
+	while(n) {
+		const ssize_t w = write(_fd, p, n);
+		if(w < 0) {
+			if(errno == EINTR)
+				continue;
+			return;
+		}
+		p += w;
+		n -= (size_t) w;
+	}
+}
+
+static void _onsignal(const int sig, siginfo_t *const info, void *const ctx) {
+	(void) ctx;
+	const int e = errno;
+	_clog_recorder_dump();
+	for(size_t i = 0; i < NSIGNALS; ++i) {
+		if(_signals[i] == sig)
+			sigaction(sig, &_former[i], NULL);
+	}
+	/* a fault happens again on return, but a signal sent must be sent again,
+	   to the former handler */
+	if(info->si_code <= 0)
+		raise(sig);
+	errno = e;
+}
+
+static bool _handle(const bool handle) {
+	if(handle == _handling)
+		return true;
+	if(handle) {
+		struct sigaction sa;
+		sa.sa_sigaction = _onsignal;
+		sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+		sigemptyset(&sa.sa_mask);
+		for(size_t i = 0; i < NSIGNALS; ++i) {
+			if(sigaction(_signals[i], &sa, &_former[i]) != 0) {
+				while(i--)
+					sigaction(_signals[i], &_former[i], NULL);
+				return false;
+			}
+		}
+	} else {
+		for(size_t i = 0; i < NSIGNALS; ++i)
+			sigaction(_signals[i], &_former[i], NULL);
+	}
+	_handling = handle;
+	return true;
+}
+
+
+bool _clog_recorder_setup(const size_t capacity, const int fd,
+                          const bool signals) {
+	struct recslot *slots = NULL;
+	if(capacity && (slots = calloc(capacity, sizeof *slots)) == NULL)
+		return false;
+	/* no record is written out while the ring changes */
+	_handle(false);
+	free(_slots);
+	_slots = slots;
+	_capacity = capacity;
+	atomic_store(&_head, 0);
+	_fd = fd;
+	if(capacity && !_handle(signals)) {
+		_clog_recorder_setup(0, fd, false);
+		return false;
+	}
+	return true;
+}
+
+void _clog_recorder_put(const char *const text, size_t len) {
+	struct recslot *const slots = _slots;
+	if(slots == NULL)
+		return;
+	const size_t i = atomic_fetch_add_explicit(&_head, 1, memory_order_relaxed);
+	struct recslot *const s = &slots[i % _capacity];
+	/* the slot is marked as written before its contents change */
+	atomic_store_explicit(&s->seq, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	if(len > RECORDER_TEXTSIZE) {
+		len = RECORDER_TEXTSIZE;
+		memcpy(s->text, text, len - 1);
+		s->text[len - 1] = '\n';
+	} else {
+		memcpy(s->text, text, len);
+	}
+	s->len = len;
+	atomic_store_explicit(&s->seq, i + 1, memory_order_release);
+}
+
+size_t _clog_recorder_dump(void) {
+	struct recslot *const slots = _slots;
+	if(slots == NULL)
+		return 0;
+	const size_t head = atomic_load_explicit(&_head, memory_order_acquire);
+	size_t n = 0;
+	char text[RECORDER_TEXTSIZE];
+	_write(_begin, sizeof _begin - 1);
+	for(size_t i = head > _capacity ? head - _capacity : 0; i < head; ++i) {
+		struct recslot *const s = &slots[i % _capacity];
+		if(atomic_load_explicit(&s->seq, memory_order_acquire) != i + 1)
+			continue;
+		const size_t len = s->len;
+		memcpy(text, s->text, len);
+		/* the copy is kept only if the record was not written over */
+		atomic_thread_fence(memory_order_acquire);
+		if(atomic_load_explicit(&s->seq, memory_order_relaxed) != i + 1)
+			continue;
+		_write(text, len);
+		++n;
+	}
+	_write(_end, sizeof _end - 1);
+	return n;
+}
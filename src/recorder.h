@@ -0,0 +1,71 @@
+/**
+ * \file recorder.h
+ * \author joH1
+ * \version 0.1
+ *
+ * The flight recorder of the log system: a ring of the last records, rendered
+ * in text format, kept in memory and written out only on demand.
+ *
+ * The ring is made of fixed-size slots, each holding one record (truncated if
+ * it is longer); the writers claim their slot with an atomic increment, and
+ * publish it with its sequence number. The ring is written out with no lock
+ * and no allocation, from a signal handler as well: a slot still being
+ * written, or written over while it is read, is skipped.
+ */
+
+#ifndef CLOG_RECORDER_H
+#define CLOG_RECORDER_H
+
+#include <stdbool.h> /* for bool */
+#include <stddef.h> /* for size_t */
+
+#include <PUCA/funcattrs.h> /* for NOTNULL */
+
+
+
+/**
+ * \brief The size of a slot of the recorder: the longer records are
+ *        truncated.
+ */
+#define RECORDER_TEXTSIZE 256
+
+
+/**
+ * \brief Sets up the recorder, or disables it.
+ *
+ * The records of the former recorder are discarded.
+ *
+ * \note The recorder must not be set up again while other threads log.
+ *
+ * \param[in] capacity The count of records kept (\c 0 to disable the
+ *                     recorder)
+ * \param[in] fd       The file descriptor the records are written out to
+ * \param[in] signals  Whether the records are written out on a crash signal
+ *
+ * \return \c false if the ring could not be allocated, or the signal handlers
+ *         installed.
+ */
+bool _clog_recorder_setup(size_t capacity, int fd, bool signals);
+
+/**
+ * \brief Keeps a record in the recorder, over the oldest one if it is full.
+ *
+ * \param[in] text The record, rendered
+ * \param[in] len  The length of the record
+ */
+void _clog_recorder_put(const char *text, size_t len) NOTNULL(1);
+
+/**
+ * \brief Writes out the records of the recorder, from the oldest one.
+ *
+ * \note This function is async-signal-safe.
+ *
+ * \return The count of records written out.
+ */
+size_t _clog_recorder_dump(void);
+
+
+#include <PUCA/end.h>
+
+
+#endif /* CLOG_RECORDER_H */
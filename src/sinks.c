@@ -0,0 +1,721 @@
+#define _GNU_SOURCE /* for fopencookie, posix_fallocate, ftruncate, strdup */
+
+#include "sinks.h"
+
+#include <errno.h> /* for errno, EINTR, ETIMEDOUT */
+#include <fcntl.h> /* for open, posix_fallocate, O_* */
+#include <pthread.h> /* for pthread_* */
+#include <sched.h> /* for sched_yield */
+#include <stdatomic.h> /* for atomic_* */
+#include <stdlib.h> /* for malloc, calloc, free */
+#include <string.h> /* for memcpy, strdup, strlen */
+#include <sys/mman.h> /* for mmap, munmap */
+#include <sys/uio.h> /* for writev */
+#include <time.h> /* for clock_gettime */
+#include <unistd.h> /* for close, ftruncate, sysconf */
+#ifdef CLOG_HAVE_ZLIB
+# include <zlib.h> /* for gz* */
+#endif
+#ifdef CLOG_HAVE_ZSTD
+# include <zstd.h> /* for ZSTD_* */
+#endif
+
+#include <PUCA/funcattrs.h> /* for NOTNULL */
+
+
+
+static void _file_write(void *const f, const char *const data,
+                        const size_t len) {
+	fwrite(data, 1, len, f);
+}
+
+static void _file_flush(void *const f) {
+	fflush(f);
+}
+
+static void _file_close(void *const f) {
+	fclose(f);
+}
+
+bool _clog_filesink(LogSink *const s, const char *const filename) {
+	FILE *const f = fopen(filename, "w");
+	if(f == NULL)
+		return false;
+	*s = (LogSink) {_file_write, _file_flush, _file_close, f};
+	return true;
+}
+
+void _clog_streamsink(LogSink *const s, FILE *const f) {
+	/* the stream belongs to the caller: only flush it on close */
+	*s = (LogSink) {_file_write, _file_flush, _file_flush, f};
+}
+
+FILE *_clog_sinkfile(const LogSink *const s) {
+	return s->write == _file_write ? s->userdata : NULL;
+}
+
+void _clog_filewritev(FILE *const f, struct iovec *iov, int n) {
+	const int fd = fileno(f);
+	if(fd < 0) {
+		/* a stream with no file, such as a compressed one */
+		for(int i = 0; i < n; ++i)
+			fwrite(iov[i].iov_base, 1, iov[i].iov_len, f);
+		return;
+	}
+	fflush(f);
+	while(n > 0) {
+		const ssize_t w = writev(fd, iov, n);
+		if(w < 0) {
+			if(errno == EINTR)
+				continue;
+			return;
+		}
+		/* skip what was written, on a short write */
+		size_t left = (size_t) w;
+		for(; n > 0 && left >= iov->iov_len; ++iov, --n)
+			left -= iov->iov_len;
+		if(n > 0) {
+			iov->iov_base = (char*) iov->iov_base + left;
+			iov->iov_len -= left;
+		}
+	}
+}
+
+
+/* Compressed file: a stream whose buffer holds a block of records; each block
+   is compressed and flushed to the file when the stream writes it out */
+#define COMPRESS_BLOCK 65536
+#define CHUNK_SIZE 16384 /* for the compression */
+struct zfile {
+	FILE *file;
+#ifdef CLOG_HAVE_ZLIB
+	z_stream gz;
+#endif
+#ifdef CLOG_HAVE_ZSTD
+	ZSTD_CCtx *zstd;
+#endif
+	char out[CHUNK_SIZE];
+	Compression codec;
+	char pad[4];
+	char block[]; /* the buffer of the stream */
+};
+
+/* Compresses data to the file, then flushes the compressed stream, or ends it */
+static bool _z_compress(struct zfile *const z, const char *const data,
+                        const size_t len, const bool end) {
+	switch(z->codec) {
+#ifdef CLOG_HAVE_ZLIB
+		case CLOG_COMPRESS_GZIP: {
+			z->gz.next_in = (Bytef*) data;
+			z->gz.avail_in = (uInt) len;
+			int r;
+			do {
+				z->gz.next_out = (Bytef*) z->out;
+				z->gz.avail_out = sizeof z->out;
+				r = deflate(&z->gz, end ? Z_FINISH : Z_SYNC_FLUSH);
+				const size_t n = sizeof z->out - z->gz.avail_out;
+				if(r == Z_STREAM_ERROR || fwrite(z->out, 1, n, z->file) != n)
+					return false;
+			} while(z->gz.avail_out == 0 || (end && r != Z_STREAM_END));
+			return true;
+		}
+#endif
+#ifdef CLOG_HAVE_ZSTD
+		case CLOG_COMPRESS_ZSTD: {
+			ZSTD_inBuffer input = {data, len, 0};
+			size_t rem;
+			do {
+				ZSTD_outBuffer output = {z->out, sizeof z->out, 0};
+				rem = ZSTD_compressStream2(z->zstd, &output, &input,
+				                           end ? ZSTD_e_end : ZSTD_e_flush);
+				if(ZSTD_isError(rem)
+				   || fwrite(z->out, 1, output.pos, z->file) != output.pos)
+					return false;
+			} while(rem != 0);
+			return true;
+		}
+#endif
+		default:
+			(void) data;
+			(void) len;
+			(void) end;
+			return false;
+	}
+}
+
+static bool _z_begin(struct zfile *const z, const int level) {
+	switch(z->codec) {
+#ifdef CLOG_HAVE_ZLIB
+		case CLOG_COMPRESS_GZIP:
+			memset(&z->gz, 0, sizeof z->gz);
+			/* with a gzip header */
+			return deflateInit2(&z->gz, level == 0 ? Z_DEFAULT_COMPRESSION
+			                            : level < 9 ? level : 9,
+			                    Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY)
+			       == Z_OK;
+#endif
+#ifdef CLOG_HAVE_ZSTD
+		case CLOG_COMPRESS_ZSTD:
+			z->zstd = ZSTD_createCCtx();
+			return z->zstd
+			       && !ZSTD_isError(ZSTD_CCtx_setParameter(
+			               z->zstd, ZSTD_c_compressionLevel, level));
+#endif
+		default:
+			(void) level;
+			return false;
+	}
+}
+
+static void _z_end(struct zfile *const z) {
+	switch(z->codec) {
+#ifdef CLOG_HAVE_ZLIB
+		case CLOG_COMPRESS_GZIP:
+			deflateEnd(&z->gz);
+			break;
+#endif
+#ifdef CLOG_HAVE_ZSTD
+		case CLOG_COMPRESS_ZSTD:
+			ZSTD_freeCCtx(z->zstd);
+			break;
+#endif
+		default: break;
+	}
+}
+
+static ssize_t _z_write(void *const u, const char *const data,
+                        const size_t len) {
+	struct zfile *const z = u;
+	if(!_z_compress(z, data, len, false))
+		return 0;
+	fflush(z->file);
+	return (ssize_t) len;
+}
+
+static int _z_close(void *const u) {
+	struct zfile *const z = u;
+	const bool ok = _z_compress(z, NULL, 0, true);
+	_z_end(z);
+	const bool closed = fclose(z->file) == 0;
+	free(z);
+	return ok && closed ? 0 : EOF;
+}
+
+/* Opens a file compressed as per a policy, as a stream; or a plain file */
+static FILE *_z_open(const char *const path,
+                     const CompressionPolicy *const p) {
+	if(p->compress == CLOG_COMPRESS_NONE)
+		return fopen(path, "w");
+	const size_t block = p->block ? p->block : COMPRESS_BLOCK;
+	struct zfile *const z = malloc(sizeof *z + block);
+	if(z == NULL)
+		return NULL;
+	z->codec = p->compress;
+	FILE *s = NULL;
+	if(_z_begin(z, p->level)) {
+		if((z->file = fopen(path, "w")) != NULL) {
+			s = fopencookie(z, "w", (cookie_io_functions_t) {
+				.write = _z_write, .close = _z_close
+			});
+			if(s == NULL)
+				fclose(z->file);
+		}
+		if(s == NULL)
+			_z_end(z);
+	}
+	if(s == NULL) {
+		free(z);
+		return NULL;
+	}
+	setvbuf(s, z->block, _IOFBF, block);
+	return s;
+}
+
+bool _clog_compressedsink(LogSink *const s, const char *const filename,
+                          const CompressionPolicy *const policy) {
+	FILE *const f = _z_open(filename, policy);
+	if(f == NULL)
+		return false;
+	*s = (LogSink) {_file_write, _file_flush, _file_close, f};
+	return true;
+}
+
+
+/* Rotated file: a background thread opens the next file beforehand, and
+   renames and compresses the former ones; the writer only swaps the streams */
+struct rotfile {
+	RotationPolicy policy;
+	FILE *file; /* the current file, used by the writer only */
+	FILE *next; /* the file prepared by the thread */
+	FILE *retired; /* the former file, for the thread to close */
+	size_t size; /* of the current file */
+	char *path; /* of the current file */
+	char *name; /* the name of the files, without the suffix of the codec */
+	char *header;
+	char *footer;
+	char *from; /* paths for the thread to rename the files */
+	char *to;
+	size_t pathsize; /* of from and to */
+	size_t headerlen;
+	struct timespec since; /* the opening time of the current file */
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t wakeup;
+	atomic_bool due; /* the current file has reached its maximal age */
+	bool fresh; /* no record was written to the current file yet */
+	bool stop;
+	char delim;
+	char pad[4];
+};
+#define ROTATE_RETRY_S 1 /* delay to retry to open the next file */
+#define ROTATE_PATHEXTRA sizeof ".-2147483648.zst" /* the longest index and
+                                                     suffix, or ".next" */
+
+static const char *_rot_suffix(const Compression c) {
+	switch(c) {
+#ifdef CLOG_HAVE_ZLIB
+		case CLOG_COMPRESS_GZIP: return ".gz";
+#endif
+#ifdef CLOG_HAVE_ZSTD
+		case CLOG_COMPRESS_ZSTD: return ".zst";
+#endif
+		default: return ""; /* not built with the compression */
+	}
+}
+
+#ifdef CLOG_HAVE_ZLIB
+static bool _gzip(FILE *const in, const char *const out) {
+	const gzFile gz = gzopen(out, "wb");
+	if(gz == NULL)
+		return false;
+	char chunk[CHUNK_SIZE];
+	bool ok = true;
+	size_t n;
+	while(ok && (n = fread(chunk, 1, sizeof chunk, in)) > 0)
+		ok = gzwrite(gz, chunk, (unsigned int) n) == (int) n;
+	return gzclose(gz) == Z_OK && ok && !ferror(in);
+}
+#endif
+
+#ifdef CLOG_HAVE_ZSTD
+static bool _zstd(FILE *const in, const char *const out) {
+	FILE *const f = fopen(out, "wb");
+	if(f == NULL)
+		return false;
+	ZSTD_CCtx *const cctx = ZSTD_createCCtx();
+	char src[CHUNK_SIZE], dst[CHUNK_SIZE];
+	bool ok = cctx != NULL;
+	for(bool last = false; ok && !last;) {
+		const size_t n = fread(src, 1, sizeof src, in);
+		last = n < sizeof src;
+		ZSTD_inBuffer input = {src, n, 0};
+		bool done;
+		do {
+			ZSTD_outBuffer output = {dst, sizeof dst, 0};
+			const size_t rem = ZSTD_compressStream2(cctx, &output, &input,
+			                                        last ? ZSTD_e_end
+			                                             : ZSTD_e_continue);
+			ok = !ZSTD_isError(rem)
+			     && fwrite(dst, 1, output.pos, f) == output.pos;
+			done = last ? rem == 0 : input.pos == input.size;
+		} while(ok && !done);
+	}
+	ZSTD_freeCCtx(cctx);
+	return fclose(f) == 0 && ok && !ferror(in);
+}
+#endif
+
+/* Compresses the file at path in, and removes it if it succeeds */
+static void _rot_compress(const Compression c, const char *const in,
+                          const char *const out) {
+	FILE *const f = fopen(in, "rb");
+	if(f == NULL)
+		return;
+	bool ok = false;
+	switch(c) {
+#ifdef CLOG_HAVE_ZLIB
+		case CLOG_COMPRESS_GZIP:
+			ok = _gzip(f, out);
+			break;
+#endif
+#ifdef CLOG_HAVE_ZSTD
+		case CLOG_COMPRESS_ZSTD:
+			ok = _zstd(f, out);
+			break;
+#endif
+		default: break;
+	}
+	fclose(f);
+	remove(ok ? in : out);
+}
+
+/* Closes the former file, shifts the names of the rotated files and gives
+   its name to the new one */
+static void _rot_retire(struct rotfile *const r, FILE *const old) {
+	fclose(old);
+	/* the files compressed while written are not once rotated */
+	const bool streamed = r->policy.stream.compress != CLOG_COMPRESS_NONE;
+	const char *const suffix = _rot_suffix(streamed ? r->policy.stream.compress
+	                                                : r->policy.compress);
+	const int keep = r->policy.keep;
+	if(keep > 0) {
+		snprintf(r->from, r->pathsize, "%s.%d%s", r->name, keep, suffix);
+		remove(r->from);
+		for(int i = keep - 1; i > 0; --i) {
+			snprintf(r->from, r->pathsize, "%s.%d%s", r->name, i, suffix);
+			snprintf(r->to, r->pathsize, "%s.%d%s", r->name, i + 1,
+			         suffix);
+			rename(r->from, r->to);
+		}
+		snprintf(r->to, r->pathsize, "%s.1%s", r->name,
+		         streamed ? suffix : "");
+		rename(r->path, r->to);
+	} else {
+		remove(r->path);
+	}
+	snprintf(r->from, r->pathsize, "%s.next", r->name);
+	rename(r->from, r->path);
+	if(keep > 0 && *suffix && !streamed) {
+		snprintf(r->from, r->pathsize, "%s.1%s", r->name, suffix);
+		_rot_compress(r->policy.compress, r->to, r->from);
+	}
+}
+
+static FILE *_rot_open(struct rotfile *const r) {
+	snprintf(r->from, r->pathsize, "%s.next", r->name);
+	FILE *const f = _z_open(r->from, &r->policy.stream);
+	if(f)
+		fwrite(r->header, 1, r->headerlen, f);
+	return f;
+}
+
+static void *_rot_run(void *const u) {
+	struct rotfile *const r = u;
+	pthread_mutex_lock(&r->mutex);
+	for(;;) {
+		if(r->retired) {
+			FILE *const old = r->retired;
+			r->retired = NULL;
+			pthread_mutex_unlock(&r->mutex);
+			_rot_retire(r, old);
+			pthread_mutex_lock(&r->mutex);
+			continue;
+		}
+		if(r->stop)
+			break;
+		struct timespec deadline;
+		if(r->next == NULL) {
+			pthread_mutex_unlock(&r->mutex);
+			FILE *const f = _rot_open(r);
+			pthread_mutex_lock(&r->mutex);
+			r->next = f;
+			if(f == NULL) {
+				clock_gettime(CLOCK_REALTIME, &deadline);
+				deadline.tv_sec += ROTATE_RETRY_S;
+				pthread_cond_timedwait(&r->wakeup, &r->mutex, &deadline);
+			}
+			continue;
+		}
+		if(r->policy.maxage > 0 && !atomic_load(&r->due)) {
+			deadline = r->since;
+			deadline.tv_sec += r->policy.maxage;
+			if(pthread_cond_timedwait(&r->wakeup, &r->mutex, &deadline)
+			   == ETIMEDOUT)
+				atomic_store(&r->due, true);
+		} else {
+			pthread_cond_wait(&r->wakeup, &r->mutex);
+		}
+	}
+	pthread_mutex_unlock(&r->mutex);
+	if(r->next) {
+		/* prepared for nothing */
+		fclose(r->next);
+		snprintf(r->from, r->pathsize, "%s.next", r->name);
+		remove(r->from);
+	}
+	return NULL;
+}
+
+/* Switches to the next file, if the thread has opened it yet */
+static void _rot_swap(struct rotfile *const r) {
+	pthread_mutex_lock(&r->mutex);
+	if(r->next && r->retired == NULL) {
+		fputs(r->footer, r->file);
+		r->retired = r->file;
+		r->file = r->next;
+		r->next = NULL;
+		r->size = r->headerlen;
+		r->fresh = true;
+		clock_gettime(CLOCK_REALTIME, &r->since);
+		atomic_store(&r->due, false);
+		pthread_cond_signal(&r->wakeup);
+	}
+	pthread_mutex_unlock(&r->mutex);
+}
+
+static void _rot_write(void *const u, const char *data, size_t len) {
+	struct rotfile *const r = u;
+	if((r->policy.maxsize && !r->fresh && r->size + len > r->policy.maxsize)
+	   || atomic_load_explicit(&r->due, memory_order_relaxed))
+		_rot_swap(r);
+	if(r->fresh) {
+		/* the first record of a file has no delimiter */
+		if(r->delim && len && *data == r->delim) {
+			++data;
+			--len;
+		}
+		r->fresh = false;
+	}
+	fwrite(data, 1, len, r->file);
+	r->size += len;
+}
+
+static void _rot_flush(void *const u) {
+	fflush(((struct rotfile*) u)->file);
+}
+
+static void _rot_free(struct rotfile *const r) {
+	free(r->path);
+	free(r->name);
+	free(r->header);
+	free(r->footer);
+	free(r->from);
+	free(r->to);
+	free(r);
+}
+
+static void _rot_close(void *const u) {
+	struct rotfile *const r = u;
+	pthread_mutex_lock(&r->mutex);
+	r->stop = true;
+	pthread_cond_signal(&r->wakeup);
+	pthread_mutex_unlock(&r->mutex);
+	pthread_join(r->thread, NULL);
+	fputs(r->footer, r->file);
+	fclose(r->file);
+	pthread_cond_destroy(&r->wakeup);
+	pthread_mutex_destroy(&r->mutex);
+	_rot_free(r);
+}
+
+bool _clog_rotatingsink(LogSink *const s, const char *const filename,
+                        const RotationPolicy *const policy,
+                        const char *const header, const char *const footer,
+                        const char delim) {
+	struct rotfile *const r = calloc(1, sizeof *r);
+	if(r == NULL)
+		return false;
+	r->pathsize = strlen(filename) + ROTATE_PATHEXTRA;
+	r->policy = *policy;
+	r->path = strdup(filename);
+	r->name = strdup(filename);
+	r->header = strdup(header);
+	r->footer = strdup(footer);
+	r->from = malloc(r->pathsize);
+	r->to = malloc(r->pathsize);
+	if(!r->path || !r->name || !r->header || !r->footer || !r->from || !r->to
+	   || (r->file = _z_open(filename, &policy->stream)) == NULL) {
+		_rot_free(r);
+		return false;
+	}
+	/* the rotated files get their index before the suffix */
+	const char *const suffix = _rot_suffix(policy->stream.compress);
+	const size_t namelen = strlen(r->name), suffixlen = strlen(suffix);
+	if(suffixlen && namelen > suffixlen
+	   && strcmp(r->name + namelen - suffixlen, suffix) == 0)
+		r->name[namelen - suffixlen] = '\0';
+	r->headerlen = strlen(header);
+	fwrite(header, 1, r->headerlen, r->file);
+	r->size = r->headerlen;
+	r->next = _rot_open(r); /* the thread would retry if it failed */
+	r->fresh = true;
+	r->delim = delim;
+	clock_gettime(CLOCK_REALTIME, &r->since);
+	atomic_init(&r->due, false);
+	pthread_mutex_init(&r->mutex, NULL);
+	pthread_cond_init(&r->wakeup, NULL);
+	if(pthread_create(&r->thread, NULL, _rot_run, r) != 0) {
+		if(r->next) {
+			fclose(r->next);
+			remove(r->from);
+		}
+		fclose(r->file);
+		pthread_cond_destroy(&r->wakeup);
+		pthread_mutex_destroy(&r->mutex);
+		_rot_free(r);
+		return false;
+	}
+	*s = (LogSink) {_rot_write, _rot_flush, _rot_close, r};
+	return true;
+}
+
+
+/* Memory-mapped file: the writers reserve their room by moving the file
+   offset, once the segments it spans are mapped, and copy their record in the
+   mapping; a record whose segments cannot be mapped is dropped, with no room
+   left for it. The file is mapped by segments; the writer that completes a
+   segment unmaps it */
+struct segment {
+	char *addr;
+	atomic_size_t index;
+	atomic_size_t committed; /* count of bytes written in the segment */
+};
+#define MMAP_SEGMENTS 16
+struct mmapfile {
+	struct segment segments[MMAP_SEGMENTS];
+	atomic_ullong offset;
+	atomic_ulong dropped;
+	size_t segsize;
+	pthread_mutex_t mutex;
+	int fd;
+	char pad[4];
+};
+
+/* Maps a segment, unless it is mapped already; returns NULL if it cannot be,
+   or if it is behind the offset (for a writer that read the offset before
+   others moved it) */
+static struct segment *_mmap_segment(struct mmapfile *const m,
+                                     const size_t index) {
+	struct segment *const seg = &m->segments[index % MMAP_SEGMENTS];
+	for(;;) {
+		if(atomic_load_explicit(&seg->index, memory_order_acquire) == index)
+			return seg->addr ? seg : NULL;
+		pthread_mutex_lock(&m->mutex);
+		/* no room is reserved in a segment not mapped yet: it cannot be
+		   passed while the lock is held */
+		if(index < atomic_load(&m->offset) / m->segsize) {
+			pthread_mutex_unlock(&m->mutex);
+			return NULL;
+		}
+		if(atomic_load(&seg->index) != index) {
+			if(seg->addr) {
+				/* still used by writers MMAP_SEGMENTS segments behind */
+				pthread_mutex_unlock(&m->mutex);
+				sched_yield();
+				continue;
+			}
+			const off_t off = (off_t) (index * m->segsize);
+			void *addr = MAP_FAILED;
+			if(posix_fallocate(m->fd, off, (off_t) m->segsize) == 0)
+				addr = mmap(NULL, m->segsize, PROT_WRITE, MAP_SHARED, m->fd,
+				            off);
+			seg->addr = addr == MAP_FAILED ? NULL : addr;
+			atomic_store(&seg->committed, 0);
+			atomic_store_explicit(&seg->index, index, memory_order_release);
+		}
+		pthread_mutex_unlock(&m->mutex);
+	}
+}
+
+/* Tells whether the segments from off to off + len are mapped */
+static bool _mmap_mapped(struct mmapfile *const m, const unsigned long long off,
+                         const size_t len) {
+	const size_t last = (size_t) ((off + len - 1) / m->segsize);
+	for(size_t i = (size_t) (off / m->segsize); i <= last; ++i) {
+		if(_mmap_segment(m, i) == NULL)
+			return false;
+	}
+	return true;
+}
+
+static void _mmap_write(void *const u, const char *data, size_t len) {
+	struct mmapfile *const m = u;
+	if(len == 0)
+		return;
+	/* a mapped segment is not unmapped before all its room is written */
+	unsigned long long off = atomic_load_explicit(&m->offset,
+	                                              memory_order_relaxed);
+	for(;;) {
+		if(!_mmap_mapped(m, off, len)) {
+			const unsigned long long now = atomic_load(&m->offset);
+			if(now == off) {
+				atomic_fetch_add_explicit(&m->dropped, 1,
+				                          memory_order_relaxed);
+				return;
+			}
+			off = now;
+		} else if(atomic_compare_exchange_weak_explicit(&m->offset, &off,
+		                                                off + len,
+		                                                memory_order_relaxed,
+		                                                memory_order_relaxed)) {
+			break;
+		}
+	}
+	while(len) {
+		/* the record can span several segments */
+		const size_t index = (size_t) (off / m->segsize);
+		const size_t start = (size_t) (off % m->segsize);
+		const size_t n = len < m->segsize - start ? len : m->segsize - start;
+		struct segment *const seg = _mmap_segment(m, index);
+		if(seg) {
+			memcpy(seg->addr + start, data, n);
+			if(atomic_fetch_add_explicit(&seg->committed, n,
+			                             memory_order_acq_rel) + n
+			   == m->segsize) {
+				/* the segment is full and no one else writes to it */
+				pthread_mutex_lock(&m->mutex);
+				munmap(seg->addr, m->segsize);
+				seg->addr = NULL;
+				pthread_mutex_unlock(&m->mutex);
+			}
+		}
+		data += n;
+		len -= n;
+		off += n;
+	}
+}
+
+static void _mmap_close(void *const u) {
+	struct mmapfile *const m = u;
+	for(size_t i = 0; i < MMAP_SEGMENTS; ++i) {
+		if(m->segments[i].addr)
+			munmap(m->segments[i].addr, m->segsize);
+	}
+	/* cut the preallocated room that was not used */
+	ftruncate(m->fd, (off_t) atomic_load(&m->offset));
+	close(m->fd);
+	pthread_mutex_destroy(&m->mutex);
+	free(m);
+}
+
+bool _clog_mmapsink(LogSink *const s, const char *const filename,
+                    const size_t segsize) {
+	struct mmapfile *const m = malloc(sizeof *m);
+	if(m == NULL)
+		return false;
+	const long pagesize = sysconf(_SC_PAGESIZE);
+	m->segsize = (segsize + (size_t) pagesize - 1) / (size_t) pagesize
+	             * (size_t) pagesize;
+	if(m->segsize == 0)
+		m->segsize = (size_t) pagesize;
+	m->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0666);
+	if(m->fd < 0) {
+		free(m);
+		return false;
+	}
+	atomic_init(&m->offset, 0);
+	atomic_init(&m->dropped, 0);
+	pthread_mutex_init(&m->mutex, NULL);
+	for(size_t i = 0; i < MMAP_SEGMENTS; ++i) {
+		m->segments[i].addr = NULL;
+		/* an index no writer will ask for */
+		atomic_init(&m->segments[i].index, (size_t) -1);
+	}
+	if(_mmap_segment(m, 0) == NULL) {
+		_mmap_close(m);
+		return false;
+	}
+	/* the mapping needs no flush: the kernel writes it back */
+	*s = (LogSink) {_mmap_write, NULL, _mmap_close, m};
+	return true;
+}
+
+unsigned long _clog_mmapdrops(const LogSink *const s) {
+	return s->write == _mmap_write
+	       ? atomic_load_explicit(&((struct mmapfile*) s->userdata)->dropped,
+	                              memory_order_relaxed)
+	       : 0;
+}
+
+
+#include <PUCA/end.h>
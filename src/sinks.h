@@ -0,0 +1,181 @@
+/**
+ * \file sinks.h
+ * \author joH1
+ * \version 0.1
+ *
+ * Internal functions to create the built-in sinks of the log system: plain
+ * files, rotated files, already opened streams, memory-mapped files and
+ * sockets.
+ */
+
+#ifndef CLOG_SINKS_H
+#define CLOG_SINKS_H
+
+#include "clog.h" /* for LogSink */
+
+#include <stddef.h> /* for size_t */
+#include <stdio.h> /* for FILE */
+#include <sys/uio.h> /* for struct iovec */
+
+#include <PUCA/funcattrs.h> /* for NOTNULL, PURE */
+
+
+
+/**
+ * \brief Creates a sink writing to a new file.
+ *
+ * \param[out] sink     The sink to set up
+ * \param[in]  filename The path to the file, truncated if it exists
+ *
+ * \return \c true iff the file could be opened.
+ */
+bool _clog_filesink(LogSink *sink, const char *filename) NOTNULL(1, 2);
+
+/**
+ * \brief Creates a sink writing to a file compressed while it is written.
+ *
+ * The records are compressed by blocks, each flushed to the file once full.
+ *
+ * \param[out] sink     The sink to set up
+ * \param[in]  filename The path to the file, truncated if it exists
+ * \param[in]  policy   The compression policy
+ *
+ * \return \c true iff the file could be opened, with a codec that was built.
+ */
+bool _clog_compressedsink(LogSink *sink, const char *filename,
+                          const CompressionPolicy *policy) NOTNULL(1, 2, 3);
+
+/**
+ * \brief Creates a sink writing to a file rotated as per a policy.
+ *
+ * The sink writes itself the header of the format to each new file and the
+ * footer to each rotated one; the first header and the last footer are
+ * expected to go through the sink functions.
+ *
+ * \param[out] sink     The sink to set up
+ * \param[in]  filename The path to the file, truncated if it exists
+ * \param[in]  policy   The rotation policy
+ * \param[in]  header   The header of the output format
+ * \param[in]  footer   The footer of the output format
+ * \param[in]  delim    The delimiter that starts the records, to skip at the
+ *                      beginning of a file; or \c '\0' if there is none
+ *
+ * \return \c true iff the file could be opened.
+ */
+bool _clog_rotatingsink(LogSink *sink, const char *filename,
+                        const RotationPolicy *policy, const char *header,
+                        const char *footer, char delim) NOTNULL(1, 2, 3, 4, 5);
+
+/**
+ * \brief Creates a sink writing to a stream, which is flushed but not closed
+ *        when the sink is.
+ *
+ * \param[out] sink   The sink to set up
+ * \param[in]  stream The stream
+ */
+void _clog_streamsink(LogSink *sink, FILE *stream) NOTNULL(1, 2);
+
+/**
+ * \brief Creates a sink writing to a memory-mapped file.
+ *
+ * The file is preallocated and mapped by segments; the concurrent writers
+ * reserve their room by moving the file offset atomically, once the segments
+ * are mapped: the records whose segments cannot be mapped are dropped, and
+ * counted. The preallocated room that was not used is cut when the sink is
+ * closed.
+ *
+ * \param[out] sink     The sink to set up
+ * \param[in]  filename The path to the file, truncated if it exists
+ * \param[in]  segsize  The size of a segment (rounded up to a multiple of the
+ *                      page size)
+ *
+ * \return \c true iff the file could be opened and mapped.
+ */
+bool _clog_mmapsink(LogSink *sink, const char *filename, size_t segsize)
+NOTNULL(1, 2);
+
+/**
+ * \brief Retrieves the count of records a memory-mapped sink dropped.
+ *
+ * \param[in] sink The sink
+ *
+ * \return The count of records dropped by a memory-mapped sink, as their
+ *         segments could not be mapped, or \c 0.
+ */
+unsigned long _clog_mmapdrops(const LogSink *sink) NOTNULL(1);
+
+/**
+ * \brief Creates a sink sending the records over a non-blocking socket.
+ *
+ * The records are queued, and sent by batches when the sink is flushed or
+ * enough of them are queued; those that do not fit in the queue are dropped.
+ *
+ * \param[out] sink      The sink to set up
+ * \param[in]  address   The \c host:port address, or the path of the socket
+ * \param[in]  type      The transport of the records
+ * \param[in]  backlog   The size of the queue, in bytes (\c 0 for the default)
+ * \param[in]  reconnect Whether a broken connection is opened again, rather
+ *                       than the next records dropped
+ *
+ * \return \c true iff the address could be resolved and the socket connected
+ *         (or its connection started).
+ */
+bool _clog_socketsink(LogSink *sink, const char *address, SocketType type,
+                      size_t backlog, bool reconnect) NOTNULL(1, 2);
+
+/**
+ * \brief Tells whether a sink sends each record as a datagram, which must not
+ *        be gathered with the others.
+ *
+ * \param[in] sink The sink
+ *
+ * \return \c true iff the sink is a UDP or Unix datagram socket sink.
+ */
+bool _clog_sinkdatagrams(const LogSink *sink) NOTNULL(1) PURE;
+
+/**
+ * \brief Tells whether a sink sends its records over a socket, which may drop
+ *        them.
+ *
+ * \param[in] sink The sink
+ *
+ * \return \c true iff the sink is a socket sink.
+ */
+bool _clog_sinksocket(const LogSink *sink) NOTNULL(1) PURE;
+
+/**
+ * \brief Retrieves the count of records a sink dropped.
+ *
+ * \param[in] sink The sink
+ *
+ * \return The count of records dropped by a socket or memory-mapped sink, or
+ *         \c 0.
+ */
+unsigned long _clog_sinkdrops(const LogSink *sink) NOTNULL(1);
+
+/**
+ * \brief Retrieves the stream a sink writes to.
+ *
+ * \param[in] sink The sink
+ *
+ * \return The stream of a file or stream sink, or \c NULL for any other sink.
+ */
+FILE *_clog_sinkfile(const LogSink *sink) NOTNULL(1) PURE;
+
+/**
+ * \brief Writes several records to a stream at once, by vectored writes to
+ *        its file descriptor.
+ *
+ * The stream is flushed first, for the records to stay in order.
+ *
+ * \param[in]     stream The stream
+ * \param[in,out] iov    The records, changed as they are written
+ * \param[in]     n      The count of records (at most \c IOV_MAX)
+ */
+void _clog_filewritev(FILE *stream, struct iovec *iov, int n) NOTNULL(1, 2);
+
+
+#include <PUCA/end.h>
+
+
+#endif /* CLOG_SINKS_H */
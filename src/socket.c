@@ -0,0 +1,345 @@
+#define _GNU_SOURCE /* for sendmmsg, SOCK_NONBLOCK, SOCK_CLOEXEC */
+
+#include "sinks.h"
+
+#include <errno.h> /* for errno, E* */
+#include <netdb.h> /* for getaddrinfo, freeaddrinfo */
+#include <poll.h> /* for poll */
+#include <stdatomic.h> /* for atomic_* */
+#include <stdlib.h> /* for malloc, realloc, free */
+#include <string.h> /* for memcpy, memmove, strrchr */
+#include <sys/socket.h> /* for socket, connect, send, sendmmsg */
+#include <sys/un.h> /* for sockaddr_un */
+#include <time.h> /* for clock_gettime */
+#include <unistd.h> /* for close */
+
+#include <PUCA/funcattrs.h> /* for NOTNULL */
+
+
+
+/* Socket: the records are queued, and sent from the oldest one by system
+   calls that do not block; the records that do not fit in the queue are
+   dropped. The queue starts past the records sent, and is moved back to the
+   start of its buffers only once it reaches their end. The address is
+   resolved once, when the sink is created */
+#define SOCKET_BACKLOG (1 << 20) /* the default size of the queue */
+#define SOCKET_BATCH 64 /* the records queued before they are sent, and the
+                           datagrams sent per system call */
+#define SOCKET_RETRY 1000000000LL /* ns between two connection attempts */
+#define SOCKET_LINGER 1000 /* ms to send the last records, when closed */
+struct socksink {
+	char *data; /* the records queued, back to back, from head to len */
+	size_t head;
+	size_t len;
+	size_t size;
+	size_t *lens; /* the lengths of the records queued, from first to nrecs
+	                 (what is left to send, for the first one) */
+	size_t first;
+	size_t nrecs;
+	size_t maxrecs;
+	long long retry; /* the time of the next connection attempt */
+	atomic_ulong dropped;
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	int fd; /* -1 while not connected */
+	SocketType type;
+	bool reconnect;
+	bool partial; /* the first record was partly sent */
+	char pad[2];
+};
+
+static long long _now(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static bool _sock_connect(struct socksink *const k) {
+	const int fd = socket(k->addr.ss_family,
+	                      (k->type == CLOG_SOCKET_TCP ? SOCK_STREAM : SOCK_DGRAM)
+	                      | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(fd < 0)
+		return false;
+	/* a TCP connection completes in the background; the records are sent
+	   once it does */
+	if(connect(fd, (const struct sockaddr*) &k->addr, k->addrlen) != 0
+	   && errno != EINPROGRESS) {
+		close(fd);
+		return false;
+	}
+	k->fd = fd;
+	return true;
+}
+
+static INLINE void _sock_drop(struct socksink *const k, const unsigned long n) {
+	atomic_fetch_add_explicit(&k->dropped, n, memory_order_relaxed);
+}
+
+/* Removes the first bytes of the queue, which were sent or dropped */
+static void _sock_consume(struct socksink *const k, const size_t n) {
+	size_t i = k->first, left = n;
+	while(i < k->nrecs && left >= k->lens[i])
+		left -= k->lens[i++];
+	if(left) {
+		k->lens[i] -= left;
+		k->partial = true;
+	} else if(i != k->first) {
+		k->partial = false;
+	}
+	k->first = i;
+	k->head += n;
+	if(k->head == k->len) {
+		/* empty: the next records start the buffers again */
+		k->head = k->len = 0;
+		k->first = k->nrecs = 0;
+	}
+}
+
+/* Moves the queue back to the start of its buffers */
+static void _sock_compact(struct socksink *const k) {
+	memmove(k->data, k->data + k->head, k->len - k->head);
+	k->len -= k->head;
+	k->head = 0;
+	memmove(k->lens, k->lens + k->first,
+	        (k->nrecs - k->first) * sizeof *k->lens);
+	k->nrecs -= k->first;
+	k->first = 0;
+}
+
+static void _sock_disconnect(struct socksink *const k) {
+	close(k->fd);
+	k->fd = -1;
+	k->retry = _now() + SOCKET_RETRY;
+	if(k->partial) {
+		/* the rest of a record would not make sense on its own */
+		_sock_drop(k, 1);
+		_sock_consume(k, k->lens[k->first]);
+	}
+	if(!k->reconnect && k->len > k->head) {
+		_sock_drop(k, k->nrecs - k->first);
+		_sock_consume(k, k->len - k->head);
+	}
+}
+
+static INLINE bool _sock_hardfail(const int e) {
+	return e != EAGAIN && e != EWOULDBLOCK && e != ENOBUFS && e != EINTR;
+}
+
+/* Sends the queue of a TCP socket, as much as it takes */
+static size_t _sock_sendstream(struct socksink *const k) {
+	const char *const data = k->data + k->head;
+	const size_t len = k->len - k->head;
+	size_t off = 0;
+	while(off < len) {
+		const ssize_t n = send(k->fd, data + off, len - off,
+		                       MSG_DONTWAIT | MSG_NOSIGNAL);
+		if(n < 0) {
+			if(errno == EINTR)
+				continue;
+			if(_sock_hardfail(errno)) {
+				_sock_consume(k, off);
+				_sock_disconnect(k);
+				return 0;
+			}
+			break;
+		}
+		off += (size_t) n;
+	}
+	return off;
+}
+
+/* Sends the queue of a datagram socket, by batches of datagrams */
+static size_t _sock_senddgrams(struct socksink *const k) {
+	struct mmsghdr msgs[SOCKET_BATCH];
+	struct iovec iovs[SOCKET_BATCH];
+	size_t done = k->first, off = 0;
+	while(done < k->nrecs) {
+		unsigned int n = 0;
+		for(size_t o = k->head + off; n < SOCKET_BATCH && done + n < k->nrecs;
+		    ++n) {
+			iovs[n] = (struct iovec) {k->data + o, k->lens[done + n]};
+			memset(&msgs[n], 0, sizeof msgs[n]);
+			msgs[n].msg_hdr.msg_iov = &iovs[n];
+			msgs[n].msg_hdr.msg_iovlen = 1;
+			o += k->lens[done + n];
+		}
+		int sent = sendmmsg(k->fd, msgs, n, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if(sent < 0) {
+			const int e = errno;
+			if(!_sock_hardfail(e))
+				break;
+			/* the first datagram cannot be sent: it is dropped, and the
+			   socket is connected again, unless the datagram only was too
+			   long */
+			_sock_drop(k, 1);
+			off += k->lens[done++];
+			if(e != EMSGSIZE) {
+				_sock_consume(k, off);
+				_sock_disconnect(k);
+				return 0;
+			}
+			continue;
+		}
+		for(; sent > 0; --sent)
+			off += k->lens[done++];
+	}
+	return off;
+}
+
+static void _sock_send(struct socksink *const k) {
+	if(k->nrecs == k->first)
+		return;
+	if(k->fd < 0) {
+		const long long now = _now();
+		if(!k->reconnect || now < k->retry)
+			return;
+		if(!_sock_connect(k)) {
+			k->retry = now + SOCKET_RETRY;
+			return;
+		}
+	}
+	const size_t n = k->type == CLOG_SOCKET_TCP ? _sock_sendstream(k)
+	                                            : _sock_senddgrams(k);
+	if(n)
+		_sock_consume(k, n);
+}
+
+static void _sock_write(void *const u, const char *const data,
+                        const size_t len) {
+	struct socksink *const k = u;
+	if(k->len + len > k->size)
+		_sock_send(k); /* to make room */
+	if(k->len - k->head + len > k->size || (k->fd < 0 && !k->reconnect)) {
+		_sock_drop(k, 1);
+		return;
+	}
+	if(k->len + len > k->size || (k->nrecs == k->maxrecs && k->first))
+		_sock_compact(k);
+	if(k->nrecs == k->maxrecs) {
+		const size_t max = k->maxrecs ? 2 * k->maxrecs : SOCKET_BATCH;
+		size_t *const lens = realloc(k->lens, max * sizeof *lens);
+		if(lens == NULL) {
+			_sock_drop(k, 1);
+			return;
+		}
+		k->lens = lens;
+		k->maxrecs = max;
+	}
+	memcpy(k->data + k->len, data, len);
+	k->len += len;
+	k->lens[k->nrecs++] = len;
+	if(k->nrecs - k->first >= SOCKET_BATCH)
+		_sock_send(k);
+}
+
+static void _sock_flush(void *const u) {
+	_sock_send(u);
+}
+
+static void _sock_close(void *const u) {
+	struct socksink *const k = u;
+	/* wait a little for the last records to be sent */
+	const long long deadline = _now() + SOCKET_LINGER * 1000000LL;
+	_sock_send(k);
+	for(long long now; k->nrecs > k->first && k->fd >= 0
+	                   && (now = _now()) < deadline;) {
+		struct pollfd p = {k->fd, POLLOUT, 0};
+		if(poll(&p, 1, (int) ((deadline - now) / 1000000) + 1) <= 0)
+			break;
+		_sock_send(k);
+	}
+	if(k->fd >= 0)
+		close(k->fd);
+	free(k->data);
+	free(k->lens);
+	free(k);
+}
+
+/* Resolves a host:port address, for the first successful connection */
+static bool _sock_resolve(struct socksink *const k, const char *const address) {
+	const char *const colon = strrchr(address, ':');
+	if(colon == NULL || colon == address)
+		return false;
+	size_t hostlen = (size_t) (colon - address);
+	const char *host = address;
+	if(*host == '[' && host[hostlen - 1] == ']') {
+		++host;
+		hostlen -= 2;
+	}
+	char *const name = malloc(hostlen + 1);
+	if(name == NULL)
+		return false;
+	memcpy(name, host, hostlen);
+	name[hostlen] = '\0';
+	const struct addrinfo hints = {
+		.ai_socktype = k->type == CLOG_SOCKET_TCP ? SOCK_STREAM : SOCK_DGRAM
+	};
+	struct addrinfo *res;
+	const int r = getaddrinfo(name, colon + 1, &hints, &res);
+	free(name);
+	if(r != 0)
+		return false;
+	for(const struct addrinfo *i = res; i && k->fd < 0; i = i->ai_next) {
+		if(i->ai_addrlen > sizeof k->addr)
+			continue;
+		memcpy(&k->addr, i->ai_addr, i->ai_addrlen);
+		k->addrlen = i->ai_addrlen;
+		_sock_connect(k);
+	}
+	freeaddrinfo(res);
+	return k->fd >= 0;
+}
+
+bool _clog_socketsink(LogSink *const s, const char *const address,
+                      const SocketType type, const size_t backlog,
+                      const bool reconnect) {
+	struct socksink *const k = calloc(1, sizeof *k);
+	if(k == NULL)
+		return false;
+	k->size = backlog ? backlog : SOCKET_BACKLOG;
+	k->fd = -1;
+	k->type = type;
+	k->reconnect = reconnect;
+	atomic_init(&k->dropped, 0);
+	bool ok = (k->data = malloc(k->size)) != NULL;
+	if(ok && type == CLOG_SOCKET_UNIX) {
+		struct sockaddr_un *const un = (struct sockaddr_un*) &k->addr;
+		const size_t len = strlen(address);
+		ok = len < sizeof un->sun_path;
+		if(ok) {
+			un->sun_family = AF_UNIX;
+			memcpy(un->sun_path, address, len + 1);
+			k->addrlen = (socklen_t) (offsetof(struct sockaddr_un, sun_path)
+			                          + len + 1);
+			ok = _sock_connect(k);
+		}
+	} else if(ok) {
+		ok = _sock_resolve(k, address);
+	}
+	if(!ok) {
+		free(k->data);
+		free(k);
+		return false;
+	}
+	*s = (LogSink) {_sock_write, _sock_flush, _sock_close, k};
+	return true;
+}
+
+bool _clog_sinkdatagrams(const LogSink *const s) {
+	return s->write == _sock_write
+	       && ((const struct socksink*) s->userdata)->type != CLOG_SOCKET_TCP;
+}
+
+bool _clog_sinksocket(const LogSink *const s) {
+	return s->write == _sock_write;
+}
+
+unsigned long _clog_sinkdrops(const LogSink *const s) {
+	return s->write == _sock_write
+	       ? atomic_load_explicit(&((struct socksink*) s->userdata)->dropped,
+	                              memory_order_relaxed)
+	       : _clog_mmapdrops(s);
+}
+
+
+#include <PUCA/end.h>
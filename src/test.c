@@ -1,15 +1,68 @@
+#define _POSIX_C_SOURCE 200809L /* for fileno, popen */
+
+#include <arpa/inet.h>
 #include <assert.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#ifdef CLOG_HAVE_ZLIB
+# include <zlib.h>
+#endif
 
 
 #include "clog.h"
 
 #define testlog(...) fprintf(stderr, __VA_ARGS__)
 
+static void _countlock(void *count) {
+	++*(int*)count;
+}
+
+static void _nounlock(void *count) {
+	(void) count; /* only the locks are counted */
+}
+
+static int _writes = 0, _flushes = 0;
+
+static void _countwrite(void *unused, const char *data, size_t len) {
+	(void) unused;
+	(void) data;
+	(void) len;
+	++_writes;
+}
+
+static void _countflush(void *unused) {
+	(void) unused;
+	++_flushes;
+}
+
+static void *_shardworker(void *unused) {
+	(void) unused;
+	info("from the worker");
+	return NULL;
+}
+
+static void _sitemsg(int i) {
+	debug("site message %d", i);
+}
+
+static void *_lockworker(void *unused) {
+	(void) unused;
+	for(int i = 0; i < 1000; ++i)
+		info("a message long enough to be interleaved %d", i);
+	return NULL;
+}
+
 int main(void) {
 
 	const char *const fname = "test.log";
+	const char *const fname_async = "test_async.log";
 
 	const LogLevel lvl = CLOG_DEBUG;
 	const char *const lname = "DEBUG";
@@ -17,6 +70,9 @@ int main(void) {
 	const char *const msg = "Test message log";
 	const char *const msg_blank = "\t\n\v\f\r ";
 
+	/* the calls are made apart from the asserts, which NDEBUG leaves out */
+	bool ok;
+
 	clog_init_file(fname, CLOG_FORMAT_TEXT, CLOG_ATTR_MINIMAL);
 
 	testlog("test clog_setfilter(%d)\n", lvl);
@@ -40,8 +96,889 @@ int main(void) {
 	debug(msg_blank);
 	// TODO check file content
 
-	testlog("end tests\n");
+	testlog("test filtered message skips the lock\n");
+	int lockcount = 0;
+	clog_setlock(_countlock);
+	clog_setunlock(_nounlock);
+	clog_setlockuserdata(&lockcount);
+	trace(msg);
+	assert(lockcount == 0);
+	debug(msg);
+	assert(lockcount == 1);
+	testlog("OK\n\n");
+
+	clog_term();
+
+	testlog("test asynchronous mode writes all the messages\n");
+	ok = clog_init_file_async(fname_async, CLOG_FORMAT_TEXT,
+	                          CLOG_ATTR_MINIMAL, 16);
+	assert(ok);
+	for(int i = 0; i < 100; ++i)
+		info("message %d", i);
+	clog_term();
+	FILE *const f = fopen(fname_async, "r");
+	assert(f != NULL);
+	int lines = 0;
+	for(int c; (c = fgetc(f)) != EOF;)
+		lines += c == '\n';
+	fclose(f);
+	assert(lines == 100);
+	testlog("OK\n\n");
+
+	testlog("test asynchronous mode is initialized again\n");
+	ok = clog_init_file_async(fname_async, CLOG_FORMAT_TEXT,
+	                          CLOG_ATTR_MINIMAL, 16);
+	assert(ok);
+	for(int i = 0; i < 100; ++i)
+		info("message %d", i);
+	/* the messages are written once flushed */
+	clog_flush();
+	FILE *const fa = fopen(fname_async, "r");
+	assert(fa != NULL);
+	lines = 0;
+	for(int c; (c = fgetc(fa)) != EOF;)
+		lines += c == '\n';
+	fclose(fa);
+	assert(lines == 100);
+	/* the queue and its thread go on, to the new file */
+	ok = clog_init_file_async(fname, CLOG_FORMAT_TEXT, CLOG_ATTR_MINIMAL,
+	                          16);
+	assert(ok);
+	for(int i = 0; i < 10; ++i)
+		info("message %d", i);
+	clog_term();
+	FILE *const fa2 = fopen(fname, "r");
+	assert(fa2 != NULL);
+	lines = 0;
+	for(int c; (c = fgetc(fa2)) != EOF;)
+		lines += c == '\n';
+	fclose(fa2);
+	assert(lines == 10);
+	testlog("OK\n\n");
+
+	testlog("test deferred formatting copies the arguments\n");
+	clog_setdeferred(true);
+	ok = clog_init_file_async(fname_async, CLOG_FORMAT_TEXT,
+	                          CLOG_ATTR_MINIMAL, 16);
+	assert(ok);
+	char arg[] = "before";
+	info("%s|%5.1f|%-*d|%c", arg, 2.3, 4, 42, '!');
+	strcpy(arg, "after");
+	clog_term();
+	clog_setdeferred(false);
+	char content[64] = "";
+	FILE *const fd = fopen(fname_async, "r");
+	assert(fd != NULL);
+	ok = fgets(content, sizeof content, fd) != NULL;
+	assert(ok);
+	fclose(fd);
+	assert(strcmp(content, "INFO    -- before|  2.3|42  |!\n") == 0);
+	testlog("OK\n\n");
+
+	testlog("test memory-mapped log file is cut to its contents\n");
+	ok = clog_init_mmap(fname_async, CLOG_FORMAT_TEXT, CLOG_ATTR_MINIMAL,
+	                    4096);
+	assert(ok);
+	for(int i = 0; i < 1000; ++i)
+		info("message %d", i);
+	clog_term();
+	FILE *const fm = fopen(fname_async, "r");
+	assert(fm != NULL);
+	lines = 0;
+	int last = EOF;
+	for(int c; (c = fgetc(fm)) != EOF; last = c)
+		lines += c == '\n';
+	fclose(fm);
+	assert(lines == 1000 && last == '\n');
+	testlog("OK\n\n");
+
+	testlog("test memory-mapped records are dropped past the file limit\n");
+	const bool mapped = clog_init_mmap(fname_async, CLOG_FORMAT_TEXT,
+	                                   CLOG_ATTR_MINIMAL, 4096);
+	assert(mapped);
+	/* the next segments cannot be allocated past the limit */
+	struct rlimit fsize;
+	getrlimit(RLIMIT_FSIZE, &fsize);
+	const struct rlimit capped = {4096, fsize.rlim_max};
+	signal(SIGXFSZ, SIG_IGN);
+	setrlimit(RLIMIT_FSIZE, &capped);
+	for(int i = 0; i < 1000; ++i)
+		info("message %d", i);
+	const unsigned long mdrops = clog_getsinkdrops(0);
+	clog_term();
+	setrlimit(RLIMIT_FSIZE, &fsize);
+	signal(SIGXFSZ, SIG_DFL);
+	assert(mdrops > 0);
+	FILE *const fmd = fopen(fname_async, "r");
+	assert(fmd != NULL);
+	lines = 0;
+	last = EOF;
+	for(int c; (c = fgetc(fmd)) != EOF; last = c) {
+		assert(c != '\0'); /* no room is left for the records dropped */
+		lines += c == '\n';
+	}
+	fclose(fmd);
+	assert(lines == 1000 - (int) mdrops && last == '\n');
+	testlog("OK\n\n");
+
+	testlog("test each sink filters and formats the messages\n");
+	ok = clog_init_file(fname_async, CLOG_FORMAT_TEXT, CLOG_ATTR_MINIMAL);
+	assert(ok);
+	clog_setsinklevel(0, CLOG_WARNING);
+	const int sink = clog_addsink_file(fname, CLOG_FORMAT_CSV,
+	                                   CLOG_ATTR_MINIMAL, CLOG_DEBUG);
+	assert(sink > 0 && clog_getsinklevel(sink) == CLOG_DEBUG);
+	info("to the CSV sink %d", sink);
+	warning("to both sinks");
+	clog_term();
+	FILE *const ft = fopen(fname_async, "r");
+	assert(ft != NULL);
+	ok = fgets(content, sizeof content, ft) != NULL;
+	assert(ok);
+	assert(strcmp(content, "WARNING -- to both sinks\n") == 0);
+	ok = fgets(content, sizeof content, ft) == NULL;
+	assert(ok);
+	fclose(ft);
+	FILE *const fc = fopen(fname, "r");
+	assert(fc != NULL);
+	ok = fgets(content, sizeof content, fc) != NULL;
+	assert(ok);
+	assert(strcmp(content, "Level name\tMessage content\n") == 0);
+	ok = fgets(content, sizeof content, fc) != NULL;
+	assert(ok);
+	assert(strcmp(content, "INFO\tto the CSV sink 1\n") == 0);
+	ok = fgets(content, sizeof content, fc) != NULL;
+	assert(ok);
+	assert(strcmp(content, "WARNING\tto both sinks\n") == 0);
+	fclose(fc);
+	testlog("OK\n\n");
+
+	testlog("test rotated files start with the header of the format\n");
+	const RotationPolicy policy = {64, 0, 1, CLOG_COMPRESS_NONE, {CLOG_COMPRESS_NONE, 0, 0}};
+	ok = clog_init_file_rotating(fname_async, CLOG_FORMAT_CSV,
+	                             CLOG_ATTR_MINIMAL, &policy);
+	assert(ok);
+	for(int i = 0; i < 10; ++i)
+		info("message %d", i);
+	clog_term();
+	char rotated[32];
+	snprintf(rotated, sizeof rotated, "%s.1", fname_async);
+	FILE *const fr = fopen(rotated, "r");
+	assert(fr != NULL);
+	ok = fgets(content, sizeof content, fr) != NULL;
+	assert(ok);
+	assert(strcmp(content, "Level name\tMessage content\n") == 0);
+	fclose(fr);
+	testlog("OK\n\n");
+
+	testlog("test JSON and XML messages are escaped\n");
+	ok = clog_init_file(fname, CLOG_FORMAT_JSON, CLOG_ATTR_MINIMAL);
+	assert(ok);
+	clog_addsink_file(fname_async, CLOG_FORMAT_XML, CLOG_ATTR_MINIMAL,
+	                  CLOG_TRACE);
+	info("a \"quoted\" <tag> & a\\b\ttab, and a long enough clean run");
+	clog_term();
+	char output[256];
+	FILE *const fj = fopen(fname, "r");
+	assert(fj != NULL);
+	output[fread(output, 1, sizeof output - 1, fj)] = '\0';
+	assert(strstr(output, "\"msg\": \"a \\\"quoted\\\" <tag> & a\\\\b\\ttab, "
+	                      "and a long enough clean run\"\n") != NULL);
+	fclose(fj);
+	FILE *const fx = fopen(fname_async, "r");
+	assert(fx != NULL);
+	output[fread(output, 1, sizeof output - 1, fx)] = '\0';
+	assert(strstr(output, ">a &quot;quoted&quot; &lt;tag&gt; &amp; a\\b\ttab, "
+	                      "and a long enough clean run</message>\n") != NULL);
+	fclose(fx);
+	testlog("OK\n\n");
+
+	testlog("test NDJSON records are one object per line\n");
+	ok = clog_init_file(fname, CLOG_FORMAT_NDJSON, CLOG_ATTR_FILE);
+	assert(ok);
+	info("\nfirst");
+	logmsg("test.c", 42, "main", CLOG_WARNING, "second");
+	clog_term();
+	FILE *const fn = fopen(fname, "r");
+	assert(fn != NULL);
+	ok = fgets(output, sizeof output, fn) != NULL;
+	assert(ok);
+	assert(strstr(output, ",\"level\":\"INFO\",\"msg\":\"first\"}\n") != NULL);
+	ok = fgets(output, sizeof output, fn) != NULL;
+	assert(ok);
+	assert(strcmp(output, "{\"file\":\"test.c\",\"line\":42,"
+	                      "\"level\":\"WARNING\",\"msg\":\"second\"}\n") == 0);
+	ok = fgets(output, sizeof output, fn) == NULL;
+	assert(ok);
+	fclose(fn);
+	testlog("OK\n\n");
+
+	testlog("test the fields are rendered by each format\n");
+	for(int async = 0; async < 2; ++async) {
+		ok = async ? clog_init_file_async(fname_async, CLOG_FORMAT_TEXT,
+		                                  CLOG_ATTR_MINIMAL, 16)
+		           : clog_init_file(fname_async, CLOG_FORMAT_TEXT,
+		                            CLOG_ATTR_MINIMAL);
+		assert(ok);
+		ok = clog_addsink_file(fname, CLOG_FORMAT_NDJSON, CLOG_ATTR_MINIMAL,
+		                       CLOG_TRACE) > 0;
+		assert(ok);
+		char req[] = "a b";
+		clog_kv(CLOG_INFO, "served", CLOG_STR("req", req),
+		        CLOG_INT("delta", -3), CLOG_DOUBLE("ratio", 0.1),
+		        CLOG_BOOL("ok", true));
+		req[0] = 'c'; /* the strings of the fields are copied */
+		clog_term();
+		FILE *const fk = fopen(fname_async, "r");
+		assert(fk != NULL);
+		ok = fgets(output, sizeof output, fk) != NULL;
+		assert(ok);
+		assert(strcmp(output, "INFO    -- served req=\"a b\" delta=-3 "
+		                      "ratio=0.1 ok=true\n") == 0);
+		fclose(fk);
+		FILE *const fl = fopen(fname, "r");
+		assert(fl != NULL);
+		ok = fgets(output, sizeof output, fl) != NULL;
+		assert(ok);
+		assert(strcmp(output, "{\"level\":\"INFO\",\"msg\":\"served\","
+		                      "\"req\":\"a b\",\"delta\":-3,\"ratio\":0.1,"
+		                      "\"ok\":true}\n") == 0);
+		fclose(fl);
+	}
+	testlog("OK\n\n");
+
+	testlog("test the identity of the thread is rendered\n");
+	for(int async = 0; async < 2; ++async) {
+		const OutputAttribute ida = CLOG_ATTR_THREAD | CLOG_ATTR_CPU;
+		ok = async ? clog_init_file_async(fname_async, CLOG_FORMAT_TEXT,
+		                                  ida, 16)
+		           : clog_init_file(fname_async, CLOG_FORMAT_TEXT, ida);
+		assert(ok);
+		ok = clog_addsink_file(fname, CLOG_FORMAT_NDJSON, CLOG_ATTR_THREAD,
+		                       CLOG_TRACE) > 0;
+		assert(ok);
+		clog_setthreadname("a <tester>");
+		info("named");
+		clog_setthreadname(NULL);
+		info("anonymous");
+		clog_term();
+		unsigned int tid, tid2;
+		int cpu, end = 0;
+		FILE *const fid = fopen(fname_async, "r");
+		assert(fid != NULL);
+		ok = fgets(output, sizeof output, fid) != NULL;
+		assert(ok);
+		/* the name is sanitized, as it is output as is */
+		ok = sscanf(output, "(%u a__tester_@%d) INFO    -- named\n%n",
+		            &tid, &cpu, &end) == 2 && output[end] == '\0';
+		assert(ok);
+		assert(cpu >= 0);
+		ok = fgets(output, sizeof output, fid) != NULL;
+		assert(ok);
+		end = 0;
+		ok = sscanf(output, "(%u@%d) INFO    -- anonymous\n%n",
+		            &tid2, &cpu, &end) == 2 && output[end] == '\0';
+		assert(ok);
+		assert(tid2 == tid);
+		fclose(fid);
+		FILE *const fnd = fopen(fname, "r");
+		assert(fnd != NULL);
+		ok = fgets(output, sizeof output, fnd) != NULL;
+		assert(ok);
+		end = 0;
+		ok = sscanf(output, "{\"tid\":%u,\"thread\":\"a__tester_\","
+		                    "\"level\":\"INFO\",\"msg\":\"named\"}\n%n",
+		            &tid2, &end) == 1 && output[end] == '\0';
+		assert(ok);
+		assert(tid2 == tid);
+		fclose(fnd);
+	}
+	testlog("OK\n\n");
+
+	testlog("test binary records define their strings once\n");
+	ok = clog_init_file(fname, CLOG_FORMAT_BINARY, CLOG_ATTR_FILE);
+	assert(ok);
+	for(int i = 0; i < 2; ++i)
+		info("binary %d", i);
+	clog_term();
+	FILE *const fb = fopen(fname, "rb");
+	assert(fb != NULL);
+	const size_t size = fread(output, 1, sizeof output, fb);
+	fclose(fb);
+	assert(size > 20 && memcmp(output, "CLOG", 4) == 0);
+	int defined = 0;
+	for(size_t i = 0; i + 9 <= size; ++i)
+		defined += memcmp(output + i, "binary %d", 9) == 0;
+	assert(defined == 1);
+	testlog("OK\n\n");
+
+	testlog("test async binary records define the keys logged\n");
+	/* the keys are copied in the slots, which are reused */
+	ok = clog_init_file_async(fname, CLOG_FORMAT_BINARY, CLOG_ATTR_MINIMAL,
+	                          1);
+	assert(ok);
+	clog_kv(CLOG_INFO, "keyed", CLOG_INT("alpha", 1));
+	clog_flush();
+	clog_kv(CLOG_INFO, "keyed", CLOG_INT("betaa", 2));
+	clog_flush();
+	clog_kv(CLOG_INFO, "keyed", CLOG_INT("gamma", 3));
+	clog_flush();
+	clog_kv(CLOG_INFO, "keyed", CLOG_INT("alpha", 4));
+	clog_term();
+	FILE *const fab = fopen(fname, "rb");
+	assert(fab != NULL);
+	const size_t asize = fread(output, 1, sizeof output, fab);
+	fclose(fab);
+	assert(asize > 20 && memcmp(output, "CLOG", 4) == 0);
+	const char *const keys[] = {"alpha", "betaa", "gamma"};
+	for(int k = 0; k < 3; ++k) {
+		defined = 0;
+		for(size_t i = 0; i + 5 <= asize; ++i)
+			defined += memcmp(output + i, keys[k], 5) == 0;
+		assert(defined == 1);
+	}
+	testlog("OK\n\n");
+
+	testlog("test the built-in lock serializes the messages\n");
+	clog_setlock(NULL);
+	clog_setunlock(NULL);
+	assert(clog_getlocktype() == CLOG_LOCK_ADAPTIVE);
+	ok = clog_init_file(fname, CLOG_FORMAT_TEXT, CLOG_ATTR_MINIMAL);
+	assert(ok);
+	pthread_t workers[4];
+	for(int i = 0; i < 4; ++i) {
+		ok = pthread_create(&workers[i], NULL, _lockworker, NULL) == 0;
+		assert(ok);
+	}
+	for(int i = 0; i < 4; ++i)
+		pthread_join(workers[i], NULL);
+	clog_term();
+	FILE *const fl = fopen(fname, "r");
+	assert(fl != NULL);
+	lines = 0;
+	while(fgets(output, sizeof output, fl) != NULL) {
+		assert(strncmp(output, "INFO    -- a message long enough", 32) == 0);
+		++lines;
+	}
+	fclose(fl);
+	assert(lines == 4000);
+	testlog("OK\n\n");
+
+	testlog("test the rate limited messages are counted\n");
+	ok = clog_init_file(fname, CLOG_FORMAT_TEXT, CLOG_ATTR_MINIMAL);
+	assert(ok);
+	clog_setratelimit(1, 3);
+	for(int i = 0; i < 11; ++i) {
+		if(i == 10)
+			clog_setratelimit(0, 0);
+		info("limited %d", i);
+	}
+	clog_term();
+	const char *const limited[] = {
+		"INFO    -- limited 0\n",
+		"INFO    -- limited 1\n",
+		"INFO    -- limited 2\n",
+		"INFO    -- 7 messages suppressed\n",
+		"INFO    -- limited 10\n"
+	};
+	FILE *const fq = fopen(fname, "r");
+	assert(fq != NULL);
+	for(int i = 0; i < 5; ++i) {
+		ok = fgets(output, sizeof output, fq) != NULL;
+		assert(ok);
+		assert(strcmp(output, limited[i]) == 0);
+	}
+	ok = fgets(output, sizeof output, fq) == NULL;
+	assert(ok);
+	fclose(fq);
+	testlog("OK\n\n");
+
+	testlog("test the repeated messages are collapsed\n");
+	ok = clog_init_file(fname, CLOG_FORMAT_TEXT, CLOG_ATTR_MINIMAL);
+	assert(ok);
+	clog_setcollapse(true);
+	for(int i = 0; i < 5; ++i)
+		warning("repeated %s", "message");
+	for(int i = 0; i < 3; ++i)
+		info("other %d", i < 2);
+	clog_term();
+	clog_setcollapse(false);
+	const char *const collapsed[] = {
+		"WARNING -- repeated message\n",
+		"WARNING -- last message repeated 4 times\n",
+		"INFO    -- other 1\n",
+		"INFO    -- last message repeated 1 times\n",
+		"INFO    -- other 0\n"
+	};
+	FILE *const fr2 = fopen(fname, "r");
+	assert(fr2 != NULL);
+	for(int i = 0; i < 5; ++i) {
+		ok = fgets(output, sizeof output, fr2) != NULL;
+		assert(ok);
+		assert(strcmp(output, collapsed[i]) == 0);
+	}
+	ok = fgets(output, sizeof output, fr2) == NULL;
+	assert(ok);
+	fclose(fr2);
+	testlog("OK\n\n");
+
+	testlog("test the filter levels of the modules\n");
+	ok = clog_init_file(fname, CLOG_FORMAT_TEXT, CLOG_ATTR_MINIMAL);
+	assert(ok);
+	clog_setfilterlevel(CLOG_INFO);
+	_sitemsg(0);
+	ok = clog_setfilterlevel_for("src/", CLOG_DEBUG);
+	assert(ok);
+	_sitemsg(1);
+	ok = clog_setfilterlevel_for("test.c", CLOG_ERROR);
+	assert(ok);
+	_sitemsg(2);
+	clog_unsetfilterlevel_for("test.c");
+	_sitemsg(3);
+	clog_unsetfilterlevel_for("src/");
+	_sitemsg(4);
+	clog_term();
+	clog_setfilterlevel(lvl);
+	FILE *const fv = fopen(fname, "r");
+	assert(fv != NULL);
+	ok = fgets(output, sizeof output, fv) != NULL;
+	assert(ok);
+	assert(strcmp(output, "DEBUG   -- site message 1\n") == 0);
+	ok = fgets(output, sizeof output, fv) != NULL;
+	assert(ok);
+	assert(strcmp(output, "DEBUG   -- site message 3\n") == 0);
+	ok = fgets(output, sizeof output, fv) == NULL;
+	assert(ok);
+	fclose(fv);
+	testlog("OK\n\n");
+
+	testlog("test the buffered records are written as per the flush policy\n");
+	ok = clog_init_file(fname, CLOG_FORMAT_TEXT, CLOG_ATTR_MINIMAL);
+	assert(ok);
+	const LogSink counted = {_countwrite, _countflush, NULL, NULL};
+	const int cs = clog_addsink(&counted, CLOG_FORMAT_TEXT, CLOG_ATTR_MINIMAL,
+	                            CLOG_DEBUG);
+	const FlushPolicy flush = {4096, CLOG_ERROR, 3, 0};
+	ok = cs > 0 && clog_setflushpolicy(cs, &flush);
+	assert(ok);
+	ok = !clog_setflushpolicy(cs + 1, &flush);
+	assert(ok);
+	_writes = _flushes = 0;
+	info("buffered");
+	info("buffered");
+	assert(_writes == 0 && _flushes == 0);
+	info("third record");
+	assert(_writes == 1 && _flushes == 1);
+	info("buffered");
+	error("flushed at once");
+	assert(_writes == 2 && _flushes == 2);
+	info("buffered");
+	clog_flush();
+	assert(_writes == 3 && _flushes == 3);
+	clog_term();
+	testlog("OK\n\n");
+
+	testlog("test the flight recorder keeps the messages filtered out\n");
+	ok = clog_init_file(fname, CLOG_FORMAT_TEXT, CLOG_ATTR_MINIMAL);
+	assert(ok);
+	clog_setfilterlevel(CLOG_INFO);
+	FILE *const frec = fopen(fname_async, "w");
+	assert(frec != NULL);
+	const RecorderPolicy recorder = {3, CLOG_DEBUG, CLOG_ATTR_MINIMAL,
+	                                 fileno(frec), false, ""};
+	ok = clog_setrecorder(&recorder);
+	assert(ok);
+	for(int i = 0; i < 4; ++i)
+		debug("recorded %d", i);
+	info("logged");
+	trace("not recorded");
+	ok = clog_dumprecorder() == 3;
+	assert(ok);
+	ok = clog_setrecorder(NULL);
+	assert(ok);
+	clog_term();
+	clog_setfilterlevel(lvl);
+	fclose(frec);
+	FILE *const fo = fopen(fname, "r");
+	assert(fo != NULL);
+	ok = fgets(output, sizeof output, fo) != NULL;
+	assert(ok);
+	assert(strcmp(output, "INFO    -- logged\n") == 0);
+	ok = fgets(output, sizeof output, fo) == NULL;
+	assert(ok);
+	fclose(fo);
+	FILE *const fd2 = fopen(fname_async, "r");
+	assert(fd2 != NULL);
+	ok = fgets(output, sizeof output, fd2) != NULL
+	     && strncmp(output, "---", 3) == 0;
+	assert(ok);
+	ok = fgets(output, sizeof output, fd2) != NULL;
+	assert(ok);
+	assert(strcmp(output, "DEBUG   -- recorded 2\n") == 0);
+	ok = fgets(output, sizeof output, fd2) != NULL;
+	assert(ok);
+	assert(strcmp(output, "DEBUG   -- recorded 3\n") == 0);
+	ok = fgets(output, sizeof output, fd2) != NULL;
+	assert(ok);
+	assert(strcmp(output, "INFO    -- logged\n") == 0);
+	ok = fgets(output, sizeof output, fd2) != NULL
+	     && strncmp(output, "---", 3) == 0;
+	assert(ok);
+	ok = fgets(output, sizeof output, fd2) == NULL;
+	assert(ok);
+	fclose(fd2);
+	testlog("OK\n\n");
 
+	testlog("test the prerendered headers of the levels and formats\n");
+	ok = clog_init_file(fname, CLOG_FORMAT_TEXT, CLOG_ATTR_COLORED);
+	assert(ok);
+	error("colored");
+	clog_addsink_file(fname_async, CLOG_FORMAT_XML, CLOG_ATTR_MINIMAL,
+	                  CLOG_TRACE);
+	fatal("framed");
 	clog_term();
+	FILE *const fh = fopen(fname, "r");
+	assert(fh != NULL);
+	ok = fgets(output, sizeof output, fh) != NULL;
+	assert(ok);
+	assert(strcmp(output, "\x1b[31mERROR   -- \x1b[0mcolored\n") == 0);
+	ok = fgets(output, sizeof output, fh) != NULL;
+	assert(ok);
+	assert(strcmp(output, "\x1b[1;31mFATAL   -- \x1b[0mframed\n") == 0);
+	fclose(fh);
+	FILE *const fxml = fopen(fname_async, "r");
+	assert(fxml != NULL);
+	ok = fgets(output, sizeof output, fxml) != NULL;
+	assert(ok);
+	assert(strncmp(output, "<?xml ", 6) == 0);
+	ok = fgets(output, sizeof output, fxml) != NULL;
+	assert(ok);
+	assert(strcmp(output, "<!DOCTYPE log SYSTEM \"clog.dtd\"><log>\n") == 0);
+	ok = fgets(output, sizeof output, fxml) != NULL;
+	assert(ok);
+	assert(strcmp(output, "\t<message level=\"FATAL\">framed</message>\n") == 0);
+	fclose(fxml);
+	testlog("OK\n\n");
+
+	testlog("test the sampled messages hold their rate\n");
+	ok = clog_init_file(fname, CLOG_FORMAT_TEXT, CLOG_ATTR_MINIMAL);
+	assert(ok);
+	clog_setsamplerate(CLOG_DEBUG, 10);
+	assert(clog_getsamplerate(CLOG_DEBUG) == 10);
+	for(int i = 0; i < 1000; ++i)
+		debug("sampled");
+	clog_setsamplerate(CLOG_DEBUG, 0);
+	assert(clog_getsamplerate(CLOG_DEBUG) == 1);
+	for(int i = 0; i < 1000; ++i)
+		clog_sampled(CLOG_INFO, 4, "sampled by the site");
+	clog_kv(CLOG_INFO, "all kept", CLOG_INT("n", 1));
+	clog_term();
+	FILE *const fs = fopen(fname, "r");
+	assert(fs != NULL);
+	int bylevel = 0, bysite = 0;
+	while(fgets(output, sizeof output, fs) != NULL) {
+		if(strcmp(output, "DEBUG   -- sampled sample_rate=10\n") == 0)
+			++bylevel;
+		else if(strcmp(output, "INFO    -- sampled by the site "
+		                       "sample_rate=4\n") == 0)
+			++bysite;
+		else
+			assert(strcmp(output, "INFO    -- all kept n=1\n") == 0);
+	}
+	fclose(fs);
+	assert(50 <= bylevel && bylevel <= 200);
+	assert(125 <= bysite && bysite <= 500);
+	testlog("OK\n\n");
+
+	testlog("test the socket sinks send syslog and journal records\n");
+	const char *const sockname = "test.sock";
+	struct sockaddr_un collector = {.sun_family = AF_UNIX};
+	strcpy(collector.sun_path, sockname);
+	unlink(sockname);
+	const int sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+	ok = sock >= 0 && bind(sock, (struct sockaddr*) &collector,
+	                       sizeof collector) == 0;
+	assert(ok);
+	clog_setsyslogident("test app", 16);
+	ok = clog_init_file(fname, CLOG_FORMAT_TEXT, CLOG_ATTR_MINIMAL);
+	assert(ok);
+	const int sls = clog_addsink_socket(sockname, CLOG_SOCKET_UNIX,
+	                                    CLOG_FORMAT_SYSLOG, CLOG_ATTR_MINIMAL,
+	                                    CLOG_WARNING, 0);
+	assert(sls > 0);
+	warning("to syslog");
+	clog_removesink(sls);
+	ok = clog_addsink_socket(sockname, CLOG_SOCKET_UNIX, CLOG_FORMAT_JOURNALD,
+	                         CLOG_ATTR_MINIMAL, CLOG_WARNING, 0) > 0;
+	assert(ok);
+	clog_kv(CLOG_ERROR, "two\nlines", CLOG_INT("user-id", 7));
+	clog_term();
+	ssize_t n = recv(sock, output, sizeof output - 1, MSG_DONTWAIT);
+	assert(n > 0);
+	output[n] = '\0';
+	char suffix[64];
+	snprintf(suffix, sizeof suffix, " test_app %ld - - to syslog\n",
+	         (long) getpid());
+	assert(strncmp(output, "<132>1 - ", 9) == 0);
+	assert(strcmp(output + strlen(output) - strlen(suffix), suffix) == 0);
+	n = recv(sock, output, sizeof output, MSG_DONTWAIT);
+	const char journal[] = "PRIORITY=3\nSYSLOG_IDENTIFIER=test_app\n"
+	                       "MESSAGE\n\x09\0\0\0\0\0\0\0two\nlines\n"
+	                       "USER_ID=7\n\n";
+	assert(n == sizeof journal - 1 && memcmp(output, journal, (size_t) n) == 0);
+	ok = recv(sock, output, sizeof output, MSG_DONTWAIT) < 0;
+	assert(ok);
+	close(sock);
+	unlink(sockname);
+	clog_setsyslogident(NULL, 1);
+	testlog("OK\n\n");
+
+	testlog("test a binary socket sink defines its strings again after a drop\n");
+	struct sockaddr_in local = {.sin_family = AF_INET};
+	local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t locallen = sizeof local;
+	const int lsock = socket(AF_INET, SOCK_STREAM, 0);
+	ok = lsock >= 0
+	     && bind(lsock, (struct sockaddr*) &local, sizeof local) == 0
+	     && listen(lsock, 1) == 0
+	     && getsockname(lsock, (struct sockaddr*) &local, &locallen) == 0;
+	assert(ok);
+	char address[32];
+	snprintf(address, sizeof address, "127.0.0.1:%d", ntohs(local.sin_port));
+	ok = clog_init_file(fname, CLOG_FORMAT_TEXT, CLOG_ATTR_MINIMAL);
+	assert(ok);
+	const int bs = clog_addsink_socket(address, CLOG_SOCKET_TCP,
+	                                   CLOG_FORMAT_BINARY, CLOG_ATTR_MINIMAL,
+	                                   CLOG_TRACE, 128);
+	assert(bs > 0);
+	char toolong[160];
+	memset(toolong, 'x', sizeof toolong - 1);
+	toolong[sizeof toolong - 1] = '\0';
+	/* the first record does not fit in the queue, with the strings it
+	   defines */
+	info("dropped %s", toolong);
+	info("dropped %s", "not");
+	assert(clog_getsinkdrops(bs) == 1);
+	clog_term();
+	const int conn = accept(lsock, NULL, NULL);
+	assert(conn >= 0);
+	size_t received = 0;
+	for(ssize_t r; received < sizeof output
+	               && (r = recv(conn, output + received,
+	                            sizeof output - received, 0)) > 0;)
+		received += (size_t) r;
+	close(conn);
+	close(lsock);
+	assert(received > 20 && memcmp(output, "CLOG", 4) == 0);
+	defined = 0;
+	for(size_t i = 0; i + 10 <= received; ++i)
+		defined += memcmp(output + i, "dropped %s", 10) == 0;
+	assert(defined == 1);
+	testlog("OK\n\n");
+
+	testlog("test the batches of the writer thread keep the records in order\n");
+	const BatchPolicy batch = {256, 10};
+	clog_setbatchpolicy(&batch);
+	ok = clog_init_file_async(fname_async, CLOG_FORMAT_TEXT,
+	                          CLOG_ATTR_MINIMAL, 1024);
+	assert(ok);
+	ok = clog_addsink_file(fname, CLOG_FORMAT_CSV, CLOG_ATTR_MINIMAL,
+	                       CLOG_TRACE) > 0;
+	assert(ok);
+	for(int i = 0; i < 1000; ++i)
+		info("record %d", i);
+	clog_term();
+	const BatchPolicy each = {1, 100};
+	clog_setbatchpolicy(&each);
+	FILE *const fbt = fopen(fname_async, "r");
+	FILE *const fbc = fopen(fname, "r");
+	assert(fbt != NULL && fbc != NULL);
+	ok = fgets(output, sizeof output, fbc) != NULL;
+	assert(ok); /* the CSV header */
+	for(int i = 0; i < 1000; ++i) {
+		char expected[32];
+		snprintf(expected, sizeof expected, "INFO    -- record %d\n", i);
+		ok = fgets(output, sizeof output, fbt) != NULL;
+		assert(ok);
+		assert(strcmp(output, expected) == 0);
+		snprintf(expected, sizeof expected, "INFO\trecord %d\n", i);
+		ok = fgets(output, sizeof output, fbc) != NULL;
+		assert(ok);
+		assert(strcmp(output, expected) == 0);
+	}
+	ok = fgetc(fbt) == EOF && fgetc(fbc) == EOF;
+	assert(ok);
+	fclose(fbt);
+	fclose(fbc);
+	testlog("OK\n\n");
+
+	testlog("test the statistics count the messages by level\n");
+	clog_setstats(true);
+	ok = clog_init_file(fname, CLOG_FORMAT_TEXT, CLOG_ATTR_MINIMAL);
+	assert(ok);
+	clog_setfilterlevel(CLOG_INFO);
+	LogStats before, after;
+	clog_getstats(&before);
+	for(int i = 0; i < 10; ++i) {
+		debug("filtered %d", i);
+		info("emitted %d", i);
+	}
+	clog_setratelimit(1, 2);
+	for(int i = 0; i < 5; ++i)
+		warning("limited");
+	clog_setratelimit(0, 0);
+	clog_getstats(&after);
+	clog_term();
+	clog_setfilterlevel(lvl);
+	clog_setstats(false);
+	assert(after.filtered[CLOG_DEBUG] - before.filtered[CLOG_DEBUG] == 10);
+	assert(after.emitted[CLOG_INFO] - before.emitted[CLOG_INFO] == 10);
+	assert(after.emitted[CLOG_WARNING] - before.emitted[CLOG_WARNING] == 2);
+	assert(after.ratelimited[CLOG_WARNING] - before.ratelimited[CLOG_WARNING]
+	       == 3);
+	assert(after.written[0] - before.written[0]
+	       == 10 * strlen("INFO    -- emitted 0\n")
+	          + 2 * strlen("WARNING -- limited\n"));
+	unsigned long long waits = 0, holds = 0;
+	for(int i = 0; i < CLOG_STATS_BUCKETS; ++i) {
+		waits += after.lockwait[i] - before.lockwait[i];
+		holds += after.lockhold[i] - before.lockhold[i];
+	}
+	assert(0 < waits && waits <= 12 && holds == waits);
+	testlog("OK\n\n");
+
+	testlog("test a compressed file holds the records\n");
+	const CompressionPolicy zpolicy = {CLOG_COMPRESS_GZIP, 0, 64};
+#ifdef CLOG_HAVE_ZLIB
+	ok = clog_init_file_compressed(fname, CLOG_FORMAT_TEXT, CLOG_ATTR_MINIMAL,
+	                               &zpolicy);
+	assert(ok);
+	for(int i = 0; i < 20; ++i)
+		info("compressed %d", i);
+	clog_term();
+	gzFile gz = gzopen(fname, "r");
+	assert(gz != NULL);
+	for(int i = 0; i < 20; ++i) {
+		char expected[64];
+		sprintf(expected, "INFO    -- compressed %d\n", i);
+		ok = gzgets(gz, output, sizeof output) != NULL;
+		assert(ok);
+		assert(strcmp(output, expected) == 0);
+	}
+	ok = gzgets(gz, output, sizeof output) == NULL;
+	assert(ok);
+	gzclose(gz);
+#else
+	/* the codec was not built */
+	ok = !clog_init_file_compressed(fname, CLOG_FORMAT_TEXT,
+	                                CLOG_ATTR_MINIMAL, &zpolicy);
+	assert(ok);
+#endif
+	testlog("OK\n\n");
+
+	testlog("test the main sink is replaced while threads log\n");
+	char reinitname[32];
+	for(int i = 0; i < 8; ++i) {
+		sprintf(reinitname, "%s.%d", fname, i);
+		ok = clog_init_file(reinitname, CLOG_FORMAT_TEXT, CLOG_ATTR_MINIMAL);
+		assert(ok);
+		for(int j = 0; i == 0 && j < 4; ++j) {
+			ok = pthread_create(&workers[j], NULL, _lockworker, NULL) == 0;
+			assert(ok);
+		}
+	}
+	for(int i = 0; i < 4; ++i)
+		pthread_join(workers[i], NULL);
+	clog_term();
+	/* no record is lost or split between two files */
+	lines = 0;
+	for(int i = 0; i < 8; ++i) {
+		sprintf(reinitname, "%s.%d", fname, i);
+		FILE *const fr = fopen(reinitname, "r");
+		assert(fr != NULL);
+		while(fgets(output, sizeof output, fr) != NULL) {
+			assert(strncmp(output, "INFO    -- a message long enough", 32) == 0);
+			++lines;
+		}
+		fclose(fr);
+		remove(reinitname);
+	}
+	assert(lines == 4000);
+	testlog("OK\n\n");
+
+	testlog("test each thread writes to its own shard\n");
+	ok = clog_init_sharded(fname, CLOG_FORMAT_CSV, CLOG_ATTR_MINIMAL);
+	assert(ok);
+	info("from the main thread");
+	pthread_t worker;
+	ok = pthread_create(&worker, NULL, _shardworker, NULL) == 0;
+	assert(ok);
+	pthread_join(worker, NULL);
+	clog_term();
+	const char *const shardmsgs[] = {
+		"INFO\tfrom the main thread\n",
+		"INFO\tfrom the worker\n"
+	};
+	for(int i = 0; i < 2; ++i) {
+		char shard[32];
+		snprintf(shard, sizeof shard, "%s.%d", fname, i);
+		FILE *const fs = fopen(shard, "r");
+		assert(fs != NULL);
+		ok = fgets(output, sizeof output, fs) != NULL;
+		assert(ok);
+		assert(strcmp(output, "Level name\tMessage content\n") == 0);
+		ok = fgets(output, sizeof output, fs) != NULL;
+		assert(ok);
+		assert(strcmp(output, shardmsgs[i]) == 0);
+		ok = fgets(output, sizeof output, fs) == NULL;
+		assert(ok);
+		fclose(fs);
+		remove(shard);
+	}
+	testlog("OK\n\n");
+
+	testlog("test the binary shards are decoded merged by time\n");
+	ok = clog_init_sharded(fname, CLOG_FORMAT_BINARY, CLOG_ATTR_TIME_NS);
+	assert(ok);
+	/* the first shard, that of the main thread, spans the others */
+	info("a message long enough to be interleaved first");
+	for(int i = 0; i < 4; ++i) {
+		ok = pthread_create(&workers[i], NULL, _lockworker, NULL) == 0;
+		assert(ok);
+	}
+	for(int i = 0; i < 4; ++i)
+		pthread_join(workers[i], NULL);
+	info("a message long enough to be interleaved last");
+	clog_term();
+	char decode[128];
+	snprintf(decode, sizeof decode, "./clog-decode -m -a TIME_NS %s.0 %s.1 %s.2"
+	         " %s.3 %s.4", fname, fname, fname, fname, fname);
+	FILE *const fdec = popen(decode, "r");
+	assert(fdec != NULL);
+	/* [HH:MM:SS.nnnnnnnnn] INFO ... : the times compare as strings, but
+	   across midnight */
+	char prev[32] = "";
+	lines = 0;
+	while(fgets(output, sizeof output, fdec) != NULL) {
+		assert(strncmp(output + 21, "INFO    -- a message long enough", 32)
+		       == 0);
+		output[20] = '\0';
+		assert(strcmp(prev, output) <= 0
+		       || (strncmp(prev, "[23:", 4) == 0
+		           && strncmp(output, "[00:", 4) == 0));
+		strcpy(prev, output);
+		++lines;
+	}
+	ok = pclose(fdec) == 0;
+	assert(ok);
+	assert(lines == 4002);
+	for(int i = 0; i < 5; ++i) {
+		char shard[32];
+		snprintf(shard, sizeof shard, "%s.%d", fname, i);
+		remove(shard);
+	}
+	testlog("OK\n\n");
+
+	testlog("end tests\n");
 	return 0;
 }